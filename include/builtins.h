@@ -18,6 +18,11 @@
   if (!check_signature(&name##_signature, argc, argv, comparison))             \
   return NIL_VAL
 
+// Typed entry point, only called once the VM has checked argc and every
+// argument type against the registry guard. Returns UNDEFINED_VAL to hand the
+// call back to the generic entry point
+#define xyl_builtin_fast(name) value_t builtin_fast_##name(value_t *argv)
+
 #define xyl_check_signature(name, comparison)                                  \
   check_signature(&name##_signature, argc, argv, comparison)
 
@@ -38,6 +43,25 @@ typedef struct {
   builtin_arg_t *args;
 } builtin_signature_t;
 
+typedef value_t (*builtin_fast_fn_t)(value_t *argv);
+
+#define BUILTIN_FAST_MAX_ARGS 2
+
+typedef struct {
+  const char *name;
+  builtin_fn_t function;
+  builtin_fast_fn_t fast;
+  int fast_argc;
+  value_type_t fast_args[BUILTIN_FAST_MAX_ARGS];
+  // Whether calls may be compiled to OP_CALL_BUILTIN
+  bool direct;
+  // Only defined by load_test_functions
+  bool test_only;
+} builtin_entry_t;
+
+extern const builtin_entry_t builtin_registry[];
+extern const int builtin_registry_count;
+
 typedef enum {
   ARGC_EXACT,
   ARGC_MORE_OR_EXACT,
@@ -76,6 +100,7 @@ xyl_builtin(write);
 
 // Vectors
 xyl_builtin(len);
+xyl_builtin_fast(len);
 xyl_builtin(append);
 xyl_builtin(pop);
 xyl_builtin(insert);
@@ -129,21 +154,35 @@ xyl_builtin(min);
 xyl_builtin(max);
 
 xyl_builtin(sin);
+xyl_builtin_fast(sin);
 xyl_builtin(cos);
+xyl_builtin_fast(cos);
 xyl_builtin(tan);
+xyl_builtin_fast(tan);
 xyl_builtin(asin);
+xyl_builtin_fast(asin);
 xyl_builtin(acos);
+xyl_builtin_fast(acos);
 xyl_builtin(atan);
+xyl_builtin_fast(atan);
 xyl_builtin(atan2);
+xyl_builtin_fast(atan2);
 
 xyl_builtin(sqrt);
+xyl_builtin_fast(sqrt);
 xyl_builtin(pow);
+xyl_builtin_fast(pow);
 xyl_builtin(log);
+xyl_builtin_fast(log);
 xyl_builtin(exp);
+xyl_builtin_fast(exp);
 
 xyl_builtin(floor);
+xyl_builtin_fast(floor);
 xyl_builtin(ceil);
+xyl_builtin_fast(ceil);
 xyl_builtin(round);
+xyl_builtin_fast(round);
 
 xyl_builtin(random);
 xyl_builtin(randomseed);
@@ -154,4 +193,26 @@ xyl_builtin(clock);
 xyl_builtin(sleep);
 xyl_builtin(localtime);
 
+// Runtime
+xyl_builtin(gc_stats);
+xyl_builtin(gc_policy);
+xyl_builtin(set_gc_policy);
+xyl_builtin(start_alloc_profile);
+xyl_builtin(stop_alloc_profile);
+xyl_builtin(write_alloc_profile);
+xyl_builtin(heap_snapshot);
+
+// Strings
+xyl_builtin(byte_at);
+xyl_builtin_fast(byte_at);
+xyl_builtin(from_bytes);
+
+// IO
+xyl_builtin(temp_dir);
+// Removes the directory made by temp_dir, along with the files in it
+void remove_temp_dir(void);
+
+// Runtime
+xyl_builtin(compact_heap);
+
 #endif
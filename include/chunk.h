@@ -89,12 +89,38 @@ typedef enum {
   OP_ASSERT_MSG,
 
   OP_CALL,
+  // Operands: global slot (3 bytes), builtin ID (2 bytes), argc
+  OP_CALL_BUILTIN,
 
   OP_LOOP,
   OP_JUMP,
   OP_JUMP_IF_FALSE,
 
   OP_RETURN,
+
+  // Quickened instructions. The compiler never emits these, the VM rewrites
+  // a generic instruction in place once its operands have been observed to
+  // be of the same types often enough (see QUICKEN_THRESHOLD in vm.c), and
+  // rewrites it back if the guard ever fails.
+  OP_ADD_NUM_NUM,
+  OP_ADD_FLT_FLT,
+  OP_SUB_NUM_NUM,
+  OP_SUB_FLT_FLT,
+  OP_MUL_NUM_NUM,
+  OP_MUL_FLT_FLT,
+  OP_GT_NUM_NUM,
+  OP_GT_FLT_FLT,
+  OP_GE_NUM_NUM,
+  OP_GE_FLT_FLT,
+  OP_LT_NUM_NUM,
+  OP_LT_FLT_FLT,
+  OP_LE_NUM_NUM,
+  OP_LE_FLT_FLT,
+  OP_GET_INDEX_VEC_NUM,
+  OP_GET_INDEX_LIST_NUM,
+  OP_GET_INDEX_ARRAY_NUM,
+  OP_SET_INDEX_VEC_NUM,
+  OP_SET_INDEX_ARRAY_NUM,
 } op_code_t;
 
 typedef struct {
@@ -102,12 +128,40 @@ typedef struct {
   int row, col;
 } srcpos_t;
 
+// Number of receiver shapes remembered by each inline cache
+#define INLINE_CACHE_WAYS 4
+
+typedef struct {
+  struct shape *shape;
+  // Slot holding the property in instances of this shape, or -1 if it is not
+  // a field
+  int slot;
+  // Shape the receiver moves to when OP_SET_PROPERTY adds the field, or NULL
+  struct shape *transition;
+  // Method resolved from the class of this shape, or NULL
+  struct obj_closure *method;
+} inline_cache_entry_t;
+
+// Per call site cache used by OP_GET_PROPERTY, OP_SET_PROPERTY and OP_INVOKE.
+// All entries are stale once `epoch` no longer matches vm.method_epoch
+typedef struct {
+  uint32_t epoch;
+  inline_cache_entry_t entries[INLINE_CACHE_WAYS];
+} inline_cache_t;
+
 typedef struct {
   int count;
   int capacity;
   uint8_t *code;
+  // One type-feedback counter per byte of code, only meaningful at offsets
+  // holding a quickenable instruction.
+  uint8_t *feedback;
   value_array_t constants;
 
+  int cache_count;
+  int cache_capacity;
+  inline_cache_t *caches;
+
   int pos_count;
   int pos_capacity;
   srcpos_t *positions;
@@ -117,6 +171,7 @@ void init_chunk(chunk_t *chunk);
 void free_chunk(chunk_t *chunk);
 void write_chunk(chunk_t *chunk, uint8_t byte, int row, int col);
 unsigned int add_constant(chunk_t *chunk, value_t value);
+int add_inline_cache(chunk_t *chunk);
 void write_constant(uint8_t op, chunk_t *chunk, value_t value);
 srcpos_t chunk_get_srcpos(chunk_t *chunk, int offset);
 
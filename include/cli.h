@@ -14,6 +14,37 @@ typedef enum {
 typedef struct {
   bool verbose;
   bool failed;
+  // Run hot functions as machine code, see jit.h
+  bool jit;
+  // Run scripts in both the interpreter and the JIT and compare the results
+  bool jit_diff;
+  // Longest pause of the incremental collector, 0 to stop the world. Negative
+  // when the value given on the command line was invalid
+  double gc_pause_ms;
+  // Threads marking the heap, 0 when the value given was invalid
+  int gc_threads;
+  // Percentage of the heap that has to be free for it to be compacted, 0
+  // never compacts. Negative when the value given was invalid
+  double gc_compact;
+  // Collection policy, see vm.gc_initial_heap and the fields after it.
+  // Negative when the value given was invalid
+  long long gc_initial_heap;
+  double gc_grow_factor;
+  long long gc_max_heap;
+  bool gc_adaptive;
+  // Print what the collector and the interpreter did on exit
+  bool stats;
+  // File the allocation profile is written to on exit, NULL when not
+  // profiling. The sampling interval is negative when invalid
+  const char *alloc_profile;
+  long long alloc_sample_bytes;
+  // Samples per second of the CPU profiler, 0 when not profiling and
+  // negative when the rate given was invalid
+  int profile_hz;
+  // File the CPU profile is written to on exit
+  const char *profile_output;
+  // File a heap snapshot is written to when the script returns, or NULL
+  const char *heap_snapshot;
 } cli_context_t;
 
 // Subcommand function signatures
@@ -25,6 +56,11 @@ cli_result_t cli_run(int argc, char **argv, cli_context_t *ctx);
 cli_result_t cli_run_test(int argc, char **argv, cli_context_t *ctx);
 cli_result_t cli_repl(int argc, char **argv, cli_context_t *ctx);
 cli_result_t cli_docs(int argc, char **argv, cli_context_t *ctx);
+cli_result_t cli_heap(int argc, char **argv, cli_context_t *ctx);
+
+// Runs path once per execution tier and reports any difference in output or
+// exit status. Returns false when the tiers disagree or the script failed
+bool cli_jit_diff(const char *path, cli_context_t *ctx);
 
 // Utility functions
 void cli_show_version(void);
@@ -29,13 +29,91 @@ static inline int64_t hash_float(double f) {
   return hash_number((int64_t)bits);
 }
 
-static inline int64_t hash_string(const char *s, size_t len) {
-  uint64_t hash = 1469598103934665603ull;
-  for (size_t i = 0; i < len; i++) {
-    hash ^= (uint8_t)s[i];
-    hash *= 1099511628211ull;
+// Replaces a and b with the low and high half of their 128 bit product
+static inline void hash_multiply(uint64_t *a, uint64_t *b) {
+#ifdef __SIZEOF_INT128__
+  __uint128_t product = (__uint128_t)*a * *b;
+  *a = (uint64_t)product;
+  *b = (uint64_t)(product >> 64);
+#else
+  uint64_t a_lo = (uint32_t)*a, a_hi = *a >> 32;
+  uint64_t b_lo = (uint32_t)*b, b_hi = *b >> 32;
+  uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo;
+  uint64_t lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+  uint64_t cross = (lo_lo >> 32) + (uint32_t)hi_lo + lo_hi;
+  *a = (cross << 32) | (uint32_t)lo_lo;
+  *b = hi_hi + (hi_lo >> 32) + (cross >> 32);
+#endif
+}
+
+static inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+  hash_multiply(&a, &b);
+  return a ^ b;
+}
+
+static inline uint64_t hash_read64(const uint8_t *p) {
+  uint64_t word;
+  memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+static inline uint64_t hash_read32(const uint8_t *p) {
+  uint32_t word;
+  memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+#define HASH_SECRET0 0x2d358dccaa6c78a5ull
+#define HASH_SECRET1 0x8bb84b93962eacc9ull
+#define HASH_SECRET2 0x4b33a62ed433d4a3ull
+#define HASH_SECRET3 0x4d5a2da51de1aa47ull
+
+// wyhash: reads 8 bytes at a time, 48 per round for long strings. Every
+// string hash goes through here, obj_string_t caches the result
+static inline uint64_t hash_string(const char *s, size_t len) {
+  const uint8_t *p = (const uint8_t *)s;
+  uint64_t seed = hash_mix(HASH_SECRET0, HASH_SECRET1);
+  uint64_t a, b;
+
+  if (len <= 16) {
+    if (len >= 4) {
+      size_t middle = (len >> 3) << 2;
+      a = (hash_read32(p) << 32) | hash_read32(p + middle);
+      b = (hash_read32(p + len - 4) << 32) | hash_read32(p + len - 4 - middle);
+    } else if (len > 0) {
+      a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = len;
+    if (i >= 48) {
+      uint64_t seed1 = seed, seed2 = seed;
+      do {
+        seed = hash_mix(hash_read64(p) ^ HASH_SECRET1, hash_read64(p + 8) ^ seed);
+        seed1 = hash_mix(hash_read64(p + 16) ^ HASH_SECRET2,
+                         hash_read64(p + 24) ^ seed1);
+        seed2 = hash_mix(hash_read64(p + 32) ^ HASH_SECRET3,
+                         hash_read64(p + 40) ^ seed2);
+        p += 48;
+        i -= 48;
+      } while (i >= 48);
+      seed ^= seed1 ^ seed2;
+    }
+    while (i > 16) {
+      seed = hash_mix(hash_read64(p) ^ HASH_SECRET1, hash_read64(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    a = hash_read64(p + i - 16);
+    b = hash_read64(p + i - 8);
   }
-  return to_positive_int64(hash);
+
+  a ^= HASH_SECRET1;
+  b ^= seed;
+  hash_multiply(&a, &b);
+  return hash_mix(a ^ HASH_SECRET0 ^ len, b ^ HASH_SECRET1);
 }
 
 #endif
@@ -0,0 +1,22 @@
+#ifndef XYL_HEAP_SNAPSHOT_H
+#define XYL_HEAP_SNAPSHOT_H
+
+#include <stdbool.h>
+
+// First line of a heap snapshot. Every line after it is tab separated, either
+//   n <id> <type> <self bytes> <name>
+// for an object, or
+//   e <from> <to> <kind> <name>
+// for a reference from one object to another. Node 0 stands for the roots of
+// the collector, the other ids count up in the order objects were found in.
+// Kinds are root, field, key, index, upvalue, global and internal. Names are
+// escaped C style and cut short past HEAP_SNAPSHOT_PREVIEW bytes
+#define HEAP_SNAPSHOT_HEADER "xylia heap snapshot 1"
+#define HEAP_SNAPSHOT_PREVIEW 64
+
+// Writes every object reachable from the roots mark_roots() traces to path.
+// Allocates nothing on the heap of the VM, so it can run anywhere a
+// collection could. Returns false if path can't be written
+bool write_heap_snapshot(const char *path);
+
+#endif
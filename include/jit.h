@@ -0,0 +1,51 @@
+#ifndef XYL_JIT_H
+#define XYL_JIT_H
+
+#ifdef JIT
+
+#include <stdint.h>
+
+#include "object.h"
+#include "vm.h"
+
+// Calls plus loop back-edges a function has to see before it is compiled
+#define JIT_HOT_THRESHOLD 1000
+
+// Interpreter loops that may be nested under compiled code calling back into
+// the VM. Deeper calls are left to the interpreter of the outermost loop
+#define JIT_MAX_DEPTH 512
+
+typedef enum {
+  // The instruction completed, continue with the next one
+  JIT_CONTINUE,
+  // Nothing happened, resume the interpreter at this instruction so it runs
+  // it (and reports any error) itself
+  JIT_FALLBACK,
+  // An error or halt has been signalled, leave compiled code right away
+  JIT_ABORT,
+} jit_status_t;
+
+typedef struct jit_code jit_code_t;
+
+// Runs frame in compiled code from frame->ip, compiling its function first
+// once it is hot. Returns with frame->ip at the instruction the interpreter
+// has to continue from
+void jit_resume(call_frame_t *frame);
+void jit_free(obj_function_t *function);
+
+// Helpers called from compiled code, defined in vm.c. They operate on the top
+// frame and the values on top of the stack just like the interpreter would
+jit_status_t jit_get_global(unsigned int slot);
+jit_status_t jit_binary(op_code_t op);
+jit_status_t jit_unary(op_code_t op);
+jit_status_t jit_get_index(void);
+jit_status_t jit_set_index(void);
+jit_status_t jit_get_property(unsigned int name, unsigned int cache);
+jit_status_t jit_set_property(unsigned int name, unsigned int cache);
+jit_status_t jit_call(int argc);
+jit_status_t jit_call_builtin(unsigned int slot, int id, int argc);
+jit_status_t jit_invoke(unsigned int name, int argc, unsigned int cache);
+
+#endif
+
+#endif
@@ -2,7 +2,10 @@
 #define XYL_MEMORY_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
+#include "object.h"
 #include "value.h"
 
 #define GROW_FACTOR 2
@@ -21,11 +24,98 @@
 
 #define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
 
+// Defaults of the collection policy, see vm.gc_initial_heap and
+// vm.gc_grow_factor
+#define GC_INITIAL_HEAP (1024 * 1024)
+#define GC_GROW_FACTOR 2.0
+
+// Bytes allocated between two minor collections
+#define NURSERY_SIZE (256 * 1024)
+
+// Bytes allocated between two steps of an incremental collection
+#define GC_STEP_SIZE (64 * 1024)
+
+// Most threads a full marking may run on, see vm.gc_threads
+#define GC_MAX_THREADS 64
+
+// Must follow every store of a heap value into an existing object, once no
+// allocation can happen before the stored value is reachable from it. An old
+// object is queued so the next minor collection traces its young children,
+// and so an incremental collection scans it again before it stops marking
+#define WRITE_BARRIER(owner)                                                   \
+  do {                                                                         \
+    obj_t *barrier_object_ = (obj_t *)(owner);                                 \
+    if (barrier_object_->is_old && !barrier_object_->is_remembered)            \
+      remember_object(barrier_object_);                                        \
+  } while (0)
+
+// Vectors and arrays from this many values on remember which CARD_SIZE long
+// runs of them were written, so collections don't scan the rest
+#define CARD_SHIFT 7
+#define CARD_SIZE (1 << CARD_SHIFT)
+#define CARD_MIN_COUNT 1024
+
+// WRITE_BARRIER for stores into values [from, to) of a vector or array
+#define WRITE_BARRIER_VALUES(owner, from, to)                                  \
+  do {                                                                         \
+    if ((owner)->obj.is_old &&                                                 \
+        (!(owner)->obj.is_remembered || (owner)->cards.flags != NULL))         \
+      remember_values(&(owner)->obj, from, to);                                \
+  } while (0)
+
+// Pauses are counted in buckets of up to 10us, 100us, 1ms, 10ms, 100ms and
+// longer than that
+#define GC_PAUSE_BUCKETS 6
+
+// What the collector has done since the VM started, see read_gc_stats
+typedef struct {
+  // Full collections that finished marking, and collections of the nursery
+  uint64_t collections;
+  uint64_t minor_collections;
+  // Time the mutator was stopped for, by nursery collections, incremental
+  // steps, full collections and compactions alike
+  uint64_t pause_count;
+  uint64_t pause_total_ns;
+  uint64_t pause_max_ns;
+  uint64_t pause_buckets[GC_PAUSE_BUCKETS];
+  // Slot bytes ever allocated for each type of object
+  uint64_t allocated_bytes[OBJ_ANY];
+  // Objects the last full marking found alive, and their slot bytes
+  uint64_t live_objects[OBJ_ANY];
+  uint64_t live_bytes[OBJ_ANY];
+  // Most bytes_allocated has been
+  size_t peak_heap;
+  // Compactions, and the slabs they emptied by moving objects out
+  uint64_t compactions;
+  uint64_t evacuated_slabs;
+} gc_stats_t;
+
+extern gc_stats_t gc_stats;
+
 char *read_file(const char *path);
 void *reallocate(void *ptr, size_t old_size, size_t new_size);
+// Like reallocate, for the memory of objects themselves. It comes from the
+// size classes in slab.h and is only given back by sweeping
+void *allocate_slot(size_t size);
+void free_object(obj_t *object);
 void mark_object(obj_t *object);
 void mark_value(value_t value);
+// Points value at the object compact_heap moved it to
+void update_value(value_t *value);
+void remember_object(obj_t *object);
+void remember_values(obj_t *object, int from, int to);
+void collect_nursery(void);
 void collect_garbage(void);
+// Moves objects out of sparse slabs so those can be freed. Only safe while
+// nothing but the roots of the VM refers to objects, see vm.gc_compact
+void compact_heap(void);
 void free_objects(void);
+// gc_stats with peak_heap brought up to date
+const gc_stats_t *read_gc_stats(void);
+// Name of an object type as gc_stats reports it
+const char *gc_type_name(obj_type_t type);
+// Prints gc_stats for --stats, along with the instructions the interpreter
+// ran or a note that it doesn't count them
+void print_gc_stats(FILE *out);
 
 #endif
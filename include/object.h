@@ -5,6 +5,8 @@
 #include <stdio.h>
 
 #include "chunk.h"
+#include "shape.h"
+#include "slab.h"
 #include "table.h"
 #include "value.h"
 
@@ -32,8 +34,9 @@
 #define AS_FUNCTION(value) ((obj_function_t *)AS_OBJ(value))
 #define AS_INSTANCE(value) ((obj_instance_t *)AS_OBJ(value))
 #define AS_BUILTIN(value) (((obj_builtin_t *)AS_OBJ(value))->function)
-#define AS_STRING(value) ((obj_string_t *)AS_OBJ(value))
-#define AS_CSTRING(value) (((obj_string_t *)AS_OBJ(value))->chars)
+// Flattens ropes, so chars can be read. Use AS_OBJ for just the length
+#define AS_STRING(value) flat_string((obj_string_t *)AS_OBJ(value))
+#define AS_CSTRING(value) (AS_STRING(value)->chars)
 #define AS_VECTOR(value) ((obj_vector_t *)AS_OBJ(value))
 #define AS_LIST(value) ((obj_list_t *)AS_OBJ(value))
 #define AS_ARRAY(value) ((obj_array_t *)AS_OBJ(value))
@@ -60,15 +63,25 @@ typedef enum {
   OBJ_UPVALUE,
   OBJ_MODULE,
   OBJ_ENUM,
+  // Integer too wide for a NaN-boxed value, see value.h
+  OBJ_NUMBER,
   OBJ_ANY,
 } obj_type_t;
 
+// Mark bits live in the slab an object was allocated in, see slab.h
 struct obj {
   obj_type_t type;
-  bool is_marked;
-  struct obj *next;
+  // Survived a collection
+  bool is_old;
+  // Old object queued in vm.remembered, see WRITE_BARRIER
+  bool is_remembered;
 };
 
+typedef struct {
+  obj_t obj;
+  int64_t value;
+} obj_number_t;
+
 typedef struct {
   obj_t obj;
   int arity;
@@ -77,8 +90,16 @@ typedef struct {
   obj_string_t *name;
   obj_string_t *path;
   int row, col;
-  table_t *globals;
+  globals_t *globals;
   bool has_varargs;
+#ifdef JIT
+  // Calls and loop back-edges seen so far, see JIT_HOT_THRESHOLD
+  uint32_t hotness;
+  // Set once compiling failed, the function stays with the interpreter
+  bool jit_failed;
+  // Machine code for chunk, NULL until the function got hot
+  struct jit_code *jit;
+#endif
 } obj_function_t;
 
 typedef value_t (*builtin_fn_t)(int argc, value_t *args);
@@ -86,16 +107,56 @@ typedef value_t (*builtin_fn_t)(int argc, value_t *args);
 typedef struct {
   obj_t obj;
   builtin_fn_t function;
+  // Index into builtin_registry
+  int id;
 } obj_builtin_t;
 
+// Strings made at runtime aren't interned until they are used as a table
+// key, and hash their contents only once something asks for the hash. Short
+// strings keep chars in their own slot, right after the object
 struct obj_string {
   obj_t obj;
+  // NULL while the string is a rope
   char *chars;
-  uint32_t hash;
+  // Valid once hashed is set, see string_hash()
+  uint64_t hash;
   int length;
+  bool hashed;
   bool interned;
 };
 
+// Concatenations at least this long make a rope instead of copying both sides
+#define ROPE_MIN_LENGTH 256
+
+// A string holding the characters of left followed by those of right, which
+// flatten_string() copies into chars the first time they are needed. Appending
+// to a string in a loop builds a chain of ropes, flattened all at once
+typedef struct {
+  obj_string_t string;
+  obj_string_t *left;
+  obj_string_t *right;
+} obj_rope_t;
+
+#define IS_ROPE(string) ((string)->chars == NULL)
+
+// Whether an object of type followed by extra bytes fits into one slot. The
+// pointers of strings, lists and closures then point right behind the object,
+// so nothing else has to tell the two layouts apart
+#define FITS_INLINE(type, extra) (sizeof(type) + (extra) <= SLAB_MAX_SIZE)
+
+#define STRING_IS_INLINE(length)                                               \
+  FITS_INLINE(obj_string_t, (size_t)(length) + 1)
+#define STRING_INLINE_CHARS(string) ((char *)((obj_string_t *)(string) + 1))
+
+// Allocates nothing the collector has to know about, so it is safe anywhere
+void flatten_string(obj_string_t *string);
+
+static inline obj_string_t *flat_string(obj_string_t *string) {
+  if (IS_ROPE(string))
+    flatten_string(string);
+  return string;
+}
+
 typedef struct obj_upvalue {
   obj_t obj;
   value_t *location;
@@ -103,23 +164,38 @@ typedef struct obj_upvalue {
   struct obj_upvalue *next;
 } obj_upvalue_t;
 
-typedef struct {
+typedef struct obj_closure {
   obj_t obj;
   obj_function_t *function;
+  // Points at inline_upvalues unless there are too many, see FITS_INLINE
   obj_upvalue_t **upvalues;
   int upvalue_count;
+  obj_upvalue_t *inline_upvalues[];
 } obj_closure_t;
 
-typedef struct {
+#define CLOSURE_IS_INLINE(count)                                               \
+  FITS_INLINE(obj_closure_t, sizeof(obj_upvalue_t *) * (size_t)(count))
+
+typedef struct obj_class {
   obj_t obj;
   obj_string_t *name;
   table_t methods;
+  // Root of the shape tree shared by all instances of this class
+  shape_t *shape;
+  int shape_count;
+  // Most fields any instance has had, used to size new instances
+  int slot_hint;
 } obj_class_t;
 
 typedef struct {
   obj_t obj;
   obj_class_t *clas;
-  table_t fields;
+  // Field layout of `slots`. NULL in dictionary mode, where the fields live in
+  // `fields` instead
+  shape_t *shape;
+  value_t *slots;
+  int slot_capacity;
+  table_t *fields;
 } obj_instance_t;
 
 typedef struct {
@@ -128,8 +204,17 @@ typedef struct {
   obj_closure_t *method;
 } obj_bound_method_t;
 
+// Dirty flag per CARD_SIZE values of a large old vector or array, see
+// WRITE_BARRIER_VALUES
+typedef struct {
+  uint8_t *flags;
+  int count;
+} card_table_t;
+
 typedef struct {
   obj_t obj;
+  // Right after the header in arrays as well, compiled code relies on it
+  card_table_t cards;
   int count;
   int capacity;
   value_t *values;
@@ -138,13 +223,19 @@ typedef struct {
 
 typedef struct {
   obj_t obj;
+  // Points at inline_values unless there are too many, see FITS_INLINE
   value_t *values;
   int count;
   bool spread;
+  value_t inline_values[];
 } obj_list_t;
 
+#define LIST_IS_INLINE(count)                                                  \
+  FITS_INLINE(obj_list_t, sizeof(value_t) * (size_t)(count))
+
 typedef struct {
   obj_t obj;
+  card_table_t cards;
   value_t *values;
   int count;
 } obj_array_t;
@@ -161,7 +252,7 @@ typedef struct {
 typedef struct {
   obj_t obj;
   obj_string_t *name;
-  table_t globals;
+  globals_t globals;
   obj_closure_t *init;
 } obj_module_t;
 
@@ -185,14 +276,28 @@ typedef struct {
   int64_t last;
 } obj_enum_t;
 
+obj_t *allocate_object(size_t size, obj_type_t type);
 obj_bound_method_t *new_bound_method(value_t receiver, obj_closure_t *method);
 obj_class_t *new_class(obj_string_t *name);
 obj_closure_t *new_closure(obj_function_t *function);
 obj_function_t *new_function(void);
 obj_instance_t *new_instance(obj_class_t *clas);
-obj_builtin_t *new_builtin(builtin_fn_t function);
+bool instance_get_field(obj_instance_t *instance, obj_string_t *name,
+                        value_t *value);
+void instance_set_field(obj_instance_t *instance, obj_string_t *name,
+                        value_t value);
+void instance_reserve_slots(obj_instance_t *instance, int count);
+obj_builtin_t *new_builtin(builtin_fn_t function, int id);
 obj_string_t *take_string(char *chars, int length);
 obj_string_t *copy_string(const char *chars, int length, bool intern);
+// Concatenates a and b, as a rope if the result is long enough
+obj_string_t *concat_strings(obj_string_t *a, obj_string_t *b);
+uint64_t string_hash(obj_string_t *string);
+// Returns the interned string equal to string, making string itself the
+// interned one if there is none yet
+obj_string_t *intern_string(obj_string_t *string);
+// Returns the interned string equal to string, or NULL if there is none
+obj_string_t *find_interned(obj_string_t *string);
 obj_upvalue_t *new_upvalue(value_t *slot);
 obj_vector_t *new_vector(int initial_capacity);
 obj_list_t *new_list(int count);
@@ -0,0 +1,58 @@
+#ifndef XYL_PROFILER_H
+#define XYL_PROFILER_H
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "object.h"
+
+// Mean bytes allocated between two samples of the allocation profiler
+#define ALLOC_SAMPLE_BYTES (512 * 1024)
+
+// Bytes left until the allocation profiler takes its next sample. Stays at
+// INT64_MAX while it is stopped, so allocations only pay for a subtraction
+extern int64_t alloc_sample_countdown;
+
+// Counts an allocation of size bytes towards the next sample of the
+// allocation profiler
+#define SAMPLE_ALLOCATION(size, type)                                          \
+  do {                                                                         \
+    if ((alloc_sample_countdown -= (int64_t)(size)) < 0)                       \
+      sample_allocation(size, type);                                           \
+  } while (0)
+
+// Starts sampling allocations, on average one every sample_bytes bytes.
+// Samples of an earlier profile are dropped
+void start_alloc_profile(size_t sample_bytes);
+// Stops sampling, the samples taken can still be written out
+void stop_alloc_profile(void);
+// Records the frame stack allocating an object of size bytes, called by
+// SAMPLE_ALLOCATION once the countdown runs out
+void sample_allocation(size_t size, obj_type_t type);
+// Writes the bytes each site is estimated to have allocated, as collapsed
+// stacks ending in the object type. Returns false if path can't be written
+bool write_alloc_profile(const char *path);
+
+// Sampling rate of the CPU profiler unless one is given
+#define PROFILE_HZ 99
+
+// The CPU profiler drops the samples it takes while this is nonzero, for
+// stretches that move the frames or the objects they point to
+extern volatile sig_atomic_t profiler_hold;
+
+// Starts taking a sample of the frame stack hz times a second of CPU time.
+// Returns false if the timer can't be set up
+bool start_cpu_profile(int hz);
+// Turns the samples the timer took so far into stacks. Has to run before
+// the collector frees or moves functions a sample may point to
+void drain_cpu_profile(void);
+// Stops the CPU profiler and writes how many samples each stack got, as
+// collapsed stacks. Returns false if path can't be written
+bool write_cpu_profile(const char *path);
+
+// Stops both profilers and drops their samples
+void free_profiles(void);
+
+#endif
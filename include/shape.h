@@ -0,0 +1,34 @@
+#ifndef XYL_SHAPE_H
+#define XYL_SHAPE_H
+
+#include "value.h"
+
+// Past either limit an instance leaves shape mode and keeps its fields in a
+// hash table instead (dictionary mode)
+#define SHAPE_MAX_FIELDS 64
+#define SHAPE_MAX_PER_CLASS 256
+
+// A shape describes the field layout shared by all instances of a class that
+// had the same fields assigned in the same order. Shapes form a tree rooted in
+// the class, every edge adds one field in the next free slot
+typedef struct shape {
+  struct shape *parent;
+  // Field added by the transition from parent, NULL for the root
+  obj_string_t *name;
+  // Number of fields, `name` lives in slot `slot_count - 1`
+  int slot_count;
+
+  struct shape **transitions;
+  int transition_count;
+  int transition_capacity;
+} shape_t;
+
+shape_t *new_shape(shape_t *parent, obj_string_t *name);
+void free_shape(shape_t *shape);
+int shape_find(shape_t *shape, obj_string_t *name);
+shape_t *shape_transition(shape_t *shape, obj_string_t *name,
+                          int *shape_count);
+void mark_shape(shape_t *shape);
+void update_shape(shape_t *shape);
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef XYL_SLAB_H
+#define XYL_SLAB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "value.h"
+
+// Objects are carved out of SLAB_SIZE aligned pages, one size class per
+// SLAB_GRANULE bytes. Every object type has to fit into SLAB_MAX_SIZE
+#define SLAB_SIZE (64 * 1024)
+#define SLAB_GRANULE 16
+#define SLAB_MAX_SIZE 256
+
+// Bytes an object of size bytes takes up in its slab
+#define SLAB_ROUND(size)                                                       \
+  (((size) + SLAB_GRANULE - 1) & ~(size_t)(SLAB_GRANULE - 1))
+
+// One bit per granule, set at the granule an object starts at
+#define SLAB_BITMAP_WORDS (SLAB_SIZE / SLAB_GRANULE / 64)
+
+typedef struct free_slot free_slot_t;
+
+// Header at the start of every slab, followed by its slots. Mark bits live
+// here instead of in the objects, so clearing them is a memset and a sweep
+// only has to touch the objects that died
+typedef struct slab {
+  // Neighbours in the list of its size class the slab is on
+  struct slab *prev;
+  struct slab *next;
+  // Next slab holding young objects, see slab_sweep_young
+  struct slab *next_young;
+  bool has_young;
+  // Emptied by slab_evacuate, its slots hold forwarding pointers
+  bool evacuated;
+
+  free_slot_t *free;
+  // Slots from here on have never been handed out
+  char *unused;
+  char *end;
+  int slot_size;
+  // Slots currently handed out
+  int live;
+
+  uint64_t live_bits[SLAB_BITMAP_WORDS];
+  uint64_t mark_bits[SLAB_BITMAP_WORDS];
+  uint64_t young_bits[SLAB_BITMAP_WORDS];
+} slab_t;
+
+#define SLAB_OF(ptr)                                                           \
+  ((slab_t *)((uintptr_t)(ptr) & ~(uintptr_t)(SLAB_SIZE - 1)))
+
+static inline int slab_bit(const void *ptr) {
+  return ((uintptr_t)ptr & (SLAB_SIZE - 1)) / SLAB_GRANULE;
+}
+
+static inline bool is_marked(const obj_t *object) {
+  int bit = slab_bit(object);
+  return SLAB_OF(object)->mark_bits[bit / 64] >> (bit % 64) & 1;
+}
+
+static inline void set_marked(const obj_t *object) {
+  int bit = slab_bit(object);
+  SLAB_OF(object)->mark_bits[bit / 64] |= (uint64_t)1 << (bit % 64);
+}
+
+// set_marked for markers running in parallel. Returns false when the object
+// was already marked
+static inline bool set_marked_atomic(const obj_t *object) {
+  int bit = slab_bit(object);
+  uint64_t *word = &SLAB_OF(object)->mark_bits[bit / 64];
+  uint64_t mask = (uint64_t)1 << (bit % 64);
+  if (__atomic_load_n(word, __ATOMIC_RELAXED) & mask)
+    return false;
+  return !(__atomic_fetch_or(word, mask, __ATOMIC_RELAXED) & mask);
+}
+
+// Where an object lives after slab_evacuate, the object itself unless it
+// was moved. The new address is kept past the header of the old slot
+static inline obj_t *forwarded(obj_t *object) {
+  if (object == NULL || !SLAB_OF(object)->evacuated)
+    return object;
+  return ((obj_t **)object)[1];
+}
+
+// Points a reference at the new address of the object it refers to
+#define UPDATE_OBJECT(object) ((object) = (void *)forwarded((obj_t *)(object)))
+
+// Returns uninitialized memory for a young object of size bytes. Sweeps the
+// size class first if it has nothing free, but never collects
+void *slab_alloc(size_t size);
+// Frees the young objects the last marking didn't reach and makes the rest
+// old. Minor collections drop the marks of the survivors, full ones keep them
+// for the sweep that follows
+void slab_sweep_young(bool keep_marks);
+// Calls visit on every young object that is marked
+void slab_each_marked_young(void (*visit)(obj_t *object));
+// Calls visit on every marked object, before the slabs are queued for
+// sweeping
+void slab_each_marked(void (*visit)(obj_t *object));
+// Sums up the slot bytes of the marked objects and of all live ones, before
+// the slabs are queued for sweeping
+void slab_marked_usage(size_t *marked_bytes, size_t *live_bytes);
+// Queues every slab to be swept after a full marking. Slabs are swept when
+// their size class runs out of free slots, or by slab_sweep_next
+void slab_begin_sweep(void);
+// Sweeps one queued slab, returns false once there are none left
+bool slab_sweep_next(void);
+// Bytes of memory held by slabs
+size_t slab_footprint(void);
+// Moves the objects out of sparse slabs into the other slabs of their size
+// class, unless can_move refuses one of them. Only to be called after a full
+// sweep. Returns the number of slabs emptied
+int slab_evacuate(bool (*can_move)(obj_t *object));
+// Calls visit on every object outside the evacuated slabs
+void slab_each_live(void (*visit)(obj_t *object));
+// Frees the slabs emptied by slab_evacuate, once nothing refers to them
+void slab_release_evacuated(void);
+// Frees every object along with the slabs
+void free_slabs(void);
+
+#endif
@@ -16,6 +16,20 @@ typedef struct {
   entry_t *entries;
 } table_t;
 
+typedef struct {
+  obj_string_t *name;
+  value_t value;
+} global_t;
+
+// Globals of a module, stored densely by the slot numbers the compiler
+// assigns. `slots` maps every name to its slot for lookups by name
+typedef struct {
+  table_t slots;
+  int count;
+  int capacity;
+  global_t *values;
+} globals_t;
+
 void init_table(table_t *table);
 void free_table(table_t *table);
 bool table_get(table_t *table, obj_string_t *key, value_t *value);
@@ -23,8 +37,18 @@ bool table_set(table_t *table, obj_string_t *key, value_t value);
 bool table_delete(table_t *table, obj_string_t *key);
 void table_add_all(table_t *from, table_t *to);
 obj_string_t *table_find_string(table_t *table, const char *chars, int length,
-                                uint32_t hash);
+                                uint64_t hash);
 void table_remove_white(table_t *table);
 void mark_table(table_t *table);
+// Points the entries at the objects compact_heap moved
+void update_table(table_t *table);
+
+void init_globals(globals_t *globals);
+void free_globals(globals_t *globals);
+int globals_slot(globals_t *globals, obj_string_t *name);
+bool globals_get(globals_t *globals, obj_string_t *name, value_t *value);
+void globals_add_all(globals_t *from, globals_t *to);
+void mark_globals(globals_t *globals);
+void update_globals(globals_t *globals);
 
 #endif
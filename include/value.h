@@ -17,6 +17,104 @@ typedef enum {
   VAL_ANY,
 } value_type_t;
 
+#ifdef NAN_BOXING
+
+#include <string.h>
+
+// Every value is packed into the 64 bits of a double. Floats are stored as
+// is, everything else hides in the payload of a quiet NaN:
+//
+//   sign  quiet NaN  int  payload (48 bits)
+//   0     1...1      0    1 nil, 2 false, 3 true, 4 undefined
+//   0     1...1      1    integer
+//   1     1...1      0    obj_t pointer
+//   1     1...1      1    pointer to the box of an integer too wide for 48 bits
+typedef uint64_t value_t;
+
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN ((uint64_t)0x7ffc000000000000)
+#define INT_BIT ((uint64_t)0x0001000000000000)
+#define PAYLOAD_MASK ((uint64_t)0x0000ffffffffffff)
+#define TAG_MASK (SIGN_BIT | QNAN | INT_BIT)
+// Computed NaNs are folded into this one so they can't collide with the tags
+#define CANONICAL_NAN ((uint64_t)0x7ff8000000000000)
+
+#define TAG_NIL 1
+#define TAG_FALSE 2
+#define TAG_TRUE 3
+#define TAG_UNDEFINED 4
+
+#define IS_BOOL(value) (((value) | 1) == (QNAN | TAG_TRUE))
+#define IS_NIL(value) ((value) == NIL_VAL)
+#define IS_NUMBER(value) (((value) & (QNAN | INT_BIT)) == (QNAN | INT_BIT))
+#define IS_FLOAT(value) (((value) & QNAN) != QNAN)
+#define IS_OBJ(value) (((value) & TAG_MASK) == (SIGN_BIT | QNAN))
+
+#define AS_BOOL(value) ((value) == (QNAN | TAG_TRUE))
+#define AS_NUMBER(value) value_to_number(value)
+#define AS_FLOAT(value) value_to_float(value)
+#define AS_OBJ(value) ((obj_t *)(uintptr_t)((value) & PAYLOAD_MASK))
+
+#define BOOL_VAL(value) ((value) ? (QNAN | TAG_TRUE) : (QNAN | TAG_FALSE))
+#define NIL_VAL ((value_t)(QNAN | TAG_NIL))
+#define NUMBER_VAL(value) number_to_value(value)
+#define FLOAT_VAL(value) float_to_value(value)
+#define OBJ_VAL(value) (SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(value))
+
+#define IS_UNDEFINED(value) ((value) == UNDEFINED_VAL)
+#define UNDEFINED_VAL ((value_t)(QNAN | TAG_UNDEFINED))
+
+// Objects and integer boxes, i.e. everything the GC has to trace
+#define IS_HEAP(value) (((value) & (SIGN_BIT | QNAN)) == (SIGN_BIT | QNAN))
+#define AS_HEAP(value) AS_OBJ(value)
+
+#define VALUE_TYPE(value) value_type(value)
+
+// Defined in object.c, boxes are GC objects
+value_t box_number(int64_t number);
+int64_t unbox_number(value_t value);
+
+static inline value_t number_to_value(int64_t number) {
+  int64_t narrowed = (int64_t)((uint64_t)number << 16) >> 16;
+  if (narrowed == number)
+    return QNAN | INT_BIT | ((uint64_t)number & PAYLOAD_MASK);
+  return box_number(number);
+}
+
+static inline int64_t value_to_number(value_t value) {
+  if (value & SIGN_BIT)
+    return unbox_number(value);
+  return (int64_t)(value << 16) >> 16;
+}
+
+static inline value_t float_to_value(double number) {
+  value_t value;
+  memcpy(&value, &number, sizeof(double));
+  return (value & QNAN) == QNAN ? CANONICAL_NAN : value;
+}
+
+static inline double value_to_float(value_t value) {
+  double number;
+  memcpy(&number, &value, sizeof(double));
+  return number;
+}
+
+static inline value_type_t value_type(value_t value) {
+  if (IS_FLOAT(value))
+    return VAL_FLOAT;
+  if (IS_NUMBER(value))
+    return VAL_NUMBER;
+  if (IS_OBJ(value))
+    return VAL_OBJ;
+  if (IS_BOOL(value))
+    return VAL_BOOL;
+  if (IS_NIL(value))
+    return VAL_NIL;
+  return VAL_ANY;
+}
+
+#else
+
 typedef struct {
   value_type_t type;
   union {
@@ -44,6 +142,18 @@ typedef struct {
 #define FLOAT_VAL(value) ((value_t){VAL_FLOAT, {.float_ = value}})
 #define OBJ_VAL(value) ((value_t){VAL_OBJ, {.obj = (obj_t *)value}})
 
+// VAL_ANY never occurs as a runtime value, so it doubles as the marker for
+// global slots that have been allocated but not defined yet
+#define IS_UNDEFINED(value) ((value).type == VAL_ANY)
+#define UNDEFINED_VAL ((value_t){VAL_ANY, {.number = 0}})
+
+#define IS_HEAP(value) IS_OBJ(value)
+#define AS_HEAP(value) AS_OBJ(value)
+
+#define VALUE_TYPE(value) ((value).type)
+
+#endif
+
 typedef struct {
   int capacity;
   int count;
@@ -1,6 +1,7 @@
 #ifndef XYL_VM_H
 #define XYL_VM_H
 
+#include <signal.h>
 #include <stddef.h>
 
 #include "object.h"
@@ -70,15 +71,28 @@ typedef struct {
   obj_closure_t *closure;
   uint8_t *ip;
   value_t *slots;
-  table_t *globals;
+  globals_t *globals;
   bool is_module;
 } call_frame_t;
 
+// Call depth at which a call signals SIG_STACK_OVERFLOW
+#define FRAMES_MAX 65536
+
+typedef enum {
+  GC_IDLE,
+  // Tracing the heap a slice at a time, see gc_pause_ms
+  GC_MARK,
+  // Freeing what the last marking left white, a slab at a time as the
+  // allocator runs out of free slots or a step comes around
+  GC_SWEEP,
+} gc_phase_t;
+
 typedef struct {
   call_frame_t *frames;
   int frame_capacity;
   int frame_count;
-  bool update_frame;
+  // Also raised by the profiler's SIGPROF handler
+  volatile sig_atomic_t update_frame;
 
   value_t *stack;
   value_t *stack_top;
@@ -88,22 +102,73 @@ typedef struct {
   table_t builtins;
   table_t strings;
 
-  table_t *globals;
+  globals_t *globals;
 
   obj_string_t *vm_strings[VM_STR_MAX];
+  // Interned string of every byte value, indexing a string returns these
+  obj_string_t *byte_strings[256];
   obj_list_t *args;
 
   obj_upvalue_t *open_upvalues;
 
+  // Bumped whenever a method table changes or a class and its shapes are
+  // freed, which invalidates every inline cache
+  uint32_t method_epoch;
+
   size_t bytes_allocated;
   size_t next_gc;
-  obj_t *objects;
+  // bytes_allocated after the last collection of the nursery
+  size_t nursery_start;
+
+  // Old objects that may point into the nursery
+  obj_t **remembered;
+  int remembered_capacity;
+  int remembered_count;
+
+  // bytes_allocated at which the first full collection starts, and below
+  // which none starts later on
+  size_t gc_initial_heap;
+  // After a full collection the next one starts once the heap has grown to
+  // this many times what the marking found alive
+  double gc_grow_factor;
+  // Most bytes the heap may hold after a full collection, 0 for no limit.
+  // Allocating past it is a runtime error
+  size_t gc_max_heap;
+  // Tune gc_grow_factor after every full collection, see adapt_grow_factor
+  bool gc_adaptive;
+  // Longest a single incremental step may take. 0 marks the whole heap at
+  // once instead
+  double gc_pause_ms;
+  // Threads tracing the heap in full collections, see GC_MAX_THREADS
+  int gc_threads;
+  // Share of the slab memory that has to be free after a full collection
+  // for the heap to be compacted, 0 never compacts
+  double gc_compact;
+  // Set by a collection that found the heap fragmented, the interpreter
+  // loop compacts it once it is safe to move objects
+  bool gc_compact_pending;
+  gc_phase_t gc_phase;
+  // bytes_allocated when the last incremental step ran
+  size_t gc_step_start;
 
   obj_t **gray_stack;
   int gray_capacity;
   int gray_count;
 
   int offset;
+  // Heap snapshot written when the main script returns, NULL for none
+  const char *heap_snapshot_path;
+  // Instructions the interpreter has run when built with COUNT_INSTRUCTIONS,
+  // compiled code doesn't count them
+  uint64_t instruction_count;
+
+#ifdef JIT
+  bool jit_enabled;
+  // Hotness a function needs before it is compiled
+  uint32_t jit_threshold;
+  // Interpreter loops currently nested under compiled code
+  int jit_depth;
+#endif
 
   vm_singal_t signal;
   int exit_code;
@@ -124,6 +189,8 @@ void free_vm(void);
 void set_args(int argc, char **argv);
 void load_test_functions(void);
 result_t interpret(const char *source, const char *file);
+// Makes room for count more values on the stack, moving it if needed
+void reserve_stack(int count);
 void push(value_t value);
 void push_frame(obj_closure_t *closure, int argc);
 value_t pop(void);
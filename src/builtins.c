@@ -31,7 +31,7 @@ obj_string_t *value_to_string(value_t value, bool literal) {
   char buf[32];
   string_builder_t sb;
 
-  switch (value.type) {
+  switch (VALUE_TYPE(value)) {
   case VAL_BOOL:
     return vm.vm_strings[AS_BOOL(value) ? VM_STR_TRUE : VM_STR_FALSE];
   case VAL_NIL:
@@ -39,12 +39,12 @@ obj_string_t *value_to_string(value_t value, bool literal) {
   case VAL_NUMBER: {
     int64_t number = AS_NUMBER(value);
     int len = snprintf(buf, sizeof(buf), "%lld", (long long)number);
-    return copy_string(buf, len, true);
+    return copy_string(buf, len, false);
   }
   case VAL_FLOAT: {
     double flt = AS_FLOAT(value);
     int len = snprintf(buf, sizeof(buf), "%g", flt);
-    return copy_string(buf, len, true);
+    return copy_string(buf, len, false);
   }
   case VAL_OBJ: {
     switch (OBJ_TYPE(value)) {
@@ -55,7 +55,7 @@ obj_string_t *value_to_string(value_t value, bool literal) {
         sb_append(&sb, "\"", 1);
         sb_append(&sb, string->chars, string->length);
         sb_append(&sb, "\"", 1);
-        obj_string_t *res = copy_string(sb.data, sb.length, true);
+        obj_string_t *res = copy_string(sb.data, sb.length, false);
         sb_free(&sb);
         return res;
       } else
@@ -72,7 +72,7 @@ obj_string_t *value_to_string(value_t value, bool literal) {
         sb_append(&sb, str_val->chars, str_val->length);
       }
       sb_append(&sb, "}", 1);
-      obj_string_t *res = copy_string(sb.data, sb.length, true);
+      obj_string_t *res = copy_string(sb.data, sb.length, false);
       sb_free(&sb);
       return res;
     }
@@ -87,7 +87,7 @@ obj_string_t *value_to_string(value_t value, bool literal) {
         sb_append(&sb, str_val->chars, str_val->length);
       }
       sb_append(&sb, "]", 1);
-      obj_string_t *res = copy_string(sb.data, sb.length, true);
+      obj_string_t *res = copy_string(sb.data, sb.length, false);
       sb_free(&sb);
       return res;
     }
@@ -102,12 +102,12 @@ obj_string_t *value_to_string(value_t value, bool literal) {
         sb_append(&sb, str_val->chars, str_val->length);
       }
       sb_append(&sb, ">", 1);
-      obj_string_t *res = copy_string(sb.data, sb.length, true);
+      obj_string_t *res = copy_string(sb.data, sb.length, false);
       sb_free(&sb);
       return res;
     } break;
     case OBJ_FILE:
-      return copy_string("<file>", 6, true);
+      return copy_string("<file>", 6, false);
     case OBJ_RANGE: {
       obj_range_t *range = AS_RANGE(value);
       sb_init(&sb);
@@ -118,7 +118,7 @@ obj_string_t *value_to_string(value_t value, bool literal) {
       sb_append(&sb, ":", 1);
       sb_append(&sb, to->chars, to->length);
       sb_append(&sb, ">", 1);
-      obj_string_t *res = copy_string(sb.data, sb.length, true);
+      obj_string_t *res = copy_string(sb.data, sb.length, false);
       sb_free(&sb);
       return res;
     }
@@ -133,7 +133,7 @@ obj_string_t *value_to_string(value_t value, bool literal) {
       obj_string_t *val = value_to_string(result->value, true);
       sb_append(&sb, val->chars, val->length);
       sb_append(&sb, ")", 1);
-      obj_string_t *res = copy_string(sb.data, sb.length, true);
+      obj_string_t *res = copy_string(sb.data, sb.length, false);
       sb_free(&sb);
       return res;
     }
@@ -143,19 +143,19 @@ obj_string_t *value_to_string(value_t value, bool literal) {
       sb_append(&sb, "<class ", 7);
       sb_append(&sb, clas->name->chars, clas->name->length);
       sb_append(&sb, ">", 1);
-      obj_string_t *res = copy_string(sb.data, sb.length, true);
+      obj_string_t *res = copy_string(sb.data, sb.length, false);
       sb_free(&sb);
       return res;
     }
     case OBJ_BOUND_METHOD: {
       obj_function_t *function = AS_BOUND_METHOD(value)->method->function;
       if (function->name == NULL)
-        return copy_string("<script>", 8, true);
+        return copy_string("<script>", 8, false);
       sb_init(&sb);
       sb_append(&sb, "<fn ", 4);
       sb_append(&sb, function->name->chars, function->name->length);
       sb_append(&sb, ">", 1);
-      obj_string_t *res = copy_string(sb.data, sb.length, true);
+      obj_string_t *res = copy_string(sb.data, sb.length, false);
       sb_free(&sb);
       return res;
     }
@@ -165,45 +165,45 @@ obj_string_t *value_to_string(value_t value, bool literal) {
       sb_append(&sb, "<instance ", 10);
       sb_append(&sb, instance->clas->name->chars, instance->clas->name->length);
       sb_append(&sb, ">", 1);
-      obj_string_t *res = copy_string(sb.data, sb.length, true);
+      obj_string_t *res = copy_string(sb.data, sb.length, false);
       sb_free(&sb);
       return res;
     }
     case OBJ_CLOSURE: {
       obj_function_t *function = AS_CLOSURE(value)->function;
       if (function->name == NULL)
-        return copy_string("<script>", 8, true);
+        return copy_string("<script>", 8, false);
       sb_init(&sb);
       sb_append(&sb, "<fn ", 4);
       sb_append(&sb, function->name->chars, function->name->length);
       sb_append(&sb, ">", 1);
-      obj_string_t *res = copy_string(sb.data, sb.length, true);
+      obj_string_t *res = copy_string(sb.data, sb.length, false);
       sb_free(&sb);
       return res;
     }
     case OBJ_FUNCTION: {
       obj_function_t *function = AS_FUNCTION(value);
       if (function->name == NULL)
-        return copy_string("<script>", 8, true);
+        return copy_string("<script>", 8, false);
       sb_init(&sb);
       sb_append(&sb, "<fn ", 4);
       sb_append(&sb, function->name->chars, function->name->length);
       sb_append(&sb, ">", 1);
-      obj_string_t *res = copy_string(sb.data, sb.length, true);
+      obj_string_t *res = copy_string(sb.data, sb.length, false);
       sb_free(&sb);
       return res;
     }
     case OBJ_BUILTIN:
-      return copy_string("<fn builtin>", 12, true);
+      return copy_string("<fn builtin>", 12, false);
     case OBJ_UPVALUE:
-      return copy_string("<upvalue>", 9, true);
+      return copy_string("<upvalue>", 9, false);
     case OBJ_MODULE: {
       obj_module_t *module = AS_MODULE(value);
       sb_init(&sb);
       sb_append(&sb, "<module ", 8);
       sb_append(&sb, module->name->chars, module->name->length);
       sb_append(&sb, ">", 1);
-      obj_string_t *res = copy_string(sb.data, sb.length, true);
+      obj_string_t *res = copy_string(sb.data, sb.length, false);
       sb_free(&sb);
       return res;
     }
@@ -213,10 +213,11 @@ obj_string_t *value_to_string(value_t value, bool literal) {
       sb_append(&sb, "<enum ", 6);
       sb_append(&sb, enum_->name->chars, enum_->name->length);
       sb_append(&sb, ">", 1);
-      obj_string_t *res = copy_string(sb.data, sb.length, true);
+      obj_string_t *res = copy_string(sb.data, sb.length, false);
       sb_free(&sb);
       return res;
     }
+    case OBJ_NUMBER:
     case OBJ_ANY:
       break;
     }
@@ -277,6 +278,8 @@ const char *obj_type_to_str(obj_type_t type) {
     return "result";
   case OBJ_ENUM:
     return "enum";
+  case OBJ_NUMBER:
+    return "number";
   case OBJ_ANY:
     return "any";
   }
@@ -319,7 +322,7 @@ bool check_signature(const builtin_signature_t *signature, int argc,
     if (want_type == VAL_ANY)
       continue;
 
-    value_type_t got_type = argv[i].type;
+    value_type_t got_type = VALUE_TYPE(argv[i]);
     if (got_type != want_type) {
       runtime_error(-1, "Expected argument %d in '%s' to be '%s' but got '%s'",
                     i + 1, signature->name, value_type_to_str(want_type),
@@ -18,7 +18,7 @@ xyl_builtin(number) {
   xyl_builtin_signature(number, 1, ARGC_EXACT, {VAL_ANY, OBJ_ANY});
 
   value_t arg = argv[0];
-  switch (arg.type) {
+  switch (VALUE_TYPE(arg)) {
   case VAL_BOOL:
     return NUMBER_VAL(AS_BOOL(arg) ? 1 : 0);
   case VAL_NIL:
@@ -58,7 +58,7 @@ xyl_builtin(float) {
   xyl_builtin_signature(float, 1, ARGC_EXACT, {VAL_ANY, OBJ_ANY});
 
   value_t arg = argv[0];
-  switch (arg.type) {
+  switch (VALUE_TYPE(arg)) {
   case VAL_BOOL:
     runtime_error(-1, "Can not cast 'bool' to 'float'");
     break;
@@ -98,7 +98,7 @@ xyl_builtin(bool) {
   xyl_builtin_signature(bool, 1, ARGC_EXACT, {VAL_ANY, OBJ_ANY});
 
   value_t arg = argv[0];
-  switch (arg.type) {
+  switch (VALUE_TYPE(arg)) {
   case VAL_BOOL:
     return arg;
   case VAL_NIL:
@@ -148,8 +148,8 @@ xyl_builtin(vector) {
     obj_range_t *range = AS_RANGE(arg);
     if (!IS_NUMBER(range->from) || !IS_NUMBER(range->to)) {
       runtime_error(-1, "Range must be 'number':'number' but got '%s':'%s'",
-                    value_type_to_str(range->from.type),
-                    value_type_to_str(range->to.type));
+                    value_type_to_str(VALUE_TYPE(range->from)),
+                    value_type_to_str(VALUE_TYPE(range->to)));
       return NIL_VAL;
     }
 
@@ -197,8 +197,8 @@ xyl_builtin(list) {
     obj_range_t *range = AS_RANGE(arg);
     if (!IS_NUMBER(range->from) || !IS_NUMBER(range->to)) {
       runtime_error(-1, "Range must be 'number':'number' but got '%s':'%s'",
-                    value_type_to_str(range->from.type),
-                    value_type_to_str(range->to.type));
+                    value_type_to_str(VALUE_TYPE(range->from)),
+                    value_type_to_str(VALUE_TYPE(range->to)));
       return NIL_VAL;
     }
 
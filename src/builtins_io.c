@@ -1,5 +1,9 @@
+#include <dirent.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "builtins.h"
 #include "memory.h"
@@ -105,13 +109,8 @@ xyl_builtin(fprintf) {
 
 xyl_builtin(stdin) {
   xyl_builtin_signature(stdin, 0, ARGC_EXACT, {VAL_ANY, OBJ_ANY});
-  obj_t *object = (obj_t *)reallocate(NULL, 0, sizeof(obj_file_t));
-  object->type = OBJ_FILE;
-  object->is_marked = false;
-  object->next = vm.objects;
-  vm.objects = object;
-
-  obj_file_t *file = (obj_file_t *)object;
+  obj_file_t *file =
+      (obj_file_t *)allocate_object(sizeof(obj_file_t), OBJ_FILE);
   file->file = stdin;
   file->open = true;
   file->readable = true;
@@ -123,13 +122,8 @@ xyl_builtin(stdin) {
 
 xyl_builtin(stdout) {
   xyl_builtin_signature(stdout, 0, ARGC_EXACT, {VAL_ANY, OBJ_ANY});
-  obj_t *object = (obj_t *)reallocate(NULL, 0, sizeof(obj_file_t));
-  object->type = OBJ_FILE;
-  object->is_marked = false;
-  object->next = vm.objects;
-  vm.objects = object;
-
-  obj_file_t *file = (obj_file_t *)object;
+  obj_file_t *file =
+      (obj_file_t *)allocate_object(sizeof(obj_file_t), OBJ_FILE);
   file->file = stdout;
   file->open = true;
   file->readable = true;
@@ -140,13 +134,8 @@ xyl_builtin(stdout) {
 }
 
 xyl_builtin(stderr) {
-  obj_t *object = (obj_t *)reallocate(NULL, 0, sizeof(obj_file_t));
-  object->type = OBJ_FILE;
-  object->is_marked = false;
-  object->next = vm.objects;
-  vm.objects = object;
-
-  obj_file_t *file = (obj_file_t *)object;
+  obj_file_t *file =
+      (obj_file_t *)allocate_object(sizeof(obj_file_t), OBJ_FILE);
   file->file = stderr;
   file->open = true;
   file->readable = true;
@@ -200,7 +189,7 @@ xyl_builtin(input) {
   }
 
   buffer[length] = '\0';
-  obj_string_t *str = copy_string(buffer, length, false);
+  obj_string_t *str = take_string(buffer, length);
 
   return OBJ_VAL(str);
 }
@@ -280,7 +269,7 @@ xyl_builtin(read) {
 
   fseek(file->file, start_pos, SEEK_SET);
 
-  return OBJ_VAL(copy_string(buffer, read_size, false));
+  return OBJ_VAL(take_string(buffer, read_size));
 }
 
 xyl_builtin(write) {
@@ -307,3 +296,61 @@ xyl_builtin(write) {
 
   return NIL_VAL;
 }
+
+// Made by temp_dir on first use, removed by remove_temp_dir
+static char *temp_dir;
+
+xyl_builtin(temp_dir) {
+  xyl_builtin_signature(temp_dir, 0, ARGC_EXACT, {VAL_ANY, OBJ_ANY});
+
+  if (temp_dir == NULL) {
+    const char *base = getenv("TMPDIR");
+    if (base == NULL || base[0] == '\0')
+      base = "/tmp";
+
+    size_t size = strlen(base) + sizeof("/xylia-XXXXXX");
+    char *path = malloc(size);
+    if (path == NULL) {
+      runtime_error(-1, "[%s:%s] Failed to allocate memory for the path",
+                    __FILE_NAME__, __PRETTY_FUNCTION__);
+      return NIL_VAL;
+    }
+    snprintf(path, size, "%s/xylia-XXXXXX", base);
+    if (mkdtemp(path) == NULL) {
+      runtime_error(-1, "Failed to create a temporary directory: %s",
+                    strerror(errno));
+      free(path);
+      return NIL_VAL;
+    }
+    temp_dir = path;
+  }
+
+  return OBJ_VAL(copy_string(temp_dir, strlen(temp_dir), false));
+}
+
+void remove_temp_dir(void) {
+  if (temp_dir == NULL)
+    return;
+
+  // Scripts can only create files in it, there are no directories to descend
+  DIR *dir = opendir(temp_dir);
+  if (dir != NULL) {
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+      if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        continue;
+      size_t size = strlen(temp_dir) + strlen(entry->d_name) + 2;
+      char *path = malloc(size);
+      if (path == NULL)
+        break;
+      snprintf(path, size, "%s/%s", temp_dir, entry->d_name);
+      unlink(path);
+      free(path);
+    }
+    closedir(dir);
+  }
+
+  rmdir(temp_dir);
+  free(temp_dir);
+  temp_dir = NULL;
+}
@@ -17,7 +17,7 @@ xyl_builtin(abs) {
 
   runtime_error(
       -1, "Expected argument 1 in 'abs' to be 'number' or 'float' but got '%s'",
-      value_type_to_str(argv[0].type));
+      value_type_to_str(VALUE_TYPE(argv[0])));
   return NIL_VAL;
 }
 
@@ -30,11 +30,11 @@ xyl_builtin(min) {
       runtime_error(-1,
                     "Expected argument %d in 'min' to be 'number' or 'float' "
                     "but got '%s'",
-                    i + 1, value_type_to_str(list->values[i].type));
+                    i + 1, value_type_to_str(VALUE_TYPE(list->values[i])));
       return NIL_VAL;
     }
 
-    if (min.type == VAL_NIL)
+    if (IS_NIL(min))
       min = list->values[i];
 
     double num = IS_NUMBER(list->values[i]) ? (double)AS_NUMBER(list->values[i])
@@ -56,11 +56,11 @@ xyl_builtin(max) {
       runtime_error(-1,
                     "Expected argument %d in 'max' to be 'number' or 'float' "
                     "but got '%s'",
-                    i + 1, value_type_to_str(list->values[i].type));
+                    i + 1, value_type_to_str(VALUE_TYPE(list->values[i])));
       return NIL_VAL;
     }
 
-    if (max.type == VAL_NIL)
+    if (IS_NIL(max))
       max = list->values[i];
 
     double num = IS_NUMBER(list->values[i]) ? (double)AS_NUMBER(list->values[i])
@@ -82,10 +82,14 @@ xyl_builtin(sin) {
 
   runtime_error(
       -1, "Expected argument 1 in 'sin' to be 'number' or 'float' but got '%s'",
-      value_type_to_str(argv[0].type));
+      value_type_to_str(VALUE_TYPE(argv[0])));
   return NIL_VAL;
 }
 
+xyl_builtin_fast(sin) {
+  return FLOAT_VAL(sin(AS_FLOAT(argv[0])));
+}
+
 xyl_builtin(cos) {
   xyl_builtin_signature(cos, 1, ARGC_EXACT, {VAL_ANY, OBJ_ANY});
   if (IS_NUMBER(argv[0]))
@@ -95,10 +99,14 @@ xyl_builtin(cos) {
 
   runtime_error(
       -1, "Expected argument 1 in 'cos' to be 'number' or 'float' but got '%s'",
-      value_type_to_str(argv[0].type));
+      value_type_to_str(VALUE_TYPE(argv[0])));
   return NIL_VAL;
 }
 
+xyl_builtin_fast(cos) {
+  return FLOAT_VAL(cos(AS_FLOAT(argv[0])));
+}
+
 xyl_builtin(tan) {
   xyl_builtin_signature(tan, 1, ARGC_EXACT, {VAL_ANY, OBJ_ANY});
   if (IS_NUMBER(argv[0]))
@@ -108,10 +116,14 @@ xyl_builtin(tan) {
 
   runtime_error(
       -1, "Expected argument 1 in 'tan' to be 'number' or 'float' but got '%s'",
-      value_type_to_str(argv[0].type));
+      value_type_to_str(VALUE_TYPE(argv[0])));
   return NIL_VAL;
 }
 
+xyl_builtin_fast(tan) {
+  return FLOAT_VAL(tan(AS_FLOAT(argv[0])));
+}
+
 xyl_builtin(asin) {
   xyl_builtin_signature(asin, 1, ARGC_EXACT, {VAL_ANY, OBJ_ANY});
   if (IS_NUMBER(argv[0]))
@@ -122,10 +134,14 @@ xyl_builtin(asin) {
   runtime_error(
       -1,
       "Expected argument 1 in 'asin' to be 'number' or 'float' but got '%s'",
-      value_type_to_str(argv[0].type));
+      value_type_to_str(VALUE_TYPE(argv[0])));
   return NIL_VAL;
 }
 
+xyl_builtin_fast(asin) {
+  return FLOAT_VAL(asin(AS_FLOAT(argv[0])));
+}
+
 xyl_builtin(acos) {
   xyl_builtin_signature(acos, 1, ARGC_EXACT, {VAL_ANY, OBJ_ANY});
   if (IS_NUMBER(argv[0]))
@@ -136,10 +152,14 @@ xyl_builtin(acos) {
   runtime_error(
       -1,
       "Expected argument 1 in 'acos' to be 'number' or 'float' but got '%s'",
-      value_type_to_str(argv[0].type));
+      value_type_to_str(VALUE_TYPE(argv[0])));
   return NIL_VAL;
 }
 
+xyl_builtin_fast(acos) {
+  return FLOAT_VAL(acos(AS_FLOAT(argv[0])));
+}
+
 xyl_builtin(atan) {
   xyl_builtin_signature(atan, 1, ARGC_EXACT, {VAL_ANY, OBJ_ANY});
   if (IS_NUMBER(argv[0]))
@@ -150,16 +170,24 @@ xyl_builtin(atan) {
   runtime_error(
       -1,
       "Expected argument 1 in 'atan' to be 'number' or 'float' but got '%s'",
-      value_type_to_str(argv[0].type));
+      value_type_to_str(VALUE_TYPE(argv[0])));
   return NIL_VAL;
 }
 
+xyl_builtin_fast(atan) {
+  return FLOAT_VAL(atan(AS_FLOAT(argv[0])));
+}
+
 xyl_builtin(atan2) {
   xyl_builtin_signature(atan2, 2, ARGC_EXACT, {VAL_FLOAT, OBJ_ANY},
                         {VAL_FLOAT, OBJ_ANY});
   return FLOAT_VAL(atan2(AS_FLOAT(argv[0]), AS_FLOAT(argv[1])));
 }
 
+xyl_builtin_fast(atan2) {
+  return FLOAT_VAL(atan2(AS_FLOAT(argv[0]), AS_FLOAT(argv[1])));
+}
+
 xyl_builtin(sqrt) {
   xyl_builtin_signature(sqrt, 1, ARGC_EXACT, {VAL_ANY, OBJ_ANY});
   if (IS_NUMBER(argv[0]))
@@ -170,10 +198,14 @@ xyl_builtin(sqrt) {
   runtime_error(
       -1,
       "Expected argument 1 in 'sqrt' to be 'number' or 'float' but got '%s'",
-      value_type_to_str(argv[0].type));
+      value_type_to_str(VALUE_TYPE(argv[0])));
   return NIL_VAL;
 }
 
+xyl_builtin_fast(sqrt) {
+  return FLOAT_VAL(sqrt(AS_FLOAT(argv[0])));
+}
+
 xyl_builtin(pow) {
   xyl_builtin_signature(pow, 2, ARGC_EXACT, {VAL_ANY, OBJ_ANY},
                         {VAL_ANY, OBJ_ANY});
@@ -181,7 +213,7 @@ xyl_builtin(pow) {
     runtime_error(
         -1,
         "Expected argument 1 in 'pow' to be 'number' or 'float' but got '%s'",
-        value_type_to_str(argv[0].type));
+        value_type_to_str(VALUE_TYPE(argv[0])));
     return NIL_VAL;
   }
 
@@ -189,7 +221,7 @@ xyl_builtin(pow) {
     runtime_error(
         -1,
         "Expected argument 2 in 'pow' to be 'number' or 'float' but got '%s'",
-        value_type_to_str(argv[1].type));
+        value_type_to_str(VALUE_TYPE(argv[1])));
     return NIL_VAL;
   }
 
@@ -199,6 +231,10 @@ xyl_builtin(pow) {
   return FLOAT_VAL(pow(a, b));
 }
 
+xyl_builtin_fast(pow) {
+  return FLOAT_VAL(pow(AS_FLOAT(argv[0]), AS_FLOAT(argv[1])));
+}
+
 xyl_builtin(log) {
   xyl_builtin_signature(log, 1, ARGC_EXACT, {VAL_ANY, OBJ_ANY});
   if (IS_NUMBER(argv[0]))
@@ -208,10 +244,14 @@ xyl_builtin(log) {
 
   runtime_error(
       -1, "Expected argument 1 in 'log' to be 'number' or 'float' but got '%s'",
-      value_type_to_str(argv[0].type));
+      value_type_to_str(VALUE_TYPE(argv[0])));
   return NIL_VAL;
 }
 
+xyl_builtin_fast(log) {
+  return FLOAT_VAL(log(AS_FLOAT(argv[0])));
+}
+
 xyl_builtin(exp) {
   xyl_builtin_signature(exp, 1, ARGC_EXACT, {VAL_ANY, OBJ_ANY});
   if (IS_NUMBER(argv[0]))
@@ -221,25 +261,41 @@ xyl_builtin(exp) {
 
   runtime_error(
       -1, "Expected argument 1 in 'exp' to be 'number' or 'float' but got '%s'",
-      value_type_to_str(argv[0].type));
+      value_type_to_str(VALUE_TYPE(argv[0])));
   return NIL_VAL;
 }
 
+xyl_builtin_fast(exp) {
+  return FLOAT_VAL(exp(AS_FLOAT(argv[0])));
+}
+
 xyl_builtin(floor) {
   xyl_builtin_signature(floor, 1, ARGC_EXACT, {VAL_FLOAT, OBJ_ANY});
   return NUMBER_VAL((int64_t)floor(AS_FLOAT(argv[0])));
 }
 
+xyl_builtin_fast(floor) {
+  return NUMBER_VAL((int64_t)floor(AS_FLOAT(argv[0])));
+}
+
 xyl_builtin(ceil) {
   xyl_builtin_signature(ceil, 1, ARGC_EXACT, {VAL_FLOAT, OBJ_ANY});
   return NUMBER_VAL((int64_t)ceil(AS_FLOAT(argv[0])));
 }
 
+xyl_builtin_fast(ceil) {
+  return NUMBER_VAL((int64_t)ceil(AS_FLOAT(argv[0])));
+}
+
 xyl_builtin(round) {
   xyl_builtin_signature(round, 1, ARGC_EXACT, {VAL_FLOAT, OBJ_ANY});
   return NUMBER_VAL((int64_t)round(AS_FLOAT(argv[0])));
 }
 
+xyl_builtin_fast(round) {
+  return NUMBER_VAL((int64_t)round(AS_FLOAT(argv[0])));
+}
+
 xyl_builtin(random) {
   xyl_builtin_signature(random, 0, ARGC_EXACT, {VAL_ANY, OBJ_ANY});
   return FLOAT_VAL(mt_rand_double01());
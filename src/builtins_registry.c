@@ -0,0 +1,146 @@
+#include "builtins.h"
+
+// Position in this table is the builtin's ID, which OP_CALL_BUILTIN encodes
+// directly in bytecode. New builtins must be appended to keep IDs stable
+#define BUILTIN(name)                                                          \
+  {"__builtin___" #name, builtin_##name, NULL, 0, {0}, true, false}
+#define BUILTIN_CLEAN(name) {#name, builtin_##name, NULL, 0, {0}, true, false}
+#define BUILTIN_FAST(name, argc, ...)                                          \
+  {"__builtin___" #name, builtin_##name, builtin_fast_##name, argc,            \
+   {__VA_ARGS__}, true, false}
+#define BUILTIN_CLEAN_FAST(name, argc, ...)                                    \
+  {#name, builtin_##name, builtin_fast_##name, argc, {__VA_ARGS__}, true, false}
+// Needs its callee slot and may push a frame, so it's always called through
+// call_value
+#define BUILTIN_INDIRECT(name) {#name, builtin_##name, NULL, 0, {0}, false, false}
+#define BUILTIN_TEST(name) {#name, builtin_##name, NULL, 0, {0}, true, true}
+
+const builtin_entry_t builtin_registry[] = {
+    // IO
+    BUILTIN(print),
+    BUILTIN(println),
+    BUILTIN(printf),
+
+    BUILTIN(fprint),
+    BUILTIN(fprintln),
+    BUILTIN(fprintf),
+
+    BUILTIN(stdin),
+    BUILTIN(stdout),
+    BUILTIN(stderr),
+
+    BUILTIN(input),
+
+    BUILTIN(open),
+    BUILTIN(close),
+    BUILTIN(read),
+    BUILTIN(write),
+
+    // Vectors
+    BUILTIN_CLEAN_FAST(len, 1, VAL_OBJ),
+    BUILTIN(append),
+    BUILTIN(pop),
+    BUILTIN(insert),
+    BUILTIN(remove),
+    BUILTIN(slice),
+
+    // Arrays
+    BUILTIN(array),
+    BUILTIN(resize),
+
+    // Utils
+    BUILTIN_CLEAN(typeof),
+    BUILTIN_CLEAN(isinstance),
+    BUILTIN_CLEAN(hasmethod),
+    BUILTIN_CLEAN(getclass),
+    BUILTIN_CLEAN(exit),
+    BUILTIN_CLEAN(argv),
+    BUILTIN(hash),
+    BUILTIN_INDIRECT(import),
+
+    // Casts
+    BUILTIN_CLEAN(string),
+    BUILTIN_CLEAN(number),
+    BUILTIN_CLEAN(float),
+    BUILTIN_CLEAN(bool),
+    BUILTIN_CLEAN(vector),
+    BUILTIN_CLEAN(list),
+
+    // Results
+    BUILTIN_CLEAN(ok),
+    BUILTIN_CLEAN(err),
+    BUILTIN_CLEAN(is_ok),
+    BUILTIN_CLEAN(is_err),
+    BUILTIN_CLEAN(unwrap),
+    BUILTIN_CLEAN(unwrap_or),
+    BUILTIN_CLEAN(unwrap_err),
+    BUILTIN_CLEAN(expect),
+
+    // Math
+    BUILTIN(abs),
+    BUILTIN(min),
+    BUILTIN(max),
+
+    BUILTIN_FAST(sin, 1, VAL_FLOAT),
+    BUILTIN_FAST(cos, 1, VAL_FLOAT),
+    BUILTIN_FAST(tan, 1, VAL_FLOAT),
+    BUILTIN_FAST(asin, 1, VAL_FLOAT),
+    BUILTIN_FAST(acos, 1, VAL_FLOAT),
+    BUILTIN_FAST(atan, 1, VAL_FLOAT),
+    BUILTIN_FAST(atan2, 2, VAL_FLOAT, VAL_FLOAT),
+
+    BUILTIN_FAST(sqrt, 1, VAL_FLOAT),
+    BUILTIN_FAST(pow, 2, VAL_FLOAT, VAL_FLOAT),
+    BUILTIN_FAST(log, 1, VAL_FLOAT),
+    BUILTIN_FAST(exp, 1, VAL_FLOAT),
+
+    BUILTIN_FAST(floor, 1, VAL_FLOAT),
+    BUILTIN_FAST(ceil, 1, VAL_FLOAT),
+    BUILTIN_FAST(round, 1, VAL_FLOAT),
+
+    // Random
+    BUILTIN(random),
+    BUILTIN(randomseed),
+
+    // Time
+    BUILTIN(now),
+    BUILTIN(clock),
+    BUILTIN(sleep),
+    BUILTIN(localtime),
+
+    // Tests
+    BUILTIN_TEST(case_failed),
+    BUILTIN_TEST(assert_true),
+    BUILTIN_TEST(assert_false),
+    BUILTIN_TEST(assert_eq),
+    BUILTIN_TEST(assert_neq),
+
+    // Runtime
+    BUILTIN(gc_stats),
+    BUILTIN(gc_policy),
+    BUILTIN(set_gc_policy),
+    BUILTIN(start_alloc_profile),
+    BUILTIN(stop_alloc_profile),
+    BUILTIN(write_alloc_profile),
+    BUILTIN(heap_snapshot),
+
+    // Strings
+    BUILTIN_FAST(byte_at, 2, VAL_OBJ, VAL_NUMBER),
+    BUILTIN(from_bytes),
+
+    // IO
+    BUILTIN(temp_dir),
+
+    // Runtime
+    BUILTIN(compact_heap),
+};
+
+const int builtin_registry_count =
+    sizeof(builtin_registry) / sizeof(builtin_registry[0]);
+
+#undef BUILTIN_TEST
+#undef BUILTIN_INDIRECT
+#undef BUILTIN_CLEAN_FAST
+#undef BUILTIN_FAST
+#undef BUILTIN_CLEAN
+#undef BUILTIN
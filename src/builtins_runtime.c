@@ -0,0 +1,143 @@
+#include <string.h>
+
+#include "builtins.h"
+#include "heap_snapshot.h"
+#include "memory.h"
+#include "object.h"
+#include "profiler.h"
+#include "vm.h"
+
+// Pops the top count values into a new list, in the order they were pushed
+static void collect_list(int count) {
+  obj_list_t *list = new_list(count);
+  value_t *values = vm.stack_top - count;
+  if (count != 0)
+    memcpy(list->values, values, sizeof(value_t) * count);
+  vm.stack_top = values;
+  push(OBJ_VAL(list));
+}
+
+static void push_counts(const uint64_t *counts, int count) {
+  for (int i = 0; i < count; i++)
+    push(NUMBER_VAL((int64_t)counts[i]));
+  collect_list(count);
+}
+
+xyl_builtin(gc_stats) {
+  xyl_builtin_signature(gc_stats, 0, ARGC_EXACT, {VAL_ANY, OBJ_ANY});
+  const gc_stats_t *stats = read_gc_stats();
+
+  // Everything stays on the stack until the list holding it is made
+  push(NUMBER_VAL((int64_t)stats->collections));
+  push(NUMBER_VAL((int64_t)stats->minor_collections));
+  push(NUMBER_VAL((int64_t)stats->pause_count));
+  push(FLOAT_VAL(stats->pause_total_ns / 1e6));
+  push(FLOAT_VAL(stats->pause_max_ns / 1e6));
+  push_counts(stats->pause_buckets, GC_PAUSE_BUCKETS);
+
+  for (int type = 0; type < OBJ_ANY; type++) {
+    const char *name = gc_type_name(type);
+    push(OBJ_VAL(copy_string(name, strlen(name), false)));
+  }
+  collect_list(OBJ_ANY);
+  push_counts(stats->allocated_bytes, OBJ_ANY);
+  push_counts(stats->live_objects, OBJ_ANY);
+  push_counts(stats->live_bytes, OBJ_ANY);
+
+#ifdef COUNT_INSTRUCTIONS
+  push(NUMBER_VAL((int64_t)vm.instruction_count));
+#else
+  push(NIL_VAL);
+#endif
+  push(NUMBER_VAL((int64_t)stats->peak_heap));
+  push(NUMBER_VAL((int64_t)stats->compactions));
+  push(NUMBER_VAL((int64_t)stats->evacuated_slabs));
+
+  collect_list(14);
+  return pop();
+}
+
+xyl_builtin(gc_policy) {
+  xyl_builtin_signature(gc_policy, 0, ARGC_EXACT, {VAL_ANY, OBJ_ANY});
+  push(NUMBER_VAL((int64_t)vm.gc_initial_heap));
+  push(FLOAT_VAL(vm.gc_grow_factor));
+  push(NUMBER_VAL((int64_t)vm.gc_max_heap));
+  push(BOOL_VAL(vm.gc_adaptive));
+  collect_list(4);
+  return pop();
+}
+
+xyl_builtin(set_gc_policy) {
+  xyl_builtin_signature(set_gc_policy, 4, ARGC_EXACT, {VAL_NUMBER, OBJ_ANY},
+                        {VAL_ANY, OBJ_ANY}, {VAL_NUMBER, OBJ_ANY},
+                        {VAL_BOOL, OBJ_ANY});
+  int64_t initial_heap = AS_NUMBER(argv[0]);
+  int64_t max_heap = AS_NUMBER(argv[2]);
+  double grow_factor = IS_NUMBER(argv[1])  ? (double)AS_NUMBER(argv[1])
+                       : IS_FLOAT(argv[1]) ? AS_FLOAT(argv[1])
+                                           : 0;
+
+  if (initial_heap <= 0) {
+    runtime_error(-1, "Initial heap size has to be positive");
+    return NIL_VAL;
+  }
+  if (!(grow_factor > 1)) {
+    runtime_error(-1, "Growth factor has to be a number above 1");
+    return NIL_VAL;
+  }
+  if (max_heap < 0) {
+    runtime_error(-1, "Maximum heap size can't be negative, 0 sets no limit");
+    return NIL_VAL;
+  }
+
+  // Only the first full collection waits for the initial heap to fill up
+  if (gc_stats.collections == 0)
+    vm.next_gc = initial_heap;
+  vm.gc_initial_heap = initial_heap;
+  vm.gc_grow_factor = grow_factor;
+  vm.gc_max_heap = max_heap;
+  vm.gc_adaptive = AS_BOOL(argv[3]);
+  return NIL_VAL;
+}
+
+xyl_builtin(start_alloc_profile) {
+  xyl_builtin_signature(start_alloc_profile, 1, ARGC_EXACT,
+                        {VAL_NUMBER, OBJ_ANY});
+  if (AS_NUMBER(argv[0]) <= 0) {
+    runtime_error(-1, "Sampling interval has to be a positive number of bytes");
+    return NIL_VAL;
+  }
+  start_alloc_profile(AS_NUMBER(argv[0]));
+  return NIL_VAL;
+}
+
+xyl_builtin(stop_alloc_profile) {
+  xyl_builtin_signature(stop_alloc_profile, 0, ARGC_EXACT, {VAL_ANY, OBJ_ANY});
+  stop_alloc_profile();
+  return NIL_VAL;
+}
+
+xyl_builtin(write_alloc_profile) {
+  xyl_builtin_signature(write_alloc_profile, 1, ARGC_EXACT,
+                        {VAL_OBJ, OBJ_STRING});
+  if (!write_alloc_profile(AS_CSTRING(argv[0])))
+    runtime_error(-1, "Could not write the allocation profile to '%s'",
+                  AS_CSTRING(argv[0]));
+  return NIL_VAL;
+}
+
+xyl_builtin(heap_snapshot) {
+  xyl_builtin_signature(heap_snapshot, 1, ARGC_EXACT, {VAL_OBJ, OBJ_STRING});
+  if (!write_heap_snapshot(AS_CSTRING(argv[0])))
+    runtime_error(-1, "Could not write the heap snapshot to '%s'",
+                  AS_CSTRING(argv[0]));
+  return NIL_VAL;
+}
+
+xyl_builtin(compact_heap) {
+  xyl_builtin_signature(compact_heap, 0, ARGC_EXACT, {VAL_ANY, OBJ_ANY});
+  // Objects only move between instructions, see run()
+  vm.gc_compact_pending = true;
+  vm.update_frame = true;
+  return NIL_VAL;
+}
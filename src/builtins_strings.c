@@ -0,0 +1,58 @@
+#include <stdlib.h>
+
+#include "builtins.h"
+#include "vm.h"
+
+xyl_builtin(byte_at) {
+  xyl_builtin_signature(byte_at, 2, ARGC_EXACT, {VAL_OBJ, OBJ_STRING},
+                        {VAL_NUMBER, OBJ_ANY});
+
+  obj_string_t *string = AS_STRING(argv[0]);
+  int64_t index = AS_NUMBER(argv[1]);
+  if (index < 0 || index >= string->length) {
+    runtime_error(-1, "String index '%lld' out of bounds", (long long)index);
+    return NIL_VAL;
+  }
+  return NUMBER_VAL((uint8_t)string->chars[index]);
+}
+
+xyl_builtin_fast(byte_at) {
+  if (!IS_STRING(argv[0]))
+    return UNDEFINED_VAL;
+
+  obj_string_t *string = AS_STRING(argv[0]);
+  int64_t index = AS_NUMBER(argv[1]);
+  if (index < 0 || index >= string->length)
+    return UNDEFINED_VAL;
+  return NUMBER_VAL((uint8_t)string->chars[index]);
+}
+
+xyl_builtin(from_bytes) {
+  xyl_builtin_signature(from_bytes, 1, ARGC_EXACT, {VAL_OBJ, OBJ_LIST});
+
+  obj_list_t *bytes = AS_LIST(argv[0]);
+  for (int i = 0; i < bytes->count; i++) {
+    value_t byte = bytes->values[i];
+    if (!IS_NUMBER(byte) || AS_NUMBER(byte) < 0 || AS_NUMBER(byte) > 255) {
+      runtime_error(-1,
+                    "Expected argument %d in 'from_bytes' to be a 'number' "
+                    "from 0 to 255",
+                    i + 1);
+      return NIL_VAL;
+    }
+  }
+
+  if (bytes->count == 1)
+    return OBJ_VAL(vm.byte_strings[AS_NUMBER(bytes->values[0])]);
+
+  char *chars = malloc(bytes->count + 1);
+  if (chars == NULL) {
+    runtime_error(-1, "[%s:%s] Failed to allocate memory for the string",
+                  __FILE_NAME__, __PRETTY_FUNCTION__);
+    return NIL_VAL;
+  }
+  for (int i = 0; i < bytes->count; i++)
+    chars[i] = (char)AS_NUMBER(bytes->values[i]);
+  chars[bytes->count] = '\0';
+  return OBJ_VAL(take_string(chars, bytes->count));
+}
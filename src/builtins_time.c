@@ -45,7 +45,7 @@ xyl_builtin(sleep) {
   runtime_error(
       -1,
       "Expected argument 1 in 'sleep' to be 'number' or 'float' but got '%s'",
-      value_type_to_str(argv[0].type));
+      value_type_to_str(VALUE_TYPE(argv[0])));
   return NIL_VAL;
 }
 
@@ -15,7 +15,7 @@ xyl_builtin(typeof) {
   xyl_builtin_signature(typeof, 1, ARGC_EXACT, {VAL_ANY, OBJ_ANY});
 
   value_t value = argv[0];
-  switch (value.type) {
+  switch (VALUE_TYPE(value)) {
   case VAL_BOOL:
     return OBJ_VAL(vm.vm_strings[VM_STR_BOOL]);
   case VAL_NIL:
@@ -58,6 +58,7 @@ xyl_builtin(typeof) {
       return OBJ_VAL(vm.vm_strings[VM_STR_RESULT]);
     case OBJ_ENUM:
       return OBJ_VAL(vm.vm_strings[VM_STR_ENUM]);
+    case OBJ_NUMBER:
     case OBJ_ANY: // Unreachable
       break;
     }
@@ -114,7 +115,7 @@ xyl_builtin(hash) {
   xyl_builtin_signature(hash, 1, ARGC_EXACT, {VAL_ANY, OBJ_ANY});
   value_t value = argv[0];
 
-  switch (value.type) {
+  switch (VALUE_TYPE(value)) {
   case VAL_BOOL:
     if (AS_BOOL(value))
       return NUMBER_VAL(HASH_TRUE);
@@ -131,8 +132,7 @@ xyl_builtin(hash) {
 
   case VAL_OBJ:
     if (AS_OBJ(value)->type == OBJ_STRING) {
-      obj_string_t *string = AS_STRING(value);
-      return NUMBER_VAL(hash_string(string->chars, string->length));
+      return NUMBER_VAL(to_positive_int64(string_hash(AS_STRING(value))));
     }
 
   case VAL_ANY:
@@ -5,8 +5,9 @@
 xyl_builtin(len) {
   xyl_builtin_signature(len, 1, ARGC_EXACT, {VAL_OBJ, OBJ_ANY});
 
+  // Ropes know their length without being flattened
   if (IS_STRING(argv[0]))
-    return NUMBER_VAL(AS_STRING(argv[0])->length);
+    return NUMBER_VAL(((obj_string_t *)AS_OBJ(argv[0]))->length);
   else if (IS_VECTOR(argv[0]))
     return NUMBER_VAL(AS_VECTOR(argv[0])->count);
   else if (IS_LIST(argv[0]))
@@ -18,11 +19,27 @@ xyl_builtin(len) {
   return NIL_VAL;
 }
 
+xyl_builtin_fast(len) {
+  switch (AS_OBJ(argv[0])->type) {
+  case OBJ_STRING:
+    return NUMBER_VAL(((obj_string_t *)AS_OBJ(argv[0]))->length);
+  case OBJ_VECTOR:
+    return NUMBER_VAL(AS_VECTOR(argv[0])->count);
+  case OBJ_LIST:
+    return NUMBER_VAL(AS_LIST(argv[0])->count);
+  case OBJ_ARRAY:
+    return NUMBER_VAL(AS_ARRAY(argv[0])->count);
+  default:
+    return UNDEFINED_VAL;
+  }
+}
+
 xyl_builtin(append) {
   xyl_builtin_signature(append, 2, ARGC_MORE_OR_EXACT, {VAL_OBJ, OBJ_VECTOR},
                         {VAL_ANY, OBJ_ANY});
 
   obj_vector_t *vector = AS_VECTOR(argv[0]);
+  int first = vector->count;
 
   for (int i = 1; i < argc; i++) {
     if (IS_VECTOR(argv[i]) && AS_VECTOR(argv[i])->spread) {
@@ -59,6 +76,8 @@ xyl_builtin(append) {
     }
   }
 
+  // The appended values are all still rooted by argv up to here
+  WRITE_BARRIER_VALUES(vector, first, vector->count);
   return NIL_VAL;
 }
 
@@ -100,6 +119,7 @@ xyl_builtin(insert) {
 
   vector->values[index] = value;
   vector->count++;
+  WRITE_BARRIER_VALUES(vector, index, vector->count);
   return NIL_VAL;
 }
 
@@ -120,6 +140,7 @@ xyl_builtin(remove) {
 
   for (int i = index; i < vector->count; i++)
     vector->values[i] = vector->values[i + 1];
+  WRITE_BARRIER_VALUES(vector, index, vector->count);
 
   return removed;
 }
@@ -207,9 +228,9 @@ xyl_builtin(slice) {
     }
 
     if (from == to)
-      return OBJ_VAL(copy_string("", 0, true));
+      return OBJ_VAL(copy_string("", 0, false));
 
-    obj_string_t *new_str = copy_string(string->chars + from, to - from, true);
+    obj_string_t *new_str = copy_string(string->chars + from, to - from, false);
     return OBJ_VAL(new_str);
   }
 
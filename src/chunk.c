@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include "chunk.h"
 #include "memory.h"
 #include "value.h"
@@ -7,6 +9,10 @@ void init_chunk(chunk_t *chunk) {
   chunk->capacity = 0;
   chunk->count = 0;
   chunk->code = NULL;
+  chunk->feedback = NULL;
+  chunk->cache_capacity = 0;
+  chunk->cache_count = 0;
+  chunk->caches = NULL;
   chunk->pos_capacity = 0;
   chunk->pos_count = 0;
   chunk->positions = NULL;
@@ -15,7 +21,9 @@ void init_chunk(chunk_t *chunk) {
 
 void free_chunk(chunk_t *chunk) {
   FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+  FREE_ARRAY(uint8_t, chunk->feedback, chunk->capacity);
   FREE_ARRAY(srcpos_t, chunk->positions, chunk->pos_capacity);
+  FREE_ARRAY(inline_cache_t, chunk->caches, chunk->cache_capacity);
   free_value_array(&chunk->constants);
   init_chunk(chunk);
 }
@@ -26,8 +34,11 @@ static inline void write_chunk_internal(chunk_t *chunk, uint8_t byte) {
     chunk->capacity = GROW_CAPACITY(old_capacity);
     chunk->code =
         GROW_ARRAY(uint8_t, chunk->code, old_capacity, chunk->capacity);
+    chunk->feedback =
+        GROW_ARRAY(uint8_t, chunk->feedback, old_capacity, chunk->capacity);
   }
 
+  chunk->feedback[chunk->count] = 0;
   chunk->code[chunk->count++] = byte;
 }
 
@@ -57,6 +68,19 @@ unsigned int add_constant(chunk_t *chunk, value_t value) {
   return chunk->constants.count - 1;
 }
 
+int add_inline_cache(chunk_t *chunk) {
+  if (chunk->cache_count >= chunk->cache_capacity) {
+    int old_capacity = chunk->cache_capacity;
+    chunk->cache_capacity = GROW_CAPACITY(old_capacity);
+    chunk->caches = GROW_ARRAY(inline_cache_t, chunk->caches, old_capacity,
+                               chunk->cache_capacity);
+  }
+
+  // Epoch 0 is never current, so a fresh cache starts out empty
+  memset(&chunk->caches[chunk->cache_count], 0, sizeof(inline_cache_t));
+  return chunk->cache_count++;
+}
+
 void write_constant(uint8_t op, chunk_t *chunk, value_t value) {
   unsigned int constant = add_constant(chunk, value);
   if (constant > UINT8_MAX) {
@@ -72,7 +96,7 @@ void write_constant(uint8_t op, chunk_t *chunk, value_t value) {
 
 srcpos_t chunk_get_srcpos(chunk_t *chunk, int offset) {
   int lo = 0;
-  int hi = chunk->pos_count + 1;
+  int hi = chunk->pos_count - 1;
 
   while (lo <= hi) {
     int mid = (lo + hi) / 2;
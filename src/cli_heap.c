@@ -0,0 +1,494 @@
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cli.h"
+#include "hash.h"
+#include "heap_snapshot.h"
+
+// Rows of each table printed unless --top says otherwise
+#define HEAP_TOP_DEFAULT 20
+
+// A snapshot as read back, with references in compressed sparse rows: the
+// targets of node i are targets[first[i]] up to targets[first[i + 1]]
+typedef struct {
+  int count;
+  int capacity;
+  char **types;
+  char **names;
+  uint64_t *sizes;
+
+  int edge_count;
+  int edge_capacity;
+  int *from;
+  int *to;
+
+  int *successors;
+  int *successor_start;
+  int *predecessors;
+  int *predecessor_start;
+} heap_t;
+
+static void *grow(void *pointer, size_t size) {
+  void *result = realloc(pointer, size);
+  if (result == NULL) {
+    perror("realloc");
+    exit(1);
+  }
+  return result;
+}
+
+static void *zeroed(size_t count, size_t size) {
+  void *result = calloc(count == 0 ? 1 : count, size);
+  if (result == NULL) {
+    perror("calloc");
+    exit(1);
+  }
+  return result;
+}
+
+// Splits line at its tabs, returns the number of fields found
+static int split(char *line, char **fields, int max) {
+  line[strcspn(line, "\n")] = '\0';
+  int count = 0;
+  fields[count++] = line;
+  for (char *c = line; *c != '\0' && count < max; c++) {
+    if (*c == '\t') {
+      *c = '\0';
+      fields[count++] = c + 1;
+    }
+  }
+  return count;
+}
+
+static void add_node(heap_t *heap, int id, const char *type, uint64_t size,
+                     const char *name) {
+  if (id >= heap->capacity) {
+    int old = heap->capacity;
+    heap->capacity = id + 1 > old * 2 ? id + 1 : old * 2;
+    heap->types = grow(heap->types, sizeof(char *) * heap->capacity);
+    heap->names = grow(heap->names, sizeof(char *) * heap->capacity);
+    heap->sizes = grow(heap->sizes, sizeof(uint64_t) * heap->capacity);
+    for (int i = old; i < heap->capacity; i++) {
+      heap->types[i] = NULL;
+      heap->names[i] = NULL;
+      heap->sizes[i] = 0;
+    }
+  }
+  if (id >= heap->count)
+    heap->count = id + 1;
+  heap->types[id] = strdup(type);
+  heap->names[id] = strdup(name);
+  heap->sizes[id] = size;
+}
+
+static void add_edge(heap_t *heap, int from, int to) {
+  if (heap->edge_count >= heap->edge_capacity) {
+    heap->edge_capacity = heap->edge_capacity < 8 ? 8 : heap->edge_capacity * 2;
+    heap->from = grow(heap->from, sizeof(int) * heap->edge_capacity);
+    heap->to = grow(heap->to, sizeof(int) * heap->edge_capacity);
+  }
+  heap->from[heap->edge_count] = from;
+  heap->to[heap->edge_count] = to;
+  heap->edge_count++;
+}
+
+static bool read_heap(const char *path, heap_t *heap) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    fprintf(stderr, "Error: Could not open '%s'\n", path);
+    return false;
+  }
+
+  char *line = NULL;
+  size_t line_size = 0;
+  int row = 1;
+  bool ok = getline(&line, &line_size, file) > 0 &&
+            strncmp(line, HEAP_SNAPSHOT_HEADER "\n",
+                    sizeof(HEAP_SNAPSHOT_HEADER)) == 0;
+  if (!ok)
+    fprintf(stderr, "Error: '%s' is not a heap snapshot\n", path);
+
+  while (ok && getline(&line, &line_size, file) > 0) {
+    row++;
+    char *fields[5];
+    int count = split(line, fields, 5);
+    if (count == 5 && strcmp(fields[0], "n") == 0) {
+      int id = atoi(fields[1]);
+      ok = id >= 0;
+      if (ok)
+        add_node(heap, id, fields[2], strtoull(fields[3], NULL, 10),
+                 fields[4]);
+    } else if (count == 5 && strcmp(fields[0], "e") == 0) {
+      int from = atoi(fields[1]);
+      int to = atoi(fields[2]);
+      ok = from >= 0 && to >= 0;
+      if (ok)
+        add_edge(heap, from, to);
+    } else {
+      ok = false;
+    }
+    if (!ok)
+      fprintf(stderr, "Error: Malformed line %d in '%s'\n", row, path);
+  }
+
+  free(line);
+  fclose(file);
+  if (!ok)
+    return false;
+
+  for (int i = 0; i < heap->edge_count; i++) {
+    if (heap->from[i] >= heap->count || heap->to[i] >= heap->count ||
+        heap->types[heap->from[i]] == NULL || heap->types[heap->to[i]] == NULL) {
+      fprintf(stderr, "Error: '%s' refers to objects it doesn't list\n", path);
+      return false;
+    }
+  }
+  if (heap->count == 0 || heap->types[0] == NULL) {
+    fprintf(stderr, "Error: '%s' has no roots\n", path);
+    return false;
+  }
+  return true;
+}
+
+// Sorts the ends of the references by the other end into sparse rows
+static void index_edges(heap_t *heap, const int *keys, const int *values,
+                        int **rows, int **start) {
+  *start = zeroed(heap->count + 1, sizeof(int));
+  *rows = zeroed(heap->edge_count, sizeof(int));
+  for (int i = 0; i < heap->edge_count; i++)
+    (*start)[keys[i] + 1]++;
+  for (int i = 0; i < heap->count; i++)
+    (*start)[i + 1] += (*start)[i];
+
+  int *next = zeroed(heap->count, sizeof(int));
+  memcpy(next, *start, sizeof(int) * heap->count);
+  for (int i = 0; i < heap->edge_count; i++)
+    (*rows)[next[keys[i]]++] = values[i];
+  free(next);
+}
+
+// Numbers the nodes reachable from the roots in depth first postorder.
+// Returns how many there are, order lists them and post maps them back
+static int postorder(heap_t *heap, int *order, int *post) {
+  int *stack = zeroed(heap->count, sizeof(int));
+  int *cursor = zeroed(heap->count, sizeof(int));
+  bool *seen = zeroed(heap->count, sizeof(bool));
+  int depth = 0;
+  int numbered = 0;
+
+  for (int i = 0; i < heap->count; i++)
+    post[i] = -1;
+  stack[depth++] = 0;
+  seen[0] = true;
+  cursor[0] = heap->successor_start[0];
+
+  while (depth > 0) {
+    int node = stack[depth - 1];
+    if (cursor[node] < heap->successor_start[node + 1]) {
+      int next = heap->successors[cursor[node]++];
+      if (!seen[next]) {
+        seen[next] = true;
+        cursor[next] = heap->successor_start[next];
+        stack[depth++] = next;
+      }
+      continue;
+    }
+    depth--;
+    post[node] = numbered;
+    order[numbered++] = node;
+  }
+
+  free(stack);
+  free(cursor);
+  free(seen);
+  return numbered;
+}
+
+static int intersect(const int *idom, const int *post, int a, int b) {
+  while (a != b) {
+    while (post[a] < post[b])
+      a = idom[a];
+    while (post[b] < post[a])
+      b = idom[b];
+  }
+  return a;
+}
+
+// Immediate dominators, as in "A Simple, Fast Dominance Algorithm" by Cooper,
+// Harvey and Kennedy. An object's dominator is the closest object every path
+// from the roots to it goes through, which frees it when it dies
+static void dominators(heap_t *heap, const int *order, const int *post,
+                       int reached, int *idom) {
+  for (int i = 0; i < heap->count; i++)
+    idom[i] = -1;
+  idom[0] = 0;
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    // Reverse postorder, the roots come last in postorder
+    for (int i = reached - 2; i >= 0; i--) {
+      int node = order[i];
+      int dominator = -1;
+      for (int j = heap->predecessor_start[node];
+           j < heap->predecessor_start[node + 1]; j++) {
+        int predecessor = heap->predecessors[j];
+        if (idom[predecessor] == -1)
+          continue;
+        dominator = dominator == -1
+                        ? predecessor
+                        : intersect(idom, post, predecessor, dominator);
+      }
+      if (idom[node] != dominator) {
+        idom[node] = dominator;
+        changed = true;
+      }
+    }
+  }
+}
+
+// Instances are grouped by class, everything else by type
+static const char *group_name(heap_t *heap, int node) {
+  return strcmp(heap->types[node], "instance") == 0 ? heap->names[node]
+                                                    : heap->types[node];
+}
+
+typedef struct {
+  const char *name;
+  uint64_t count;
+  uint64_t self;
+  uint64_t retained;
+} group_t;
+
+typedef struct {
+  group_t *groups;
+  int count;
+  int *slots;
+  int capacity;
+} groups_t;
+
+static int find_group(groups_t *groups, const char *name) {
+  if ((groups->count + 1) * 2 > groups->capacity) {
+    int *slots = groups->slots;
+    int capacity = groups->capacity;
+    groups->capacity = capacity < 64 ? 64 : capacity * 2;
+    groups->slots = zeroed(groups->capacity, sizeof(int));
+    groups->groups = grow(groups->groups, sizeof(group_t) * groups->capacity);
+    for (int i = 0; i < capacity; i++) {
+      if (slots[i] == 0)
+        continue;
+      const char *old = groups->groups[slots[i] - 1].name;
+      int index = hash_string(old, strlen(old)) & (groups->capacity - 1);
+      while (groups->slots[index] != 0)
+        index = (index + 1) & (groups->capacity - 1);
+      groups->slots[index] = slots[i];
+    }
+    free(slots);
+  }
+
+  int index = hash_string(name, strlen(name)) & (groups->capacity - 1);
+  while (groups->slots[index] != 0) {
+    if (strcmp(groups->groups[groups->slots[index] - 1].name, name) == 0)
+      return groups->slots[index] - 1;
+    index = (index + 1) & (groups->capacity - 1);
+  }
+
+  groups->groups[groups->count] = (group_t){name, 0, 0, 0};
+  groups->slots[index] = ++groups->count;
+  return groups->count - 1;
+}
+
+// Totals per group. Objects dominated by another one of their group are
+// already part of its retained size, so they don't add theirs again
+static void sum_groups(heap_t *heap, const int *idom, const uint64_t *retained,
+                       const int *post, groups_t *groups) {
+  int *group = zeroed(heap->count, sizeof(int));
+  for (int node = 1; node < heap->count; node++) {
+    if (post[node] == -1)
+      continue;
+    group[node] = find_group(groups, group_name(heap, node));
+    groups->groups[group[node]].count++;
+    groups->groups[group[node]].self += heap->sizes[node];
+  }
+
+  // Walk the dominator tree, counting the open ancestors of every group
+  int *children = zeroed(heap->count, sizeof(int));
+  int *start = zeroed(heap->count + 1, sizeof(int));
+  for (int node = 1; node < heap->count; node++)
+    if (post[node] != -1)
+      start[idom[node] + 1]++;
+  for (int i = 0; i < heap->count; i++)
+    start[i + 1] += start[i];
+  int *next = zeroed(heap->count, sizeof(int));
+  memcpy(next, start, sizeof(int) * heap->count);
+  for (int node = 1; node < heap->count; node++)
+    if (post[node] != -1)
+      children[next[idom[node]]++] = node;
+
+  int *open = zeroed(groups->count, sizeof(int));
+  int *stack = zeroed(heap->count, sizeof(int));
+  int depth = 0;
+  memcpy(next, start, sizeof(int) * heap->count);
+  stack[depth++] = 0;
+  while (depth > 0) {
+    int node = stack[depth - 1];
+    if (next[node] < start[node + 1]) {
+      int child = children[next[node]++];
+      if (open[group[child]]++ == 0)
+        groups->groups[group[child]].retained += retained[child];
+      stack[depth++] = child;
+      continue;
+    }
+    depth--;
+    if (node != 0)
+      open[group[node]]--;
+  }
+
+  free(group);
+  free(children);
+  free(start);
+  free(next);
+  free(open);
+  free(stack);
+}
+
+static const uint64_t *sort_retained;
+
+static int by_retained(const void *a, const void *b) {
+  uint64_t x = sort_retained[*(const int *)a];
+  uint64_t y = sort_retained[*(const int *)b];
+  return (x < y) - (x > y);
+}
+
+static int group_by_retained(const void *a, const void *b) {
+  uint64_t x = ((const group_t *)a)->retained;
+  uint64_t y = ((const group_t *)b)->retained;
+  return (x < y) - (x > y);
+}
+
+static void print_summary(heap_t *heap, const int *idom,
+                          const uint64_t *retained, const int *order,
+                          int reached, groups_t *groups, int top) {
+  printf("Objects:           %d\n", reached - 1);
+  printf("References:        %d\n", heap->edge_count);
+  printf("Heap:              %" PRIu64 " bytes\n", retained[0]);
+  printf("\n");
+
+  qsort(groups->groups, groups->count, sizeof(group_t), group_by_retained);
+  printf("%-24s %10s %14s %14s\n", "Class or type", "Count", "Self bytes",
+         "Retained");
+  for (int i = 0; i < groups->count && i < top; i++)
+    printf("  %-22s %10" PRIu64 " %14" PRIu64 " %14" PRIu64 "\n",
+           groups->groups[i].name, groups->groups[i].count,
+           groups->groups[i].self, groups->groups[i].retained);
+  printf("\n");
+
+  int *nodes = zeroed(reached, sizeof(int));
+  int count = 0;
+  for (int i = 0; i < reached; i++)
+    if (order[i] != 0)
+      nodes[count++] = order[i];
+  sort_retained = retained;
+  qsort(nodes, count, sizeof(int), by_retained);
+
+  printf("%-24s %14s %14s  %s\n", "Object", "Self bytes", "Retained",
+         "Held by");
+  for (int i = 0; i < count && i < top; i++) {
+    int node = nodes[i];
+    int holder = idom[node];
+    char object[64];
+    snprintf(object, sizeof(object), "%s %s", heap->types[node],
+             heap->names[node]);
+    printf("  %-22s %14" PRIu64 " %14" PRIu64 "  ", object, heap->sizes[node],
+           retained[node]);
+    if (holder == 0)
+      printf("(roots)\n");
+    else
+      printf("%s %s\n", heap->types[holder], heap->names[holder]);
+  }
+  free(nodes);
+}
+
+static void free_heap(heap_t *heap) {
+  for (int i = 0; i < heap->count; i++) {
+    free(heap->types[i]);
+    free(heap->names[i]);
+  }
+  free(heap->types);
+  free(heap->names);
+  free(heap->sizes);
+  free(heap->from);
+  free(heap->to);
+  free(heap->successors);
+  free(heap->successor_start);
+  free(heap->predecessors);
+  free(heap->predecessor_start);
+}
+
+// Implementation of the 'heap' subcommand
+cli_result_t cli_heap(int argc, char **argv, cli_context_t *ctx) {
+  (void)ctx;
+  const char *path = NULL;
+  int top = HEAP_TOP_DEFAULT;
+  for (int i = 0; i < argc; i++) {
+    if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+      char *end;
+      long value = strtol(argv[++i], &end, 10);
+      if (*end != '\0' || value < 1) {
+        fprintf(stderr, "Error: --top expects a positive number\n");
+        return CLI_INVALID_ARGS;
+      }
+      top = value > INT32_MAX ? INT32_MAX : (int)value;
+    } else if (path == NULL) {
+      path = argv[i];
+    } else {
+      path = NULL;
+      break;
+    }
+  }
+  if (path == NULL) {
+    fprintf(stderr, "Usage: xylia heap <snapshot> [--top <n>]\n");
+    return CLI_INVALID_ARGS;
+  }
+
+  heap_t heap = {0};
+  if (!read_heap(path, &heap)) {
+    free_heap(&heap);
+    return CLI_ERROR;
+  }
+  index_edges(&heap, heap.from, heap.to, &heap.successors,
+              &heap.successor_start);
+  index_edges(&heap, heap.to, heap.from, &heap.predecessors,
+              &heap.predecessor_start);
+
+  int *order = zeroed(heap.count, sizeof(int));
+  int *post = zeroed(heap.count, sizeof(int));
+  int *idom = zeroed(heap.count, sizeof(int));
+  int reached = postorder(&heap, order, post);
+  dominators(&heap, order, post, reached, idom);
+
+  // Dominators come after everything they dominate in postorder
+  uint64_t *retained = zeroed(heap.count, sizeof(uint64_t));
+  for (int i = 0; i < reached; i++) {
+    int node = order[i];
+    retained[node] += heap.sizes[node];
+    if (node != 0)
+      retained[idom[node]] += retained[node];
+  }
+
+  groups_t groups = {0};
+  sum_groups(&heap, idom, retained, post, &groups);
+  print_summary(&heap, idom, retained, order, reached, &groups, top);
+
+  free(groups.groups);
+  free(groups.slots);
+  free(order);
+  free(post);
+  free(idom);
+  free(retained);
+  free_heap(&heap);
+  return CLI_SUCCESS;
+}
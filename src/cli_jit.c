@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "builtins.h"
+#include "cli.h"
+#include "memory.h"
+#include "vm.h"
+
+// What one tier printed and how it exited
+typedef struct {
+  const char *name;
+  char *out;
+  size_t out_size;
+  char *err;
+  size_t err_size;
+  int status;
+} tier_run_t;
+
+static char *slurp(FILE *file, size_t *size) {
+  fflush(file);
+  long length = ftell(file);
+  rewind(file);
+
+  char *buffer = malloc(length + 1);
+  *size = fread(buffer, 1, length, file);
+  buffer[*size] = '\0';
+  fclose(file);
+  return buffer;
+}
+
+// Runs path in a child process so both tiers start from the same VM state,
+// capturing stdout and stderr
+static bool run_tier(const char *path, bool jit, tier_run_t *run) {
+  FILE *out = tmpfile();
+  FILE *err = tmpfile();
+  if (out == NULL || err == NULL) {
+    perror("tmpfile");
+    return false;
+  }
+
+  fflush(NULL);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return false;
+  }
+
+  if (pid == 0) {
+    dup2(fileno(out), STDOUT_FILENO);
+    dup2(fileno(err), STDERR_FILENO);
+
+    // Suite files need the test builtins, also when run without 'test'
+    load_test_functions();
+
+#ifdef JIT
+    // Compile everything on first entry so the test covers as much machine
+    // code as possible
+    vm.jit_enabled = jit;
+    vm.jit_threshold = 0;
+#else
+    (void)jit;
+#endif
+
+    int exit_code = 1;
+    char *source = read_file(path);
+    if (source != NULL) {
+      result_t result = interpret(source, path);
+      exit_code = result == RESULT_OK ? vm.exit_code : 1;
+      if (vm.signal == SIG_STACK_OVERFLOW) {
+        fprintf(stderr, "Error: Stack overflow detected\n");
+        exit_code = 2;
+      } else if (vm.signal == SIG_STACK_UNDERFLOW) {
+        fprintf(stderr, "Error: Stack underflow detected\n");
+        exit_code = 2;
+      }
+    }
+
+    fflush(NULL);
+    // _exit skips free_vm, which would remove it
+    remove_temp_dir();
+    _exit(exit_code);
+  }
+
+  int status;
+  waitpid(pid, &status, 0);
+  run->status = status;
+  run->out = slurp(out, &run->out_size);
+  run->err = slurp(err, &run->err_size);
+  return true;
+}
+
+static bool same_output(const char *a, size_t a_size, const char *b,
+                        size_t b_size) {
+  return a_size == b_size && memcmp(a, b, a_size) == 0;
+}
+
+static void describe_status(const tier_run_t *run) {
+  if (WIFEXITED(run->status))
+    fprintf(stderr, "  %-11s exited with %d\n", run->name,
+            WEXITSTATUS(run->status));
+  else if (WIFSIGNALED(run->status))
+    fprintf(stderr, "  %-11s killed by signal %d\n", run->name,
+            WTERMSIG(run->status));
+}
+
+bool cli_jit_diff(const char *path, cli_context_t *ctx) {
+  tier_run_t interpreter = {.name = "interpreter"};
+  tier_run_t jit = {.name = "jit"};
+  if (!run_tier(path, false, &interpreter) || !run_tier(path, true, &jit))
+    return false;
+
+  // The interpreter is the reference, pass its output through unchanged
+  fwrite(interpreter.out, 1, interpreter.out_size, stdout);
+  fwrite(interpreter.err, 1, interpreter.err_size, stderr);
+  fflush(stdout);
+
+  bool same_out = same_output(interpreter.out, interpreter.out_size, jit.out,
+                              jit.out_size);
+  bool same_err = same_output(interpreter.err, interpreter.err_size, jit.err,
+                              jit.err_size);
+  bool same_status = interpreter.status == jit.status;
+
+  if (same_out && same_err && same_status) {
+    if (ctx->verbose)
+      fprintf(stderr, "jit-diff: %s: tiers agree\n", path);
+  } else {
+    fprintf(stderr, "jit-diff: %s: tiers disagree\n", path);
+    if (!same_out)
+      fprintf(stderr, "  stdout differs, jit printed:\n%.*s\n",
+              (int)jit.out_size, jit.out);
+    if (!same_err)
+      fprintf(stderr, "  stderr differs, jit printed:\n%.*s\n",
+              (int)jit.err_size, jit.err);
+    if (!same_status) {
+      describe_status(&interpreter);
+      describe_status(&jit);
+    }
+  }
+
+  bool ok = same_out && same_err && same_status &&
+            WIFEXITED(interpreter.status) && WEXITSTATUS(interpreter.status) == 0;
+  free(interpreter.out);
+  free(interpreter.err);
+  free(jit.out);
+  free(jit.err);
+  return ok;
+}
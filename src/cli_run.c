@@ -11,6 +11,12 @@ static void run_file(const char *path, cli_context_t *ctx) {
     printf("Running file: %s\n", path);
   }
 
+  if (ctx->jit_diff) {
+    if (!cli_jit_diff(path, ctx))
+      ctx->failed = true;
+    return;
+  }
+
   char *source = read_file(path);
   if (!source) {
     ctx->failed = true;
@@ -25,6 +25,44 @@ void cli_show_help(const char *program_name) {
   printf("    -h, --help       Show this help message\n");
   printf("    -V, --version    Show version information\n");
   printf("    -v, --verbose    Enable verbose output\n");
+  printf("    --jit            Compile hot functions to machine code\n");
+  printf("    --jit-diff       Run in the interpreter and the JIT, compare "
+         "results\n");
+  printf("    --gc-pause-ms <ms>\n");
+  printf("                     Collect the heap incrementally in steps of at "
+         "most ms\n");
+  printf("    --gc-threads <n> Mark the heap on n threads in full "
+         "collections\n");
+  printf("    --gc-compact <percent>\n");
+  printf("                     Compact the heap once more than percent of it "
+         "is free\n");
+  printf("    --gc-initial-heap <size>\n");
+  printf("                     Heap size that starts the first full "
+         "collection\n");
+  printf("    --gc-grow-factor <factor>\n");
+  printf("                     Let the heap grow to factor times the live "
+         "data\n");
+  printf("    --gc-max-heap <size>\n");
+  printf("                     Fail with a runtime error past size bytes of "
+         "heap\n");
+  printf("    --gc-adaptive    Tune the growth factor to the cost of "
+         "collections\n");
+  printf("    --stats          Print collector and interpreter statistics on "
+         "exit\n");
+  printf("    --alloc-profile <file>\n");
+  printf("                     Sample allocations and write them to file as "
+         "collapsed stacks\n");
+  printf("    --alloc-sample-bytes <size>\n");
+  printf("                     Mean bytes allocated between two samples "
+         "(default 512K)\n");
+  printf("    --profile[=hz]   Sample the frame stack hz times a second of CPU "
+         "time (default 99)\n");
+  printf("    --profile-output <file>\n");
+  printf("                     Write the profile to file as folded stacks "
+         "(default xylia.folded)\n");
+  printf("    --heap-snapshot-on-exit <file>\n");
+  printf("                     Write the objects left when the script returns "
+         "to file\n");
   printf("    --zsh            Print script to set up zsh shell integration\n");
   printf(
       "    --bash           Print script to set up bash shell integration\n");
@@ -35,6 +73,9 @@ void cli_show_help(const char *program_name) {
   printf("    test <file>      Runs the tests from a Xylia script file\n");
   printf("    repl             Start interactive REPL session\n");
   printf("    docs <input>     Generate documentation from source files\n");
+  printf("    heap <snapshot> [--top <n>]\n");
+  printf("                     Summarize what retains the memory in a heap "
+         "snapshot\n");
   printf("    help             Show this help message\n");
   printf("    version          Show version information\n");
   printf("\n");
@@ -59,6 +100,10 @@ void cli_show_help(const char *program_name) {
 
   printf("ENVIRONMENT:\n");
   printf("    XYL_HOME         Path to Xylia standard library (required)\n");
+  printf("    XYL_GC_INITIAL_HEAP, XYL_GC_GROW_FACTOR, XYL_GC_MAX_HEAP, "
+         "XYL_GC_ADAPTIVE\n");
+  printf("                     Defaults for the --gc-* flags of the same "
+         "name\n");
   printf("\n");
 
   printf("For more information, visit: https://github.com/vh8t/xylia\n");
@@ -84,7 +129,8 @@ bool cli_looks_like_file(const char *str) {
   // Check if it's not a known subcommand
   if (strcmp(str, "run") == 0 || strcmp(str, "repl") == 0 ||
       strcmp(str, "docs") == 0 || strcmp(str, "help") == 0 ||
-      strcmp(str, "version") == 0 || strcmp(str, "test") == 0) {
+      strcmp(str, "version") == 0 || strcmp(str, "test") == 0 ||
+      strcmp(str, "heap") == 0) {
     return false;
   }
 
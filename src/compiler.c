@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "builtins.h"
 #include "chunk.h"
 #include "compiler.h"
 #include "memory.h"
@@ -75,7 +76,7 @@ typedef struct compiler {
   obj_string_t *path;
   obj_function_t *function;
   function_type_t type;
-  table_t *globals;
+  globals_t *globals;
 
   local_t *locals;
   int local_capacity;
@@ -106,7 +107,7 @@ chunk_t *compiling_chunk = NULL;
 loop_t *current_loop = NULL;
 
 static void init_compiler(compiler_t *compiler, obj_string_t *path,
-                          function_type_t type, table_t *globals) {
+                          function_type_t type, globals_t *globals) {
   compiler->enclosing = current;
   compiler->path = path;
   compiler->function = NULL;
@@ -284,6 +285,18 @@ static void emit_var_op(op_code_t op, unsigned int arg) {
     emit_bytes(op, arg);
 }
 
+// Property accesses and invokes are followed by the index of their inline
+// cache in the current chunk
+static void emit_cache_slot(void) {
+  int slot = add_inline_cache(current_chunk());
+  if (slot > UINT16_MAX) {
+    error("Too many property accesses in one function");
+    return;
+  }
+
+  emit_bytes(slot & 0xff, (slot >> 8) & 0xff);
+}
+
 static bool idents_equal(token_t *a, token_t *b) {
   if (a->length != b->length)
     return false;
@@ -480,6 +493,27 @@ static unsigned int ident_constant(token_t *name) {
                       OBJ_VAL(copy_string(name->start, name->length, true)));
 }
 
+// Resolves a global name to its slot in the module being compiled
+static unsigned int global_slot(token_t *name) {
+  obj_string_t *string = copy_string(name->start, name->length, true);
+  push(OBJ_VAL(string));
+  unsigned int slot = globals_slot(current->globals, string);
+  pop();
+  return slot;
+}
+
+// Returns the registry ID of the builtin a call to name can be compiled to
+// directly, or -1. Whether a global shadows it is only known at runtime
+static int direct_builtin(token_t *name) {
+  obj_string_t *string = copy_string(name->start, name->length, true);
+  value_t builtin;
+  if (!table_get(&vm.builtins, string, &builtin))
+    return -1;
+
+  int id = ((obj_builtin_t *)AS_OBJ(builtin))->id;
+  return builtin_registry[id].direct ? id : -1;
+}
+
 static uint8_t argument_list(void) {
   uint8_t count = 0;
   if (!check(TOK_RPAREN)) {
@@ -739,9 +773,19 @@ static void named_variable(token_t name, bool can_assign) {
     get_op = OP_GET_UPVALUE;
     set_op = OP_SET_UPVALUE;
   } else {
-    arg = ident_constant(&name);
+    arg = global_slot(&name);
     get_op = OP_GET_GLOBAL;
     set_op = OP_SET_GLOBAL;
+
+    int id = direct_builtin(&name);
+    if (id != -1 && match(TOK_LPAREN)) {
+      uint8_t argc = argument_list();
+      emit_byte(OP_CALL_BUILTIN);
+      emit_bytes(arg & 0xff, (arg >> 8) & 0xff);
+      emit_bytes((arg >> 16) & 0xff, id & 0xff);
+      emit_bytes((id >> 8) & 0xff, argc);
+      return;
+    }
   }
 
   if (can_assign && match(TOK_ASSIGN)) {
@@ -917,12 +961,16 @@ static void dot(bool can_assign) {
   if (can_assign && match(TOK_ASSIGN)) {
     expression();
     emit_var_op(OP_SET_PROPERTY, name);
+    emit_cache_slot();
   } else if (match(TOK_LPAREN)) {
     uint8_t count = argument_list();
     emit_var_op(OP_INVOKE, name);
     emit_byte(count);
-  } else
+    emit_cache_slot();
+  } else {
     emit_var_op(OP_GET_PROPERTY, name);
+    emit_cache_slot();
+  }
 }
 
 static void access(bool can_assign) {
@@ -1096,7 +1144,7 @@ static unsigned int parse_variable(const char *err) {
   if (current->scope_depth > 0)
     return 0;
 
-  return ident_constant(&parser.previous);
+  return global_slot(&parser.previous);
 }
 
 static unsigned int parse_variable_with_hint(const char *err,
@@ -1107,7 +1155,7 @@ static unsigned int parse_variable_with_hint(const char *err,
   if (current->scope_depth > 0)
     return 0;
 
-  return ident_constant(&parser.previous);
+  return global_slot(&parser.previous);
 }
 
 static void mark_initialized(void) {
@@ -1146,15 +1194,15 @@ static void function(function_type_t type, obj_string_t *name) {
 
       parser.previous = param_name;
 
-      unsigned int constant;
+      unsigned int global;
       if (current->scope_depth > 0) {
         declare_variable_with_hint(param_hint);
-        constant = 0;
+        global = 0;
       } else {
-        constant = ident_constant(&param_name);
+        global = global_slot(&param_name);
       }
 
-      define_variable(constant);
+      define_variable(global);
 
       if (match(TOK_LBRACKET)) {
         consume(TOK_RBRACKET, "Expected ']' after '[' in argument list");
@@ -1216,7 +1264,7 @@ static void enum_declaration(void) {
   declare_variable();
 
   emit_var_op(OP_ENUM, name_constant);
-  define_variable(name_constant);
+  define_variable(current->scope_depth > 0 ? 0 : global_slot(&enum_name));
 
   named_variable(enum_name, false);
   consume(TOK_LBRACE, "Expected '{' before enum body");
@@ -1245,7 +1293,7 @@ static void class_declaration(void) {
   declare_variable();
 
   emit_var_op(OP_CLASS, name_constant);
-  define_variable(name_constant);
+  define_variable(current->scope_depth > 0 ? 0 : global_slot(&class_name));
 
   class_compiler_t class_compiler;
   class_compiler.enclosing = current_class;
@@ -1301,7 +1349,7 @@ static void var_declaration(void) {
     declare_variable_with_hint(var_hint);
     global = 0;
   } else {
-    global = ident_constant(&var_name);
+    global = global_slot(&var_name);
   }
 
   if (match(TOK_ASSIGN))
@@ -1560,6 +1608,7 @@ obj_module_t *compile(const char *source, obj_string_t *path,
   pop();
   pop();
   module->init = closure;
+  WRITE_BARRIER(module);
   return parser.had_error ? NULL : module;
 }
 
@@ -1567,6 +1616,8 @@ void mark_compiler_roots(void) {
   compiler_t *compiler = current;
   while (compiler != NULL) {
     mark_object((obj_t *)compiler->function);
+    // Constants keep being added after the function has been promoted
+    WRITE_BARRIER(compiler->function);
     compiler = compiler->enclosing;
   }
 }
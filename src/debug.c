@@ -1,6 +1,7 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "builtins.h"
 #include "chunk.h"
 #include "debug.h"
 #include "object.h"
@@ -104,6 +105,17 @@ static int invoke_op_long(const char *name, chunk_t *chunk, int offset) {
   return offset + 5;
 }
 
+// Skips the inline cache slot following property and invoke instructions
+static int cached_op(int next_offset) { return next_offset + 2; }
+
+static int call_builtin_op(const char *name, chunk_t *chunk, int offset) {
+  uint16_t id = chunk->code[offset + 4] | (chunk->code[offset + 5] << 8);
+  uint8_t argc = chunk->code[offset + 6];
+  printf("%-20s %8d '%s' (%d args)\n", name, id, builtin_registry[id].name,
+         argc);
+  return offset + 7;
+}
+
 static int jump_op(const char *name, int sign, chunk_t *chunk, int offset) {
   uint16_t jump = chunk->code[offset + 1] | (chunk->code[offset + 2] << 8);
   printf("%-20s %8d -> %d\n", name, offset, offset + 3 + sign * jump);
@@ -120,17 +132,17 @@ int disassemble_instruction(chunk_t *chunk, int offset) {
   case OP_CONSTANT_LONG:
     return constant_op_long("OP_CONSTANT_LONG", chunk, offset);
   case OP_DEFINE_GLOBAL:
-    return constant_op("OP_DEFINE_GLOBAL", chunk, offset);
+    return byte_op("OP_DEFINE_GLOBAL", chunk, offset);
   case OP_DEFINE_GLOBAL_LONG:
-    return constant_op_long("OP_DEFINE_GLOBAL_LONG", chunk, offset);
+    return long_op("OP_DEFINE_GLOBAL_LONG", chunk, offset);
   case OP_GET_GLOBAL:
-    return constant_op("OP_GET_GLOBAL", chunk, offset);
+    return byte_op("OP_GET_GLOBAL", chunk, offset);
   case OP_GET_GLOBAL_LONG:
-    return constant_op_long("OP_GET_GLOBAL_LONG", chunk, offset);
+    return long_op("OP_GET_GLOBAL_LONG", chunk, offset);
   case OP_SET_GLOBAL:
-    return constant_op("OP_SET_GLOBAL", chunk, offset);
+    return byte_op("OP_SET_GLOBAL", chunk, offset);
   case OP_SET_GLOBAL_LONG:
-    return constant_op_long("OP_SET_GLOBAL_LONG", chunk, offset);
+    return long_op("OP_SET_GLOBAL_LONG", chunk, offset);
   case OP_GET_LOCAL:
     return byte_op("OP_GET_LOCAL", chunk, offset);
   case OP_GET_LOCAL_LONG:
@@ -152,25 +164,25 @@ int disassemble_instruction(chunk_t *chunk, int offset) {
   case OP_GET_SUPER_LONG:
     return constant_op_long("OP_GET_SUPER_LONG", chunk, offset);
   case OP_GET_PROPERTY:
-    return constant_op("OP_GET_PROPERTY", chunk, offset);
+    return cached_op(constant_op("OP_GET_PROPERTY", chunk, offset));
   case OP_GET_PROPERTY_LONG:
-    return constant_op_long("OP_GET_PORPERTY_LONG", chunk, offset);
+    return cached_op(constant_op_long("OP_GET_PORPERTY_LONG", chunk, offset));
   case OP_GET_ACCESS:
     return constant_op("OP_GET_ACCESS", chunk, offset);
   case OP_GET_ACCESS_LONG:
     return constant_op_long("OP_GET_ACCESS_LONG", chunk, offset);
   case OP_SET_PROPERTY:
-    return constant_op("OP_SET_PROPERTY", chunk, offset);
+    return cached_op(constant_op("OP_SET_PROPERTY", chunk, offset));
   case OP_SET_PROPERTY_LONG:
-    return constant_op_long("OP_SET_PROPERTY_LONG", chunk, offset);
+    return cached_op(constant_op_long("OP_SET_PROPERTY_LONG", chunk, offset));
   case OP_GET_INDEX:
     return simple_op("OP_GET_INDEX", offset);
   case OP_SET_INDEX:
     return simple_op("OP_SET_INDEX", offset);
   case OP_INVOKE:
-    return invoke_op("OP_INVOKE", chunk, offset);
+    return cached_op(invoke_op("OP_INVOKE", chunk, offset));
   case OP_INVOKE_LONG:
-    return invoke_op_long("OP_INVOKE_LONG", chunk, offset);
+    return cached_op(invoke_op_long("OP_INVOKE_LONG", chunk, offset));
   case OP_INVOKE_ACCESS:
     return invoke_op("OP_INVOKE_ACCESS", chunk, offset);
   case OP_INVOKE_ACCESS_LONG:
@@ -281,6 +293,8 @@ int disassemble_instruction(chunk_t *chunk, int offset) {
     return assert_op("OP_ASSERT_MSG", chunk, offset);
   case OP_CALL:
     return byte_op("OP_CALL", chunk, offset);
+  case OP_CALL_BUILTIN:
+    return call_builtin_op("OP_CALL_BUILTIN", chunk, offset);
   case OP_LOOP:
     return jump_op("OP_LOOP", -1, chunk, offset);
   case OP_JUMP:
@@ -289,6 +303,44 @@ int disassemble_instruction(chunk_t *chunk, int offset) {
     return jump_op("JUMP_IF_FALSE", 1, chunk, offset);
   case OP_RETURN:
     return simple_op("OP_RETURN", offset);
+  case OP_ADD_NUM_NUM:
+    return simple_op("OP_ADD_NUM_NUM", offset);
+  case OP_ADD_FLT_FLT:
+    return simple_op("OP_ADD_FLT_FLT", offset);
+  case OP_SUB_NUM_NUM:
+    return simple_op("OP_SUB_NUM_NUM", offset);
+  case OP_SUB_FLT_FLT:
+    return simple_op("OP_SUB_FLT_FLT", offset);
+  case OP_MUL_NUM_NUM:
+    return simple_op("OP_MUL_NUM_NUM", offset);
+  case OP_MUL_FLT_FLT:
+    return simple_op("OP_MUL_FLT_FLT", offset);
+  case OP_GT_NUM_NUM:
+    return simple_op("OP_GT_NUM_NUM", offset);
+  case OP_GT_FLT_FLT:
+    return simple_op("OP_GT_FLT_FLT", offset);
+  case OP_GE_NUM_NUM:
+    return simple_op("OP_GE_NUM_NUM", offset);
+  case OP_GE_FLT_FLT:
+    return simple_op("OP_GE_FLT_FLT", offset);
+  case OP_LT_NUM_NUM:
+    return simple_op("OP_LT_NUM_NUM", offset);
+  case OP_LT_FLT_FLT:
+    return simple_op("OP_LT_FLT_FLT", offset);
+  case OP_LE_NUM_NUM:
+    return simple_op("OP_LE_NUM_NUM", offset);
+  case OP_LE_FLT_FLT:
+    return simple_op("OP_LE_FLT_FLT", offset);
+  case OP_GET_INDEX_VEC_NUM:
+    return simple_op("OP_GET_INDEX_VEC_NUM", offset);
+  case OP_GET_INDEX_LIST_NUM:
+    return simple_op("OP_GET_INDEX_LIST_NUM", offset);
+  case OP_GET_INDEX_ARRAY_NUM:
+    return simple_op("OP_GET_INDEX_ARRAY_NUM", offset);
+  case OP_SET_INDEX_VEC_NUM:
+    return simple_op("OP_SET_INDEX_VEC_NUM", offset);
+  case OP_SET_INDEX_ARRAY_NUM:
+    return simple_op("OP_SET_INDEX_ARRAY_NUM", offset);
   case OP_LIST:
     return byte_op("OP_LIST", chunk, offset);
   case OP_LIST_LONG:
@@ -0,0 +1,434 @@
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builtins.h"
+#include "heap_snapshot.h"
+#include "memory.h"
+#include "object.h"
+#include "slab.h"
+#include "table.h"
+#include "value.h"
+#include "vm.h"
+
+// Objects found so far and the ids they got, and the ones whose references
+// haven't been written yet. Kept in C memory, so writing a snapshot never
+// collects
+typedef struct {
+  FILE *file;
+  obj_t **objects;
+  int *ids;
+  int capacity;
+  int count;
+
+  obj_t **pending;
+  int pending_count;
+  int pending_capacity;
+} snapshot_t;
+
+static void *grow(void *pointer, size_t size) {
+  void *result = realloc(pointer, size);
+  if (result == NULL) {
+    perror("realloc");
+    exit(1);
+  }
+  return result;
+}
+
+static int *find_id(snapshot_t *snapshot, obj_t *object) {
+  size_t index = ((uintptr_t)object >> 4) & (snapshot->capacity - 1);
+  while (snapshot->objects[index] != NULL && snapshot->objects[index] != object)
+    index = (index + 1) & (snapshot->capacity - 1);
+  snapshot->objects[index] = object;
+  return &snapshot->ids[index];
+}
+
+static void grow_ids(snapshot_t *snapshot) {
+  obj_t **objects = snapshot->objects;
+  int *ids = snapshot->ids;
+  int capacity = snapshot->capacity;
+
+  snapshot->capacity = GROW_CAPACITY(capacity);
+  snapshot->objects = calloc(snapshot->capacity, sizeof(obj_t *));
+  snapshot->ids = calloc(snapshot->capacity, sizeof(int));
+  if (snapshot->objects == NULL || snapshot->ids == NULL) {
+    perror("calloc");
+    exit(1);
+  }
+  for (int i = 0; i < capacity; i++)
+    if (objects[i] != NULL)
+      *find_id(snapshot, objects[i]) = ids[i];
+  free(objects);
+  free(ids);
+}
+
+// Id of object, queueing it to be written out the first time it comes up
+static int node_id(snapshot_t *snapshot, obj_t *object) {
+  if ((snapshot->count + 1) * 4 > snapshot->capacity * 3)
+    grow_ids(snapshot);
+
+  int *id = find_id(snapshot, object);
+  if (*id != 0)
+    return *id;
+  *id = ++snapshot->count;
+
+  if (snapshot->pending_capacity <= snapshot->pending_count) {
+    snapshot->pending_capacity = GROW_CAPACITY(snapshot->pending_capacity);
+    snapshot->pending = grow(snapshot->pending, sizeof(obj_t *) *
+                                                    snapshot->pending_capacity);
+  }
+  snapshot->pending[snapshot->pending_count++] = object;
+  return *id;
+}
+
+static void write_escaped(FILE *file, const char *chars, int length) {
+  int shown = length < HEAP_SNAPSHOT_PREVIEW ? length : HEAP_SNAPSHOT_PREVIEW;
+  for (int i = 0; i < shown; i++) {
+    unsigned char c = chars[i];
+    switch (c) {
+    case '\\':
+      fputs("\\\\", file);
+      break;
+    case '\t':
+      fputs("\\t", file);
+      break;
+    case '\n':
+      fputs("\\n", file);
+      break;
+    case '\r':
+      fputs("\\r", file);
+      break;
+    default:
+      if (c < 0x20 || c == 0x7f)
+        fprintf(file, "\\x%02x", c);
+      else
+        fputc(c, file);
+    }
+  }
+  if (shown < length)
+    fputs("...", file);
+}
+
+static void write_string(FILE *file, obj_string_t *string) {
+  if (string != NULL && !IS_ROPE(string))
+    write_escaped(file, string->chars, string->length);
+}
+
+static void edge(snapshot_t *snapshot, int from, obj_t *to, const char *kind,
+                 const char *name, int length) {
+  if (to == NULL)
+    return;
+  fprintf(snapshot->file, "e\t%d\t%d\t%s\t", from, node_id(snapshot, to),
+          kind);
+  write_escaped(snapshot->file, name, length);
+  fputc('\n', snapshot->file);
+}
+
+static void named_edge(snapshot_t *snapshot, int from, obj_t *to,
+                       const char *kind, const char *name) {
+  edge(snapshot, from, to, kind, name, (int)strlen(name));
+}
+
+static void key_edge(snapshot_t *snapshot, int from, value_t value,
+                     const char *kind, obj_string_t *key) {
+  if (!IS_HEAP(value))
+    return;
+  if (key == NULL)
+    edge(snapshot, from, AS_HEAP(value), kind, "", 0);
+  else
+    edge(snapshot, from, AS_HEAP(value), kind, key->chars, key->length);
+}
+
+static void index_edge(snapshot_t *snapshot, int from, value_t value,
+                       const char *kind, int index) {
+  if (!IS_HEAP(value))
+    return;
+  char name[16];
+  snprintf(name, sizeof(name), "%d", index);
+  named_edge(snapshot, from, AS_HEAP(value), kind, name);
+}
+
+// Keys are interned strings, which the string table holds on to anyway, so
+// they only show up as the names of the edges
+static void table_edges(snapshot_t *snapshot, int from, table_t *table,
+                        const char *kind) {
+  for (int i = 0; i < table->capacity; i++) {
+    entry_t *entry = &table->entries[i];
+    if (entry->key != NULL)
+      key_edge(snapshot, from, entry->value, kind, entry->key);
+  }
+}
+
+static void globals_edges(snapshot_t *snapshot, int from, globals_t *globals) {
+  for (int i = 0; i < globals->count; i++)
+    key_edge(snapshot, from, globals->values[i].value, "global",
+             globals->values[i].name);
+}
+
+static void shape_edges(snapshot_t *snapshot, int from, shape_t *shape) {
+  named_edge(snapshot, from, (obj_t *)shape->name, "internal", "shape");
+  for (int i = 0; i < shape->transition_count; i++)
+    shape_edges(snapshot, from, shape->transitions[i]);
+}
+
+// Name of the field an instance keeps in slot
+static obj_string_t *slot_name(shape_t *shape, int slot) {
+  while (shape->slot_count > slot + 1)
+    shape = shape->parent;
+  return shape->name;
+}
+
+static size_t table_bytes(table_t *table) {
+  return sizeof(entry_t) * table->capacity;
+}
+
+// Bytes of the slot of object and of the memory it owns outside of it
+static size_t self_bytes(obj_t *object) {
+  size_t bytes = SLAB_OF(object)->slot_size;
+  switch (object->type) {
+  case OBJ_STRING: {
+    obj_string_t *string = (obj_string_t *)object;
+    if (IS_ROPE(string) || STRING_IS_INLINE(string->length))
+      return bytes;
+    return bytes + string->length + 1;
+  }
+  case OBJ_VECTOR: {
+    obj_vector_t *vector = (obj_vector_t *)object;
+    return bytes + sizeof(value_t) * vector->capacity + vector->cards.count;
+  }
+  case OBJ_LIST: {
+    int count = ((obj_list_t *)object)->count;
+    return LIST_IS_INLINE(count) ? bytes : bytes + sizeof(value_t) * count;
+  }
+  case OBJ_ARRAY: {
+    obj_array_t *array = (obj_array_t *)object;
+    return bytes + sizeof(value_t) * array->count + array->cards.count;
+  }
+  case OBJ_CLASS:
+    return bytes + table_bytes(&((obj_class_t *)object)->methods);
+  case OBJ_INSTANCE: {
+    obj_instance_t *instance = (obj_instance_t *)object;
+    bytes += sizeof(value_t) * instance->slot_capacity;
+    if (instance->fields != NULL)
+      bytes += sizeof(table_t) + table_bytes(instance->fields);
+    return bytes;
+  }
+  case OBJ_CLOSURE: {
+    int count = ((obj_closure_t *)object)->upvalue_count;
+    if (CLOSURE_IS_INLINE(count))
+      return bytes;
+    return bytes + sizeof(obj_upvalue_t *) * count;
+  }
+  case OBJ_FUNCTION: {
+    chunk_t *chunk = &((obj_function_t *)object)->chunk;
+    return bytes + (sizeof(uint8_t) * 2) * chunk->capacity +
+           sizeof(value_t) * chunk->constants.capacity +
+           sizeof(inline_cache_t) * chunk->cache_capacity +
+           sizeof(srcpos_t) * chunk->pos_capacity;
+  }
+  case OBJ_MODULE: {
+    globals_t *globals = &((obj_module_t *)object)->globals;
+    return bytes + sizeof(global_t) * globals->capacity +
+           table_bytes(&globals->slots);
+  }
+  case OBJ_ENUM:
+    return bytes + table_bytes(&((obj_enum_t *)object)->values);
+  default:
+    return bytes;
+  }
+}
+
+static void write_name(FILE *file, obj_t *object) {
+  switch (object->type) {
+  case OBJ_STRING:
+    write_string(file, (obj_string_t *)object);
+    break;
+  case OBJ_CLASS:
+    write_string(file, ((obj_class_t *)object)->name);
+    break;
+  case OBJ_INSTANCE:
+    write_string(file, ((obj_instance_t *)object)->clas->name);
+    break;
+  case OBJ_BOUND_METHOD:
+    object = (obj_t *)((obj_bound_method_t *)object)->method;
+    // fallthrough
+  case OBJ_CLOSURE:
+    object = (obj_t *)((obj_closure_t *)object)->function;
+    // fallthrough
+  case OBJ_FUNCTION: {
+    obj_function_t *function = (obj_function_t *)object;
+    if (function->name == NULL)
+      fputs("script", file);
+    else
+      write_string(file, function->name);
+  } break;
+  case OBJ_MODULE:
+    write_string(file, ((obj_module_t *)object)->name);
+    break;
+  case OBJ_ENUM:
+    write_string(file, ((obj_enum_t *)object)->name);
+    break;
+  case OBJ_BUILTIN:
+    fputs(builtin_registry[((obj_builtin_t *)object)->id].name, file);
+    break;
+  case OBJ_NUMBER:
+    fprintf(file, "%" PRId64, ((obj_number_t *)object)->value);
+    break;
+  default:
+    break;
+  }
+}
+
+// Writes the node of object and its references, the same ones
+// blacken_object traces
+static void write_object(snapshot_t *snapshot, obj_t *object) {
+  int id = node_id(snapshot, object);
+  fprintf(snapshot->file, "n\t%d\t%s\t%zu\t", id, gc_type_name(object->type),
+          self_bytes(object));
+  write_name(snapshot->file, object);
+  fputc('\n', snapshot->file);
+
+  switch (object->type) {
+  case OBJ_STRING:
+    if (IS_ROPE((obj_string_t *)object)) {
+      obj_rope_t *rope = (obj_rope_t *)object;
+      named_edge(snapshot, id, (obj_t *)rope->left, "internal", "left");
+      named_edge(snapshot, id, (obj_t *)rope->right, "internal", "right");
+    }
+    break;
+  case OBJ_BUILTIN:
+  case OBJ_FILE:
+  case OBJ_NUMBER:
+  case OBJ_ANY:
+    break;
+  case OBJ_VECTOR: {
+    obj_vector_t *vector = (obj_vector_t *)object;
+    for (int i = 0; i < vector->count; i++)
+      index_edge(snapshot, id, vector->values[i], "index", i);
+  } break;
+  case OBJ_LIST: {
+    obj_list_t *list = (obj_list_t *)object;
+    if (list->values != NULL)
+      for (int i = 0; i < list->count; i++)
+        index_edge(snapshot, id, list->values[i], "index", i);
+  } break;
+  case OBJ_ARRAY: {
+    obj_array_t *array = (obj_array_t *)object;
+    if (array->values != NULL)
+      for (int i = 0; i < array->count; i++)
+        index_edge(snapshot, id, array->values[i], "index", i);
+  } break;
+  case OBJ_CLASS: {
+    obj_class_t *clas = (obj_class_t *)object;
+    named_edge(snapshot, id, (obj_t *)clas->name, "internal", "name");
+    table_edges(snapshot, id, &clas->methods, "key");
+    shape_edges(snapshot, id, clas->shape);
+  } break;
+  case OBJ_BOUND_METHOD: {
+    obj_bound_method_t *bound = (obj_bound_method_t *)object;
+    if (IS_HEAP(bound->receiver))
+      named_edge(snapshot, id, AS_HEAP(bound->receiver), "internal",
+                 "receiver");
+    named_edge(snapshot, id, (obj_t *)bound->method, "internal", "method");
+  } break;
+  case OBJ_INSTANCE: {
+    obj_instance_t *instance = (obj_instance_t *)object;
+    named_edge(snapshot, id, (obj_t *)instance->clas, "internal", "class");
+    if (instance->shape != NULL)
+      for (int i = 0; i < instance->shape->slot_count; i++)
+        key_edge(snapshot, id, instance->slots[i], "field",
+                 slot_name(instance->shape, i));
+    if (instance->fields != NULL)
+      table_edges(snapshot, id, instance->fields, "field");
+  } break;
+  case OBJ_CLOSURE: {
+    obj_closure_t *closure = (obj_closure_t *)object;
+    named_edge(snapshot, id, (obj_t *)closure->function, "internal",
+               "function");
+    for (int i = 0; i < closure->upvalue_count; i++)
+      if (closure->upvalues[i] != NULL)
+        index_edge(snapshot, id, OBJ_VAL(closure->upvalues[i]), "upvalue", i);
+  } break;
+  case OBJ_FUNCTION: {
+    obj_function_t *function = (obj_function_t *)object;
+    named_edge(snapshot, id, (obj_t *)function->name, "internal", "name");
+    for (int i = 0; i < function->chunk.constants.count; i++)
+      index_edge(snapshot, id, function->chunk.constants.values[i], "internal",
+                 i);
+    if (function->globals != NULL)
+      globals_edges(snapshot, id, function->globals);
+  } break;
+  case OBJ_UPVALUE:
+    key_edge(snapshot, id, ((obj_upvalue_t *)object)->closed, "internal",
+             NULL);
+    break;
+  case OBJ_MODULE: {
+    obj_module_t *module = (obj_module_t *)object;
+    named_edge(snapshot, id, (obj_t *)module->name, "internal", "name");
+    named_edge(snapshot, id, (obj_t *)module->init, "internal", "init");
+    globals_edges(snapshot, id, &module->globals);
+  } break;
+  case OBJ_RANGE: {
+    obj_range_t *range = (obj_range_t *)object;
+    index_edge(snapshot, id, range->from, "internal", 0);
+    index_edge(snapshot, id, range->to, "internal", 1);
+  } break;
+  case OBJ_RESULT:
+    key_edge(snapshot, id, ((obj_result_t *)object)->value, "internal", NULL);
+    break;
+  case OBJ_ENUM:
+    table_edges(snapshot, id, &((obj_enum_t *)object)->values, "key");
+    break;
+  }
+}
+
+// References from the roots mark_roots() traces. The compiler isn't running
+// while scripts can ask for a snapshot, so its roots are left out
+static void write_roots(snapshot_t *snapshot) {
+  fputs("n\t0\troots\t0\t(roots)\n", snapshot->file);
+
+  for (value_t *slot = vm.stack; slot < vm.stack_top; slot++)
+    index_edge(snapshot, 0, *slot, "root", (int)(slot - vm.stack));
+
+  for (int i = 0; i < vm.frame_count; i++) {
+    named_edge(snapshot, 0, (obj_t *)vm.frames[i].closure, "root", "frame");
+    if (vm.frames[i].globals != NULL)
+      globals_edges(snapshot, 0, vm.frames[i].globals);
+  }
+
+  for (obj_upvalue_t *upvalue = vm.open_upvalues; upvalue != NULL;
+       upvalue = upvalue->next)
+    named_edge(snapshot, 0, (obj_t *)upvalue, "root", "open upvalue");
+
+  for (int i = 0; i < VM_STR_MAX; i++)
+    named_edge(snapshot, 0, (obj_t *)vm.vm_strings[i], "root", "vm string");
+  for (int i = 0; i < 256; i++)
+    named_edge(snapshot, 0, (obj_t *)vm.byte_strings[i], "root", "byte string");
+  named_edge(snapshot, 0, (obj_t *)vm.args, "root", "args");
+
+  table_edges(snapshot, 0, &vm.module_lookup, "key");
+  table_edges(snapshot, 0, &vm.builtins, "key");
+  for (int i = 0; i < vm.strings.capacity; i++)
+    named_edge(snapshot, 0, (obj_t *)vm.strings.entries[i].key, "root",
+               "interned");
+}
+
+bool write_heap_snapshot(const char *path) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL)
+    return false;
+
+  snapshot_t snapshot = {.file = file};
+  grow_ids(&snapshot);
+  fputs(HEAP_SNAPSHOT_HEADER "\n", file);
+  write_roots(&snapshot);
+  for (int next = 0; next < snapshot.pending_count; next++)
+    write_object(&snapshot, snapshot.pending[next]);
+
+  free(snapshot.objects);
+  free(snapshot.ids);
+  free(snapshot.pending);
+  return fclose(file) == 0;
+}
@@ -0,0 +1,1042 @@
+#ifdef JIT
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "chunk.h"
+#include "jit.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+// Baseline template compiler. Every bytecode instruction is translated on its
+// own into a fixed x86-64 sequence working directly on the VM stack, so the
+// interpreter can take over (and hand back) at any instruction boundary.
+// Instructions without a template simply leave compiled code.
+//
+// Registers pinned while compiled code runs, all callee-saved:
+//   rbx  frame->slots
+//   r12  &vm
+//   r13  vm.stack_top, written back around helper calls and on exit
+//   r14  the running frame
+//   r15  byte offset of that frame in vm.frames, which may move during calls
+
+typedef enum {
+  RAX,
+  RCX,
+  RDX,
+  RBX,
+  RSP,
+  RBP,
+  RSI,
+  RDI,
+  R8,
+  R9,
+  R10,
+  R11,
+  R12,
+  R13,
+  R14,
+  R15,
+} reg_t;
+
+typedef enum {
+  CC_O = 0x0,
+  CC_B = 0x2,
+  CC_AE = 0x3,
+  CC_E = 0x4,
+  CC_NE = 0x5,
+  CC_A = 0x7,
+  CC_L = 0xc,
+  CC_GE = 0xd,
+  CC_LE = 0xe,
+  CC_G = 0xf,
+} cond_t;
+
+#define REG_SLOTS RBX
+#define REG_VM R12
+#define REG_TOP R13
+#define REG_FRAME R14
+#define REG_FRAME_OFFSET R15
+
+#define VALUE_SIZE ((int32_t)sizeof(value_t))
+// Displacement of the value `distance` slots below the stack top
+#define PEEK(distance) (-((distance) + 1) * VALUE_SIZE)
+#define VM_FIELD(field) ((int32_t)offsetof(vm_t, field))
+#define FRAME_FIELD(field) ((int32_t)offsetof(call_frame_t, field))
+
+#ifndef NAN_BOXING
+#define TYPE_OFFSET ((int32_t)offsetof(value_t, type))
+#define AS_OFFSET ((int32_t)offsetof(value_t, as))
+#endif
+
+// Forward jumps that all land on the same, not yet emitted, label
+#define LABEL_MAX_JUMPS 8
+
+typedef struct {
+  int jumps[LABEL_MAX_JUMPS];
+  int count;
+} label_t;
+
+typedef struct {
+  // Position of the rel32 to patch and bytecode offset it jumps to
+  int at;
+  int target;
+} fixup_t;
+
+typedef struct {
+  uint8_t *code;
+  int count;
+  int capacity;
+
+  // Native offset of every instruction, -1 inside of one
+  int *offsets;
+  fixup_t *fixups;
+  int fixup_count;
+  int fixup_capacity;
+
+  int exit;
+  chunk_t *chunk;
+} assembler_t;
+
+typedef void (*jit_enter_fn_t)(call_frame_t *frame, void *target);
+
+struct jit_code {
+  uint8_t *memory;
+  // The entry trampoline at the start of memory
+  jit_enter_fn_t enter;
+  size_t size;
+  // Native address of every instruction of the chunk, NULL inside of one
+  void **entries;
+};
+
+static void *grow(void *pointer, int *capacity, size_t size) {
+  *capacity = *capacity < 64 ? 64 : *capacity * 2;
+  void *result = realloc(pointer, *capacity * size);
+  if (result == NULL) {
+    perror("realloc");
+    exit(1);
+  }
+  return result;
+}
+
+static void emit8(assembler_t *as, uint8_t byte) {
+  if (as->count >= as->capacity)
+    as->code = grow(as->code, &as->capacity, 1);
+  as->code[as->count++] = byte;
+}
+
+static void emit32(assembler_t *as, uint32_t value) {
+  for (int i = 0; i < 4; i++)
+    emit8(as, (value >> (i * 8)) & 0xff);
+}
+
+static void emit64(assembler_t *as, uint64_t value) {
+  for (int i = 0; i < 8; i++)
+    emit8(as, (value >> (i * 8)) & 0xff);
+}
+
+static void patch32(assembler_t *as, int at, int32_t value) {
+  memcpy(&as->code[at], &value, sizeof(int32_t));
+}
+
+static void rex(assembler_t *as, bool wide, int reg, int base) {
+  uint8_t prefix = 0x40 | (wide << 3) | (((reg >> 3) & 1) << 2) |
+                   ((base >> 3) & 1);
+  if (prefix != 0x40)
+    emit8(as, prefix);
+}
+
+// ModRM (and SIB) for [base + disp]
+static void mem(assembler_t *as, int reg, reg_t base, int32_t disp) {
+  int mod = 2;
+  if (disp == 0 && (base & 7) != RBP)
+    mod = 0;
+  else if (disp >= -128 && disp <= 127)
+    mod = 1;
+  emit8(as, (mod << 6) | ((reg & 7) << 3) | (base & 7));
+  if ((base & 7) == RSP)
+    emit8(as, 0x24);
+  if (mod == 1)
+    emit8(as, (uint8_t)disp);
+  else if (mod == 2)
+    emit32(as, disp);
+}
+
+static void op_mem(assembler_t *as, bool wide, uint8_t opcode, int reg,
+                   reg_t base, int32_t disp) {
+  rex(as, wide, reg, base);
+  emit8(as, opcode);
+  mem(as, reg, base, disp);
+}
+
+static void op_reg(assembler_t *as, bool wide, uint8_t opcode, int reg,
+                   reg_t rm) {
+  rex(as, wide, reg, rm);
+  emit8(as, opcode);
+  emit8(as, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+#ifndef NAN_BOXING
+// SSE instruction on an xmm register and [base + disp]
+static void sse_mem(assembler_t *as, uint8_t prefix, uint8_t opcode, int xmm,
+                    reg_t base, int32_t disp) {
+  emit8(as, prefix);
+  rex(as, false, xmm, base);
+  emit8(as, 0x0f);
+  emit8(as, opcode);
+  mem(as, xmm, base, disp);
+}
+#endif
+
+static void load(assembler_t *as, reg_t dst, reg_t base, int32_t disp) {
+  op_mem(as, true, 0x8b, dst, base, disp);
+}
+
+static void store(assembler_t *as, reg_t base, int32_t disp, reg_t src) {
+  op_mem(as, true, 0x89, src, base, disp);
+}
+
+static void mov_imm(assembler_t *as, reg_t dst, uint64_t imm) {
+  rex(as, true, 0, dst);
+  emit8(as, 0xb8 + (dst & 7));
+  emit64(as, imm);
+}
+
+static void mov_reg(assembler_t *as, reg_t dst, reg_t src) {
+  op_reg(as, true, 0x89, src, dst);
+}
+
+static void add_imm(assembler_t *as, reg_t reg, int32_t imm) {
+  op_reg(as, true, 0x81, imm >= 0 ? 0 : 5, reg);
+  emit32(as, imm >= 0 ? imm : -imm);
+}
+
+static void store32_imm(assembler_t *as, reg_t base, int32_t disp,
+                        uint32_t imm) {
+  op_mem(as, false, 0xc7, 0, base, disp);
+  emit32(as, imm);
+}
+
+static void cmp32_imm(assembler_t *as, reg_t base, int32_t disp,
+                      uint32_t imm) {
+  op_mem(as, false, 0x81, 7, base, disp);
+  emit32(as, imm);
+}
+
+static void push_reg(assembler_t *as, reg_t reg) {
+  rex(as, false, 0, reg);
+  emit8(as, 0x50 + (reg & 7));
+}
+
+static void pop_reg(assembler_t *as, reg_t reg) {
+  rex(as, false, 0, reg);
+  emit8(as, 0x58 + (reg & 7));
+}
+
+static void call_abs(assembler_t *as, uintptr_t function) {
+  mov_imm(as, RAX, function);
+  emit8(as, 0xff);
+  emit8(as, 0xd0);
+}
+
+static int jump_rel32(assembler_t *as, int cond) {
+  if (cond < 0)
+    emit8(as, 0xe9);
+  else {
+    emit8(as, 0x0f);
+    emit8(as, 0x80 | cond);
+  }
+  emit32(as, 0);
+  return as->count - 4;
+}
+
+static void jump_to(assembler_t *as, int cond, int native_offset) {
+  int at = jump_rel32(as, cond);
+  patch32(as, at, native_offset - (at + 4));
+}
+
+static void jump_label(assembler_t *as, int cond, label_t *label) {
+  label->jumps[label->count++] = jump_rel32(as, cond);
+}
+
+static void bind(assembler_t *as, label_t *label) {
+  for (int i = 0; i < label->count; i++)
+    patch32(as, label->jumps[i], as->count - (label->jumps[i] + 4));
+  label->count = 0;
+}
+
+// Jump to the code of the instruction at bytecode offset target
+static void jump_bytecode(assembler_t *as, int cond, int target) {
+  if (as->fixup_count >= as->fixup_capacity)
+    as->fixups = grow(as->fixups, &as->fixup_capacity, sizeof(fixup_t));
+  as->fixups[as->fixup_count].at = jump_rel32(as, cond);
+  as->fixups[as->fixup_count].target = target;
+  as->fixup_count++;
+}
+
+static void copy_value(assembler_t *as, reg_t dst, int32_t dst_disp,
+                       reg_t src, int32_t src_disp) {
+#ifdef NAN_BOXING
+  load(as, RCX, src, src_disp);
+  store(as, dst, dst_disp, RCX);
+#else
+  sse_mem(as, 0xf3, 0x6f, 0, src, src_disp); // movdqu xmm0, [src]
+  sse_mem(as, 0xf3, 0x7f, 0, dst, dst_disp); // movdqu [dst], xmm0
+#endif
+}
+
+static void push_from(assembler_t *as, reg_t src, int32_t disp) {
+  copy_value(as, REG_TOP, 0, src, disp);
+  add_imm(as, REG_TOP, VALUE_SIZE);
+}
+
+static void push_value(assembler_t *as, value_t value) {
+#ifdef NAN_BOXING
+  mov_imm(as, RAX, value);
+  store(as, REG_TOP, 0, RAX);
+#else
+  uint64_t payload;
+  memcpy(&payload, &value.as, sizeof(payload));
+  store32_imm(as, REG_TOP, TYPE_OFFSET, value.type);
+  mov_imm(as, RAX, payload);
+  store(as, REG_TOP, AS_OFFSET, RAX);
+#endif
+  add_imm(as, REG_TOP, VALUE_SIZE);
+}
+
+// Leave compiled code, the interpreter continues at bytecode offset ip
+static void emit_exit(assembler_t *as, int ip) {
+  mov_imm(as, RAX, (uintptr_t)(as->chunk->code + ip));
+  jump_to(as, -1, as->exit);
+}
+
+// Calls a helper with up to three integer arguments. When it does not return
+// JIT_CONTINUE the interpreter takes over at the instruction
+static void emit_helper(assembler_t *as, int offset, uintptr_t helper,
+                        int argc, uint64_t a, uint64_t b, uint64_t c) {
+  store(as, REG_VM, VM_FIELD(stack_top), REG_TOP);
+  store32_imm(as, REG_VM, VM_FIELD(offset), offset + 1);
+  if (argc > 0)
+    mov_imm(as, RDI, a);
+  if (argc > 1)
+    mov_imm(as, RSI, b);
+  if (argc > 2)
+    mov_imm(as, RDX, c);
+  call_abs(as, helper);
+
+  // The helper may have grown the stack or the frame array
+  load(as, REG_TOP, REG_VM, VM_FIELD(stack_top));
+  load(as, REG_FRAME, REG_VM, VM_FIELD(frames));
+  op_reg(as, true, 0x01, REG_FRAME_OFFSET, REG_FRAME); // add r14, r15
+  load(as, REG_SLOTS, REG_FRAME, FRAME_FIELD(slots));
+
+  emit8(as, 0x85); // test eax, eax
+  emit8(as, 0xc0);
+  label_t done = {0};
+  jump_label(as, CC_E, &done);
+  emit_exit(as, offset);
+  bind(as, &done);
+}
+
+// rax = address of the global_t for slot
+static void load_global(assembler_t *as, unsigned int slot) {
+  load(as, RAX, REG_FRAME, FRAME_FIELD(globals));
+  load(as, RAX, RAX, (int32_t)offsetof(globals_t, values));
+  add_imm(as, RAX, slot * (int32_t)sizeof(global_t) +
+                       (int32_t)offsetof(global_t, value));
+}
+
+// Jumps to label when the value at [base + disp] is UNDEFINED_VAL
+static void jump_if_undefined(assembler_t *as, reg_t base, int32_t disp,
+                              label_t *label) {
+#ifdef NAN_BOXING
+  mov_imm(as, RCX, UNDEFINED_VAL);
+  op_mem(as, true, 0x3b, RCX, base, disp); // cmp rcx, [base + disp]
+#else
+  cmp32_imm(as, base, disp + TYPE_OFFSET, VAL_ANY);
+#endif
+  jump_label(as, CC_E, label);
+}
+
+// rax = the obj_upvalue_t of upvalue slot
+static void load_upvalue_object(assembler_t *as, unsigned int slot) {
+  load(as, RAX, REG_FRAME, FRAME_FIELD(closure));
+  load(as, RAX, RAX, (int32_t)offsetof(obj_closure_t, upvalues));
+  load(as, RAX, RAX, slot * (int32_t)sizeof(obj_upvalue_t *));
+}
+
+// rax = the obj_upvalue_t location of upvalue slot
+static void load_upvalue(assembler_t *as, unsigned int slot) {
+  load_upvalue_object(as, slot);
+  load(as, RAX, RAX, (int32_t)offsetof(obj_upvalue_t, location));
+}
+
+// Jumps to label when storing into the object in reg needs WRITE_BARRIER,
+// which compiled code leaves to the interpreter
+static void jump_if_barrier(assembler_t *as, reg_t object, label_t *label) {
+  label_t young = {0};
+  op_mem(as, false, 0x80, 7, object, (int32_t)offsetof(obj_t, is_old));
+  emit8(as, 0);
+  jump_label(as, CC_E, &young);
+  op_mem(as, false, 0x80, 7, object, (int32_t)offsetof(obj_t, is_remembered));
+  emit8(as, 0);
+  jump_label(as, CC_E, label);
+  bind(as, &young);
+}
+
+// A loop back-edge. Leaves for the interpreter, at the OP_LOOP itself, when it
+// has to drain the profiler or compact the heap, as a long running loop would
+// otherwise hold that off until it returns
+static void emit_loop(assembler_t *as, int offset, int target) {
+  _Static_assert(sizeof(sig_atomic_t) == sizeof(uint32_t),
+                 "update_frame is compared as a dword");
+  label_t update = {0};
+  cmp32_imm(as, REG_VM, VM_FIELD(update_frame), 0);
+  jump_label(as, CC_NE, &update);
+  jump_bytecode(as, -1, target);
+  bind(as, &update);
+  emit_exit(as, offset);
+}
+
+static void emit_jump_if_false(assembler_t *as, int target) {
+#ifdef NAN_BOXING
+  load(as, RAX, REG_TOP, PEEK(0));
+  mov_imm(as, RCX, NIL_VAL);
+  op_reg(as, true, 0x39, RCX, RAX); // cmp rax, rcx
+  jump_bytecode(as, CC_E, target);
+  mov_imm(as, RCX, BOOL_VAL(false));
+  op_reg(as, true, 0x39, RCX, RAX);
+  jump_bytecode(as, CC_E, target);
+#else
+  label_t truthy = {0};
+  cmp32_imm(as, REG_TOP, PEEK(0) + TYPE_OFFSET, VAL_NIL);
+  jump_bytecode(as, CC_E, target);
+  cmp32_imm(as, REG_TOP, PEEK(0) + TYPE_OFFSET, VAL_BOOL);
+  jump_label(as, CC_NE, &truthy);
+  op_mem(as, false, 0x80, 7, REG_TOP, PEEK(0) + AS_OFFSET); // cmp byte, 0
+  emit8(as, 0);
+  jump_bytecode(as, CC_E, target);
+  bind(as, &truthy);
+#endif
+}
+
+#ifndef NAN_BOXING
+
+// Jumps to label unless both operands on top of the stack are of type
+static void guard_operands(assembler_t *as, value_type_t type,
+                           label_t *label) {
+  cmp32_imm(as, REG_TOP, PEEK(1) + TYPE_OFFSET, type);
+  jump_label(as, CC_NE, label);
+  cmp32_imm(as, REG_TOP, PEEK(0) + TYPE_OFFSET, type);
+  jump_label(as, CC_NE, label);
+}
+
+// Replaces both operands with al as a bool
+static void store_bool_result(assembler_t *as) {
+  emit8(as, 0x0f); // movzx eax, al
+  emit8(as, 0xb6);
+  emit8(as, 0xc0);
+  store32_imm(as, REG_TOP, PEEK(1) + TYPE_OFFSET, VAL_BOOL);
+  store(as, REG_TOP, PEEK(1) + AS_OFFSET, RAX);
+  add_imm(as, REG_TOP, -VALUE_SIZE);
+}
+
+static void setcc(assembler_t *as, cond_t cond) {
+  emit8(as, 0x0f);
+  emit8(as, 0x90 | cond);
+  emit8(as, 0xc0);
+}
+
+// number (op) number, the result stays a number. Results that overflow jump
+// to overflow, when given, for the helper to compute them as a float
+static void emit_int_arith(assembler_t *as, uint8_t opcode, bool two_byte,
+                           label_t *not_int, label_t *overflow,
+                           label_t *done) {
+  guard_operands(as, VAL_NUMBER, not_int);
+  load(as, RAX, REG_TOP, PEEK(1) + AS_OFFSET);
+  rex(as, true, RAX, REG_TOP);
+  if (two_byte)
+    emit8(as, 0x0f);
+  emit8(as, opcode);
+  mem(as, RAX, REG_TOP, PEEK(0) + AS_OFFSET);
+  if (overflow != NULL)
+    jump_label(as, CC_O, overflow);
+  store(as, REG_TOP, PEEK(1) + AS_OFFSET, RAX);
+  add_imm(as, REG_TOP, -VALUE_SIZE);
+  jump_label(as, -1, done);
+}
+
+// float (op) float, the result stays a float
+static void emit_float_arith(assembler_t *as, uint8_t opcode, label_t *slow,
+                             label_t *done) {
+  guard_operands(as, VAL_FLOAT, slow);
+  sse_mem(as, 0xf2, 0x10, 0, REG_TOP, PEEK(1) + AS_OFFSET); // movsd
+  sse_mem(as, 0xf2, opcode, 0, REG_TOP, PEEK(0) + AS_OFFSET);
+  sse_mem(as, 0xf2, 0x11, 0, REG_TOP, PEEK(1) + AS_OFFSET);
+  add_imm(as, REG_TOP, -VALUE_SIZE);
+  jump_label(as, -1, done);
+}
+
+static void emit_int_compare(assembler_t *as, cond_t cond, label_t *not_int,
+                             label_t *done) {
+  guard_operands(as, VAL_NUMBER, not_int);
+  load(as, RAX, REG_TOP, PEEK(1) + AS_OFFSET);
+  op_mem(as, true, 0x3b, RAX, REG_TOP, PEEK(0) + AS_OFFSET); // cmp rax, b
+  setcc(as, cond);
+  store_bool_result(as);
+  jump_label(as, -1, done);
+}
+
+// Unordered operands have to compare false, so a < b is tested as b > a
+static void emit_float_compare(assembler_t *as, op_code_t op, label_t *slow,
+                               label_t *done) {
+  bool swap = op == OP_LT || op == OP_LE;
+  bool inclusive = op == OP_GE || op == OP_LE;
+  guard_operands(as, VAL_FLOAT, slow);
+  sse_mem(as, 0xf2, 0x10, 0, REG_TOP, (swap ? PEEK(0) : PEEK(1)) + AS_OFFSET);
+  sse_mem(as, 0x66, 0x2e, 0, REG_TOP,
+          (swap ? PEEK(1) : PEEK(0)) + AS_OFFSET); // ucomisd
+  setcc(as, inclusive ? CC_AE : CC_A);
+  store_bool_result(as);
+  jump_label(as, -1, done);
+}
+
+// Indexing into vectors, lists and arrays by number. Leaves rax pointing at
+// the element and rdx at the stack slot of the container
+static void emit_element_address(assembler_t *as, int container, int index,
+                                 bool with_list, label_t *slow,
+                                 label_t *found) {
+  static const struct {
+    obj_type_t type;
+    int32_t count;
+    int32_t values;
+  } layouts[] = {
+      {OBJ_VECTOR, offsetof(obj_vector_t, count),
+       offsetof(obj_vector_t, values)},
+      {OBJ_ARRAY, offsetof(obj_array_t, count), offsetof(obj_array_t, values)},
+      {OBJ_LIST, offsetof(obj_list_t, count), offsetof(obj_list_t, values)},
+  };
+
+  cmp32_imm(as, REG_TOP, PEEK(index) + TYPE_OFFSET, VAL_NUMBER);
+  jump_label(as, CC_NE, slow);
+  cmp32_imm(as, REG_TOP, PEEK(container) + TYPE_OFFSET, VAL_OBJ);
+  jump_label(as, CC_NE, slow);
+  load(as, RAX, REG_TOP, PEEK(container) + AS_OFFSET);
+  load(as, RDX, REG_TOP, PEEK(index) + AS_OFFSET);
+
+  int count = with_list ? 3 : 2;
+  for (int i = 0; i < count; i++) {
+    label_t next = {0};
+    cmp32_imm(as, RAX, (int32_t)offsetof(obj_t, type), layouts[i].type);
+    jump_label(as, CC_NE, &next);
+    op_mem(as, true, 0x63, RCX, RAX, layouts[i].count); // movsxd rcx, count
+    op_reg(as, true, 0x39, RCX, RDX);                   // cmp rdx, rcx
+    // Negative indices compare above every count as unsigned
+    jump_label(as, CC_AE, slow);
+    load(as, RAX, RAX, layouts[i].values);
+    rex(as, true, 0, RDX); // shl rdx, log2(sizeof(value_t))
+    emit8(as, 0xc1);
+    emit8(as, 0xe2);
+    emit8(as, __builtin_ctz(sizeof(value_t)));
+    op_reg(as, true, 0x01, RDX, RAX); // add rax, rdx
+    jump_label(as, -1, found);
+    bind(as, &next);
+  }
+  jump_label(as, -1, slow);
+}
+
+// WRITE_BARRIER_VALUES for the element stored by OP_SET_INDEX. Marks the card
+// of a remembered container itself and leaves the rest to the interpreter
+static void emit_element_barrier(assembler_t *as, label_t *slow) {
+  _Static_assert(offsetof(obj_vector_t, cards) == offsetof(obj_array_t, cards),
+                 "card tables have to be at the same offset");
+  label_t done = {0};
+  load(as, RCX, REG_TOP, PEEK(2) + AS_OFFSET);
+  op_mem(as, false, 0x80, 7, RCX, (int32_t)offsetof(obj_t, is_old));
+  emit8(as, 0);
+  jump_label(as, CC_E, &done);
+  op_mem(as, false, 0x80, 7, RCX, (int32_t)offsetof(obj_t, is_remembered));
+  emit8(as, 0);
+  jump_label(as, CC_E, slow);
+  load(as, RCX, RCX, (int32_t)offsetof(obj_vector_t, cards.flags));
+  op_reg(as, true, 0x85, RCX, RCX); // test rcx, rcx
+  jump_label(as, CC_E, &done);
+  load(as, RDX, REG_TOP, PEEK(1) + AS_OFFSET);
+  op_reg(as, true, 0xc1, 5, RDX); // shr rdx, CARD_SHIFT
+  emit8(as, CARD_SHIFT);
+  emit8(as, 0xc6); // mov byte [rcx + rdx], 1
+  emit8(as, 0x04);
+  emit8(as, 0x11);
+  emit8(as, 1);
+  bind(as, &done);
+}
+
+#endif
+
+static void emit_binary(assembler_t *as, int offset, op_code_t op) {
+  label_t slow = {0};
+  label_t done = {0};
+
+#ifndef NAN_BOXING
+  label_t not_int = {0};
+  switch (op) {
+  case OP_ADD:
+    emit_int_arith(as, 0x03, false, &not_int, &slow, &done);
+    bind(as, &not_int);
+    emit_float_arith(as, 0x58, &slow, &done);
+    break;
+  case OP_SUB:
+    emit_int_arith(as, 0x2b, false, &not_int, &slow, &done);
+    bind(as, &not_int);
+    emit_float_arith(as, 0x5c, &slow, &done);
+    break;
+  case OP_MUL:
+    emit_int_arith(as, 0xaf, true, &not_int, &slow, &done);
+    bind(as, &not_int);
+    emit_float_arith(as, 0x59, &slow, &done);
+    break;
+  case OP_BIT_AND:
+    emit_int_arith(as, 0x23, false, &slow, NULL, &done);
+    break;
+  case OP_BIT_OR:
+    emit_int_arith(as, 0x0b, false, &slow, NULL, &done);
+    break;
+  case OP_XOR:
+    emit_int_arith(as, 0x33, false, &slow, NULL, &done);
+    break;
+  case OP_EQ:
+    emit_int_compare(as, CC_E, &slow, &done);
+    break;
+  case OP_GT:
+  case OP_GE:
+  case OP_LT:
+  case OP_LE: {
+    static const cond_t conds[] = {CC_G, CC_GE, CC_L, CC_LE};
+    emit_int_compare(as, conds[op - OP_GT], &not_int, &done);
+    bind(as, &not_int);
+    emit_float_compare(as, op, &slow, &done);
+  } break;
+  default:
+    break;
+  }
+#endif
+
+  bind(as, &slow);
+  emit_helper(as, offset, (uintptr_t)jit_binary, 1, op, 0, 0);
+  bind(as, &done);
+}
+
+// Translates the instruction at offset, returns the offset of the next one
+static int emit_instruction(assembler_t *as, int offset) {
+  chunk_t *chunk = as->chunk;
+  uint8_t *code = chunk->code + offset;
+#define BYTE(i) ((unsigned int)code[i])
+#define SHORT(i) (BYTE(i) | (BYTE(i + 1) << 8))
+#define LONG(i) (BYTE(i) | (BYTE(i + 1) << 8) | (BYTE(i + 2) << 16))
+
+  op_code_t op = code[0];
+  switch (op) {
+  case OP_CONSTANT:
+  case OP_CONSTANT_LONG: {
+    unsigned int index = op == OP_CONSTANT ? BYTE(1) : LONG(1);
+    mov_imm(as, RAX, (uintptr_t)&chunk->constants.values[index]);
+    push_from(as, RAX, 0);
+    return offset + (op == OP_CONSTANT ? 2 : 4);
+  }
+  case OP_TRUE:
+  case OP_FALSE:
+  case OP_NIL:
+    push_value(as, op == OP_NIL ? NIL_VAL : BOOL_VAL(op == OP_TRUE));
+    return offset + 1;
+  case OP_POP:
+    add_imm(as, REG_TOP, -VALUE_SIZE);
+    return offset + 1;
+  case OP_GET_LOCAL:
+  case OP_GET_LOCAL_LONG: {
+    unsigned int slot = op == OP_GET_LOCAL ? BYTE(1) : LONG(1);
+    push_from(as, REG_SLOTS, slot * VALUE_SIZE);
+    return offset + (op == OP_GET_LOCAL ? 2 : 4);
+  }
+  case OP_SET_LOCAL:
+  case OP_SET_LOCAL_LONG: {
+    unsigned int slot = op == OP_SET_LOCAL ? BYTE(1) : LONG(1);
+    copy_value(as, REG_SLOTS, slot * VALUE_SIZE, REG_TOP, PEEK(0));
+    return offset + (op == OP_SET_LOCAL ? 2 : 4);
+  }
+  case OP_GET_UPVALUE:
+  case OP_GET_UPVALUE_LONG: {
+    load_upvalue(as, op == OP_GET_UPVALUE ? BYTE(1) : LONG(1));
+    push_from(as, RAX, 0);
+    return offset + (op == OP_GET_UPVALUE ? 2 : 4);
+  }
+  case OP_SET_UPVALUE:
+  case OP_SET_UPVALUE_LONG: {
+    label_t barrier = {0};
+    label_t done = {0};
+    load_upvalue_object(as, op == OP_SET_UPVALUE ? BYTE(1) : LONG(1));
+    jump_if_barrier(as, RAX, &barrier);
+    load(as, RAX, RAX, (int32_t)offsetof(obj_upvalue_t, location));
+    copy_value(as, RAX, 0, REG_TOP, PEEK(0));
+    jump_label(as, -1, &done);
+    bind(as, &barrier);
+    emit_exit(as, offset);
+    bind(as, &done);
+    return offset + (op == OP_SET_UPVALUE ? 2 : 4);
+  }
+  case OP_DEFINE_GLOBAL:
+  case OP_DEFINE_GLOBAL_LONG:
+    load_global(as, op == OP_DEFINE_GLOBAL ? BYTE(1) : LONG(1));
+    copy_value(as, RAX, 0, REG_TOP, PEEK(0));
+    add_imm(as, REG_TOP, -VALUE_SIZE);
+    return offset + (op == OP_DEFINE_GLOBAL ? 2 : 4);
+  case OP_GET_GLOBAL:
+  case OP_GET_GLOBAL_LONG: {
+    unsigned int slot = op == OP_GET_GLOBAL ? BYTE(1) : LONG(1);
+    label_t builtin = {0};
+    label_t done = {0};
+    load_global(as, slot);
+    jump_if_undefined(as, RAX, 0, &builtin);
+    push_from(as, RAX, 0);
+    jump_label(as, -1, &done);
+    bind(as, &builtin);
+    emit_helper(as, offset, (uintptr_t)jit_get_global, 1, slot, 0, 0);
+    bind(as, &done);
+    return offset + (op == OP_GET_GLOBAL ? 2 : 4);
+  }
+  case OP_SET_GLOBAL:
+  case OP_SET_GLOBAL_LONG: {
+    label_t undefined = {0};
+    label_t done = {0};
+    load_global(as, op == OP_SET_GLOBAL ? BYTE(1) : LONG(1));
+    jump_if_undefined(as, RAX, 0, &undefined);
+    copy_value(as, RAX, 0, REG_TOP, PEEK(0));
+    jump_label(as, -1, &done);
+    bind(as, &undefined);
+    emit_exit(as, offset);
+    bind(as, &done);
+    return offset + (op == OP_SET_GLOBAL ? 2 : 4);
+  }
+  case OP_GET_PROPERTY:
+  case OP_GET_PROPERTY_LONG:
+  case OP_SET_PROPERTY:
+  case OP_SET_PROPERTY_LONG: {
+    bool is_long = op == OP_GET_PROPERTY_LONG || op == OP_SET_PROPERTY_LONG;
+    bool is_get = op == OP_GET_PROPERTY || op == OP_GET_PROPERTY_LONG;
+    unsigned int name = is_long ? LONG(1) : BYTE(1);
+    unsigned int cache = is_long ? SHORT(4) : SHORT(2);
+    uintptr_t helper = is_get ? (uintptr_t)jit_get_property
+                              : (uintptr_t)jit_set_property;
+    emit_helper(as, offset, helper, 2, name, cache, 0);
+    return offset + (is_long ? 6 : 4);
+  }
+  case OP_GET_INDEX:
+  case OP_GET_INDEX_VEC_NUM:
+  case OP_GET_INDEX_LIST_NUM:
+  case OP_GET_INDEX_ARRAY_NUM: {
+    label_t slow = {0};
+    label_t done = {0};
+#ifndef NAN_BOXING
+    label_t found = {0};
+    emit_element_address(as, 1, 0, true, &slow, &found);
+    bind(as, &found);
+    copy_value(as, REG_TOP, PEEK(1), RAX, 0);
+    add_imm(as, REG_TOP, -VALUE_SIZE);
+    jump_label(as, -1, &done);
+#endif
+    bind(as, &slow);
+    emit_helper(as, offset, (uintptr_t)jit_get_index, 0, 0, 0, 0);
+    bind(as, &done);
+    return offset + 1;
+  }
+  case OP_SET_INDEX:
+  case OP_SET_INDEX_VEC_NUM:
+  case OP_SET_INDEX_ARRAY_NUM: {
+    label_t slow = {0};
+    label_t done = {0};
+#ifndef NAN_BOXING
+    label_t found = {0};
+    emit_element_address(as, 2, 1, false, &slow, &found);
+    bind(as, &found);
+    emit_element_barrier(as, &slow);
+    copy_value(as, RAX, 0, REG_TOP, PEEK(0));
+    copy_value(as, REG_TOP, PEEK(2), REG_TOP, PEEK(0));
+    add_imm(as, REG_TOP, -2 * VALUE_SIZE);
+    jump_label(as, -1, &done);
+#endif
+    bind(as, &slow);
+    emit_helper(as, offset, (uintptr_t)jit_set_index, 0, 0, 0, 0);
+    bind(as, &done);
+    return offset + 1;
+  }
+  case OP_ADD:
+  case OP_SUB:
+  case OP_MUL:
+  case OP_DIV:
+  case OP_MOD:
+  case OP_SHIFTL:
+  case OP_SHIFTR:
+  case OP_BIT_AND:
+  case OP_BIT_OR:
+  case OP_XOR:
+  case OP_EQ:
+  case OP_GT:
+  case OP_GE:
+  case OP_LT:
+  case OP_LE:
+    emit_binary(as, offset, op);
+    return offset + 1;
+  // Quickened forms only differ in which guard the interpreter checks first,
+  // the templates test both
+  case OP_ADD_NUM_NUM:
+  case OP_ADD_FLT_FLT:
+    emit_binary(as, offset, OP_ADD);
+    return offset + 1;
+  case OP_SUB_NUM_NUM:
+  case OP_SUB_FLT_FLT:
+    emit_binary(as, offset, OP_SUB);
+    return offset + 1;
+  case OP_MUL_NUM_NUM:
+  case OP_MUL_FLT_FLT:
+    emit_binary(as, offset, OP_MUL);
+    return offset + 1;
+  case OP_GT_NUM_NUM:
+  case OP_GT_FLT_FLT:
+    emit_binary(as, offset, OP_GT);
+    return offset + 1;
+  case OP_GE_NUM_NUM:
+  case OP_GE_FLT_FLT:
+    emit_binary(as, offset, OP_GE);
+    return offset + 1;
+  case OP_LT_NUM_NUM:
+  case OP_LT_FLT_FLT:
+    emit_binary(as, offset, OP_LT);
+    return offset + 1;
+  case OP_LE_NUM_NUM:
+  case OP_LE_FLT_FLT:
+    emit_binary(as, offset, OP_LE);
+    return offset + 1;
+  case OP_NEG: {
+    label_t done = {0};
+#ifndef NAN_BOXING
+    label_t slow = {0};
+    cmp32_imm(as, REG_TOP, PEEK(0) + TYPE_OFFSET, VAL_NUMBER);
+    jump_label(as, CC_NE, &slow);
+    op_mem(as, true, 0xf7, 3, REG_TOP, PEEK(0) + AS_OFFSET); // neg qword
+    jump_label(as, -1, &done);
+    bind(as, &slow);
+#endif
+    emit_helper(as, offset, (uintptr_t)jit_unary, 1, op, 0, 0);
+    bind(as, &done);
+    return offset + 1;
+  }
+  case OP_LOG_NOT:
+  case OP_BIT_NOT:
+    emit_helper(as, offset, (uintptr_t)jit_unary, 1, op, 0, 0);
+    return offset + 1;
+  case OP_CALL:
+    emit_helper(as, offset, (uintptr_t)jit_call, 1, BYTE(1), 0, 0);
+    return offset + 2;
+  case OP_CALL_BUILTIN:
+    emit_helper(as, offset, (uintptr_t)jit_call_builtin, 3, LONG(1), SHORT(4),
+                BYTE(6));
+    return offset + 7;
+  case OP_INVOKE:
+    emit_helper(as, offset, (uintptr_t)jit_invoke, 3, BYTE(1), BYTE(2),
+                SHORT(3));
+    return offset + 5;
+  case OP_INVOKE_LONG:
+    emit_helper(as, offset, (uintptr_t)jit_invoke, 3, LONG(1), BYTE(4),
+                SHORT(5));
+    return offset + 7;
+  case OP_LOOP:
+    emit_loop(as, offset, offset + 3 - SHORT(1));
+    return offset + 3;
+  case OP_JUMP:
+    jump_bytecode(as, -1, offset + 3 + SHORT(1));
+    return offset + 3;
+  case OP_JUMP_IF_FALSE:
+    emit_jump_if_false(as, offset + 3 + SHORT(1));
+    return offset + 3;
+
+  // Everything below is left to the interpreter
+  case OP_CLOSURE:
+  case OP_CLOSURE_LONG: {
+    bool is_long = op == OP_CLOSURE_LONG;
+    obj_function_t *function =
+        AS_FUNCTION(chunk->constants.values[is_long ? LONG(1) : BYTE(1)]);
+    emit_exit(as, offset);
+    return offset + (is_long ? 4 : 2) + function->upvalue_count * 2;
+  }
+  case OP_ASSERT:
+  case OP_ASSERT_MSG:
+    emit_exit(as, offset);
+    return offset + 10;
+  case OP_INVOKE_ACCESS:
+  case OP_SUPER_INVOKE:
+    emit_exit(as, offset);
+    return offset + 3;
+  case OP_INVOKE_ACCESS_LONG:
+  case OP_SUPER_INVOKE_LONG:
+    emit_exit(as, offset);
+    return offset + 5;
+  case OP_GET_SUPER:
+  case OP_GET_ACCESS:
+  case OP_VECTOR:
+  case OP_LIST:
+  case OP_CLASS:
+  case OP_ENUM:
+  case OP_METHOD:
+  case OP_ENUM_VALUE:
+  case OP_ENUM_VALUE_CUSTOM:
+    emit_exit(as, offset);
+    return offset + 2;
+  case OP_GET_SUPER_LONG:
+  case OP_GET_ACCESS_LONG:
+  case OP_VECTOR_LONG:
+  case OP_LIST_LONG:
+  case OP_CLASS_LONG:
+  case OP_ENUM_LONG:
+  case OP_METHOD_LONG:
+  case OP_ENUM_VALUE_LONG:
+  case OP_ENUM_VALUE_CUSTOM_LONG:
+    emit_exit(as, offset);
+    return offset + 4;
+  case OP_SPREAD:
+  case OP_RANGE:
+  case OP_CLOSE_UPVALUE:
+  case OP_INHERIT:
+  case OP_RETURN:
+    emit_exit(as, offset);
+    return offset + 1;
+  }
+
+#undef LONG
+#undef SHORT
+#undef BYTE
+
+  // Unknown opcode, the rest of the chunk can't be decoded
+  return -1;
+}
+
+// Shared entry and exit sequences, emitted before the instructions:
+//   enter(frame, target) loads the pinned registers and jumps to target
+//   exit stores rax as frame->ip, writes back the stack top and returns
+static void emit_trampolines(assembler_t *as) {
+  static const reg_t saved[] = {RBX, R12, R13, R14, R15};
+  int saved_count = sizeof(saved) / sizeof(saved[0]);
+
+  for (int i = 0; i < saved_count; i++)
+    push_reg(as, saved[i]);
+  mov_reg(as, REG_FRAME, RDI);
+  mov_imm(as, REG_VM, (uintptr_t)&vm);
+  mov_reg(as, REG_FRAME_OFFSET, REG_FRAME);
+  op_mem(as, true, 0x2b, REG_FRAME_OFFSET, REG_VM, VM_FIELD(frames));
+  load(as, REG_SLOTS, REG_FRAME, FRAME_FIELD(slots));
+  load(as, REG_TOP, REG_VM, VM_FIELD(stack_top));
+  load(as, RAX, REG_FRAME, FRAME_FIELD(globals));
+  store(as, REG_VM, VM_FIELD(globals), RAX);
+  emit8(as, 0xff); // jmp rsi
+  emit8(as, 0xe6);
+
+  as->exit = as->count;
+  store(as, REG_FRAME, FRAME_FIELD(ip), RAX);
+  store(as, REG_VM, VM_FIELD(stack_top), REG_TOP);
+  for (int i = saved_count - 1; i >= 0; i--)
+    pop_reg(as, saved[i]);
+  emit8(as, 0xc3); // ret
+}
+
+static jit_code_t *jit_compile(obj_function_t *function) {
+  chunk_t *chunk = &function->chunk;
+  assembler_t as = {0};
+  as.chunk = chunk;
+  as.offsets = malloc(sizeof(int) * (chunk->count + 1));
+  for (int i = 0; i <= chunk->count; i++)
+    as.offsets[i] = -1;
+
+  emit_trampolines(&as);
+
+  int offset = 0;
+  while (offset >= 0 && offset < chunk->count) {
+    as.offsets[offset] = as.count;
+    offset = emit_instruction(&as, offset);
+  }
+
+  jit_code_t *jit = NULL;
+  bool ok = offset == chunk->count;
+  for (int i = 0; ok && i < as.fixup_count; i++) {
+    int target = as.fixups[i].target;
+    if (target < 0 || target >= chunk->count || as.offsets[target] < 0)
+      ok = false;
+    else
+      patch32(&as, as.fixups[i].at,
+              as.offsets[target] - (as.fixups[i].at + 4));
+  }
+
+  void *memory = MAP_FAILED;
+  if (ok)
+    memory = mmap(NULL, as.count, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (memory != MAP_FAILED) {
+    memcpy(memory, as.code, as.count);
+    if (mprotect(memory, as.count, PROT_READ | PROT_EXEC) == 0) {
+      jit = malloc(sizeof(jit_code_t));
+      jit->memory = memory;
+      jit->enter = (jit_enter_fn_t)(uintptr_t)memory;
+      jit->size = as.count;
+      jit->entries = malloc(sizeof(void *) * chunk->count);
+      for (int i = 0; i < chunk->count; i++)
+        jit->entries[i] =
+            as.offsets[i] < 0 ? NULL : (uint8_t *)memory + as.offsets[i];
+    } else
+      munmap(memory, as.count);
+  }
+
+  free(as.code);
+  free(as.offsets);
+  free(as.fixups);
+  return jit;
+}
+
+void jit_resume(call_frame_t *frame) {
+  obj_function_t *function = frame->closure->function;
+  if (function->jit == NULL) {
+    if (function->jit_failed || function->hotness++ < vm.jit_threshold)
+      return;
+    function->jit = jit_compile(function);
+    if (function->jit == NULL) {
+      // It would fail the same way every time it got hot again
+      function->jit_failed = true;
+      return;
+    }
+  }
+
+  // Compiled pushes skip the capacity check push() does. No instruction
+  // pushes more than one value, so room for one per byte of code is plenty
+  value_t *limit = frame->slots + function->arity + 1 + function->chunk.count;
+  if (limit > vm.stack_top)
+    reserve_stack(limit - vm.stack_top);
+
+  void *target = function->jit->entries[frame->ip - function->chunk.code];
+  if (target != NULL)
+    function->jit->enter(frame, target);
+}
+
+void jit_free(obj_function_t *function) {
+  if (function->jit == NULL)
+    return;
+  munmap(function->jit->memory, function->jit->size);
+  free(function->jit->entries);
+  free(function->jit);
+  function->jit = NULL;
+}
+
+#endif
@@ -1,3 +1,4 @@
+#include <limits.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -7,6 +8,7 @@
 
 #include "cli.h"
 #include "memory.h"
+#include "profiler.h"
 #include "random.h"
 #include "shell_integration.h"
 #include "vm.h"
@@ -63,6 +65,7 @@ static const subcommand_t subcommands[] = {
     {"test", cli_run_test, "Run a Xylia test file"},
     {"repl", cli_repl, "Start interactive REPL session"},
     {"docs", cli_docs, "Generate documentation from source files"},
+    {"heap", cli_heap, "Summarize what retains the memory in a heap snapshot"},
     {NULL, NULL, NULL} // Sentinel
 };
 
@@ -140,6 +143,52 @@ static bool parse_global_args_before_subcommand(int *argc, char ***argv,
   return true;
 }
 
+// Parses a byte count with an optional K, M or G suffix, -1 when text isn't
+// one
+static long long parse_size(const char *text) {
+  char *end = NULL;
+  long long size = strtoll(text, &end, 10);
+  if (end == text || size < 0)
+    return -1;
+
+  int shift = 0;
+  if (*end == 'k' || *end == 'K')
+    shift = 10;
+  else if (*end == 'm' || *end == 'M')
+    shift = 20;
+  else if (*end == 'g' || *end == 'G')
+    shift = 30;
+  if (shift != 0)
+    end++;
+
+  if (*end != '\0' || size > (LLONG_MAX >> shift))
+    return -1;
+  return size << shift;
+}
+
+// -1 unless text is a number above 1
+static double parse_grow_factor(const char *text) {
+  char *end = NULL;
+  double factor = strtod(text, &end);
+  if (end == text || *end != '\0' || !(factor > 1))
+    return -1;
+  return factor;
+}
+
+// The collection policy can be set in the environment as well, flags given
+// on the command line take precedence
+static void read_gc_environment(cli_context_t *ctx) {
+  const char *value;
+  if ((value = getenv("XYL_GC_INITIAL_HEAP")) != NULL)
+    ctx->gc_initial_heap = parse_size(value);
+  if ((value = getenv("XYL_GC_GROW_FACTOR")) != NULL)
+    ctx->gc_grow_factor = parse_grow_factor(value);
+  if ((value = getenv("XYL_GC_MAX_HEAP")) != NULL)
+    ctx->gc_max_heap = parse_size(value);
+  if ((value = getenv("XYL_GC_ADAPTIVE")) != NULL)
+    ctx->gc_adaptive = strcmp(value, "") != 0 && strcmp(value, "0") != 0;
+}
+
 // Separate global args from subcommand args
 static void separate_global_and_subcommand_args(int argc, char **argv,
                                                 int *global_argc,
@@ -169,6 +218,58 @@ static void separate_global_and_subcommand_args(int argc, char **argv,
       } else if (strcmp(arg, "-v") == 0 || strcmp(arg, "--verbose") == 0) {
         // Global verbose flag
         ctx->verbose = true;
+      } else if (strcmp(arg, "--jit") == 0) {
+        ctx->jit = true;
+      } else if (strcmp(arg, "--jit-diff") == 0) {
+        ctx->jit_diff = true;
+      } else if (strcmp(arg, "--gc-pause-ms") == 0) {
+        char *end = NULL;
+        if (i + 1 < argc)
+          ctx->gc_pause_ms = strtod(argv[++i], &end);
+        if (end == NULL || end == argv[i] || *end != '\0' ||
+            ctx->gc_pause_ms < 0)
+          ctx->gc_pause_ms = -1;
+      } else if (strcmp(arg, "--gc-threads") == 0) {
+        char *end = NULL;
+        long threads = 0;
+        if (i + 1 < argc)
+          threads = strtol(argv[++i], &end, 10);
+        if (end == NULL || end == argv[i] || *end != '\0' || threads < 1 ||
+            threads > GC_MAX_THREADS)
+          threads = 0;
+        ctx->gc_threads = (int)threads;
+      } else if (strcmp(arg, "--gc-initial-heap") == 0) {
+        ctx->gc_initial_heap = i + 1 < argc ? parse_size(argv[++i]) : -1;
+      } else if (strcmp(arg, "--gc-grow-factor") == 0) {
+        ctx->gc_grow_factor = i + 1 < argc ? parse_grow_factor(argv[++i]) : -1;
+      } else if (strcmp(arg, "--gc-max-heap") == 0) {
+        ctx->gc_max_heap = i + 1 < argc ? parse_size(argv[++i]) : -1;
+      } else if (strcmp(arg, "--gc-adaptive") == 0) {
+        ctx->gc_adaptive = true;
+      } else if (strcmp(arg, "--stats") == 0) {
+        ctx->stats = true;
+      } else if (strcmp(arg, "--alloc-profile") == 0) {
+        ctx->alloc_profile = i + 1 < argc ? argv[++i] : "";
+      } else if (strcmp(arg, "--alloc-sample-bytes") == 0) {
+        ctx->alloc_sample_bytes = i + 1 < argc ? parse_size(argv[++i]) : -1;
+      } else if (strcmp(arg, "--profile") == 0) {
+        ctx->profile_hz = PROFILE_HZ;
+      } else if (strncmp(arg, "--profile=", 10) == 0) {
+        char *end = NULL;
+        long hz = strtol(arg + 10, &end, 10);
+        ctx->profile_hz =
+            end == arg + 10 || *end != '\0' || hz < 1 || hz > 1000 ? -1 : hz;
+      } else if (strcmp(arg, "--profile-output") == 0) {
+        ctx->profile_output = i + 1 < argc ? argv[++i] : "";
+      } else if (strcmp(arg, "--heap-snapshot-on-exit") == 0) {
+        ctx->heap_snapshot = i + 1 < argc ? argv[++i] : "";
+      } else if (strcmp(arg, "--gc-compact") == 0) {
+        char *end = NULL;
+        if (i + 1 < argc)
+          ctx->gc_compact = strtod(argv[++i], &end);
+        if (end == NULL || end == argv[i] || *end != '\0' ||
+            ctx->gc_compact <= 0 || ctx->gc_compact >= 100)
+          ctx->gc_compact = -1;
       } else if (strcmp(arg, "run") == 0 || strcmp(arg, "repl") == 0 ||
                  strcmp(arg, "docs") == 0 || strcmp(arg, "help") == 0 ||
                  strcmp(arg, "version") == 0 || cli_looks_like_file(arg)) {
@@ -199,12 +300,15 @@ static cli_result_t run_file_direct(const char *file, int script_argc,
     printf("Running file: %s\n", file);
   }
 
+  set_args(script_argc, script_argv);
+  if (ctx->jit_diff)
+    return cli_jit_diff(file, ctx) ? CLI_SUCCESS : CLI_ERROR;
+
   char *source = read_file(file);
   if (!source) {
     return CLI_ERROR;
   }
 
-  set_args(script_argc, script_argv);
   result_t result = interpret(source, file);
   free(source);
 
@@ -221,7 +325,24 @@ int main(int argc, char **argv) {
 #endif
 
   // Initialize CLI context
-  cli_context_t ctx = {.verbose = false, .failed = false};
+  cli_context_t ctx = {.verbose = false,
+                       .failed = false,
+                       .jit = false,
+                       .jit_diff = false,
+                       .gc_pause_ms = 0,
+                       .gc_threads = 1,
+                       .gc_compact = 0,
+                       .gc_initial_heap = GC_INITIAL_HEAP,
+                       .gc_grow_factor = GC_GROW_FACTOR,
+                       .gc_max_heap = 0,
+                       .gc_adaptive = false,
+                       .stats = false,
+                       .alloc_profile = NULL,
+                       .alloc_sample_bytes = ALLOC_SAMPLE_BYTES,
+                       .profile_hz = 0,
+                       .profile_output = "xylia.folded",
+                       .heap_snapshot = NULL};
+  read_gc_environment(&ctx);
 
   // Skip program name
   argc--;
@@ -263,6 +384,105 @@ int main(int argc, char **argv) {
   mt_seed_u64(seed);
   init_vm();
 
+  if (ctx.gc_pause_ms < 0) {
+    fprintf(stderr, "Error: --gc-pause-ms expects a non-negative number\n");
+    free_vm();
+    return CLI_INVALID_ARGS;
+  }
+  vm.gc_pause_ms = ctx.gc_pause_ms;
+
+  if (ctx.gc_threads == 0) {
+    fprintf(stderr, "Error: --gc-threads expects a number from 1 to %d\n",
+            GC_MAX_THREADS);
+    free_vm();
+    return CLI_INVALID_ARGS;
+  }
+  vm.gc_threads = ctx.gc_threads;
+
+  if (ctx.gc_compact < 0) {
+    fprintf(stderr, "Error: --gc-compact expects a percentage between 0 and "
+                    "100\n");
+    free_vm();
+    return CLI_INVALID_ARGS;
+  }
+  vm.gc_compact = ctx.gc_compact / 100;
+
+  if (ctx.gc_initial_heap <= 0) {
+    fprintf(stderr, "Error: --gc-initial-heap and XYL_GC_INITIAL_HEAP expect "
+                    "a size like 64M\n");
+    free_vm();
+    return CLI_INVALID_ARGS;
+  }
+  vm.gc_initial_heap = ctx.gc_initial_heap;
+  vm.next_gc = vm.gc_initial_heap;
+
+  if (ctx.gc_grow_factor < 0) {
+    fprintf(stderr, "Error: --gc-grow-factor and XYL_GC_GROW_FACTOR expect a "
+                    "number above 1\n");
+    free_vm();
+    return CLI_INVALID_ARGS;
+  }
+  vm.gc_grow_factor = ctx.gc_grow_factor;
+
+  if (ctx.gc_max_heap < 0) {
+    fprintf(stderr, "Error: --gc-max-heap and XYL_GC_MAX_HEAP expect a size "
+                    "like 512M\n");
+    free_vm();
+    return CLI_INVALID_ARGS;
+  }
+  vm.gc_max_heap = ctx.gc_max_heap;
+  vm.gc_adaptive = ctx.gc_adaptive;
+
+  if (ctx.alloc_profile != NULL && *ctx.alloc_profile == '\0') {
+    fprintf(stderr, "Error: --alloc-profile expects a file to write to\n");
+    free_vm();
+    return CLI_INVALID_ARGS;
+  }
+  if (ctx.alloc_sample_bytes <= 0) {
+    fprintf(stderr, "Error: --alloc-sample-bytes expects a size like 512K\n");
+    free_vm();
+    return CLI_INVALID_ARGS;
+  }
+  if (ctx.alloc_profile != NULL)
+    start_alloc_profile(ctx.alloc_sample_bytes);
+
+  if (ctx.heap_snapshot != NULL && *ctx.heap_snapshot == '\0') {
+    fprintf(stderr, "Error: --heap-snapshot-on-exit expects a file to write "
+                    "to\n");
+    free_vm();
+    return CLI_INVALID_ARGS;
+  }
+  vm.heap_snapshot_path = ctx.heap_snapshot;
+
+  if (ctx.profile_hz < 0) {
+    fprintf(stderr, "Error: --profile= expects samples per second from 1 to "
+                    "1000\n");
+    free_vm();
+    return CLI_INVALID_ARGS;
+  }
+  if (*ctx.profile_output == '\0') {
+    fprintf(stderr, "Error: --profile-output expects a file to write to\n");
+    free_vm();
+    return CLI_INVALID_ARGS;
+  }
+  if (ctx.profile_hz > 0 && !start_cpu_profile(ctx.profile_hz)) {
+    perror("Error: Could not start the profiler");
+    free_vm();
+    return CLI_ERROR;
+  }
+
+#ifdef JIT
+  vm.jit_enabled = ctx.jit;
+#else
+  if (ctx.jit)
+    fprintf(stderr, "Warning: Built without JIT support, ignoring --jit\n");
+  if (ctx.jit_diff) {
+    fprintf(stderr, "Error: --jit-diff needs a build with -DJIT=ON\n");
+    free_vm();
+    return CLI_INVALID_ARGS;
+  }
+#endif
+
   cli_result_t result = CLI_SUCCESS;
 
   // Determine what to do based on arguments
@@ -299,6 +519,21 @@ int main(int argc, char **argv) {
     break;
   }
 
+  if (ctx.stats)
+    print_gc_stats(stderr);
+  if (ctx.alloc_profile != NULL && !write_alloc_profile(ctx.alloc_profile)) {
+    fprintf(stderr, "Error: Could not write the allocation profile to '%s'\n",
+            ctx.alloc_profile);
+    if (exit_code == 0)
+      exit_code = CLI_ERROR;
+  }
+  if (ctx.profile_hz > 0 && !write_cpu_profile(ctx.profile_output)) {
+    fprintf(stderr, "Error: Could not write the profile to '%s'\n",
+            ctx.profile_output);
+    if (exit_code == 0)
+      exit_code = CLI_ERROR;
+  }
+
   free_vm();
   return exit_code;
 }
@@ -1,15 +1,141 @@
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #include "compiler.h"
+#include "jit.h"
 #include "memory.h"
 #include "object.h"
+#include "profiler.h"
+#include "slab.h"
 #include "table.h"
 #include "value.h"
 #include "vm.h"
 
-#define GC_HEAP_GROW_FACTOR 2
+// The adaptive policy keeps the share of the run time spent collecting near
+// GC_TARGET_OVERHEAD, within these growth factors
+#define GC_TARGET_OVERHEAD 0.05
+#define GC_MIN_ADAPTIVE_GROWTH 1.5
+#define GC_MAX_ADAPTIVE_GROWTH 8.0
+
+// Objects an incremental step works through between looks at the clock
+#define GC_STEP_BATCH 64
+
+#ifdef DEBUG_STRESS_GC
+// Under stress every allocation collects the nursery, and every this many
+// allocations the whole heap
+#define STRESS_FULL_GC_INTERVAL 64
+#endif
+
+// Slab memory below which the heap isn't worth compacting, see vm.gc_compact
+#ifdef DEBUG_STRESS_GC
+#define GC_COMPACT_MIN_HEAP 0
+#else
+#define GC_COMPACT_MIN_HEAP (4 * 1024 * 1024)
+#endif
+
+gc_stats_t gc_stats;
+
+// Slot bytes of the objects the last full marking found alive
+static size_t marked_size = 0;
+// Slab memory the last compaction left behind. Compacting again only pays off
+// once the heap has grown past it
+static size_t compacted_size = 0;
+
+// Set while collecting only the nursery: old objects count as reachable and
+// are neither marked nor traced unless they are remembered
+static bool young_only = false;
+
+// Gray objects a marking thread can hold before the rest go to its overflow
+#define MARK_DEQUE_SIZE 4096
+
+// A thread tracing the heap during a parallel marking. The owner pushes and
+// takes gray objects at the bottom of the deque while idle markers steal from
+// its top (a Chase-Lev deque)
+typedef struct {
+  int64_t top;
+  int64_t bottom;
+  obj_t **deque;
+  // Gray objects that didn't fit into the deque, only the owner sees these
+  obj_t **overflow;
+  int overflow_count;
+  int overflow_capacity;
+  pthread_t thread;
+  bool started;
+} marker_t;
+
+static marker_t *markers = NULL;
+static int marker_count = 0;
+// Markers that may still find work, marking is over once this drops to 0
+static int active_markers = 0;
+// The marker of this thread while marking in parallel, NULL otherwise
+static _Thread_local marker_t *current_marker = NULL;
+
+static void push_gray(marker_t *marker, obj_t *object) {
+  int64_t bottom = __atomic_load_n(&marker->bottom, __ATOMIC_RELAXED);
+  int64_t top = __atomic_load_n(&marker->top, __ATOMIC_ACQUIRE);
+  if (bottom - top >= MARK_DEQUE_SIZE) {
+    if (marker->overflow_capacity <= marker->overflow_count) {
+      marker->overflow_capacity = GROW_CAPACITY(marker->overflow_capacity);
+      marker->overflow = (obj_t **)realloc(
+          marker->overflow, sizeof(obj_t *) * marker->overflow_capacity);
+      if (marker->overflow == NULL) {
+        perror("realloc");
+        exit(1);
+      }
+    }
+    marker->overflow[marker->overflow_count++] = object;
+    return;
+  }
+
+  __atomic_store_n(&marker->deque[bottom % MARK_DEQUE_SIZE], object,
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&marker->bottom, bottom + 1, __ATOMIC_RELEASE);
+}
+
+static obj_t *take_gray(marker_t *marker) {
+  int64_t bottom = __atomic_load_n(&marker->bottom, __ATOMIC_RELAXED) - 1;
+  __atomic_store_n(&marker->bottom, bottom, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  int64_t top = __atomic_load_n(&marker->top, __ATOMIC_RELAXED);
+  if (top > bottom) {
+    __atomic_store_n(&marker->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+
+  obj_t *object =
+      __atomic_load_n(&marker->deque[bottom % MARK_DEQUE_SIZE], __ATOMIC_RELAXED);
+  if (top == bottom) {
+    // The last one, thieves may be after it as well
+    if (!__atomic_compare_exchange_n(&marker->top, &top, top + 1, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+      object = NULL;
+    __atomic_store_n(&marker->bottom, bottom + 1, __ATOMIC_RELAXED);
+  }
+  return object;
+}
+
+// Returns NULL when the deque is empty or another thief got there first
+static obj_t *steal_gray(marker_t *marker) {
+  int64_t top = __atomic_load_n(&marker->top, __ATOMIC_ACQUIRE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  int64_t bottom = __atomic_load_n(&marker->bottom, __ATOMIC_ACQUIRE);
+  if (top >= bottom)
+    return NULL;
+
+  obj_t *object =
+      __atomic_load_n(&marker->deque[top % MARK_DEQUE_SIZE], __ATOMIC_RELAXED);
+  if (!__atomic_compare_exchange_n(&marker->top, &top, top + 1, false,
+                                   __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    return NULL;
+  return object;
+}
 
 char *read_file(const char *path) {
   FILE *f = fopen(path, "r");
@@ -43,14 +169,118 @@ char *read_file(const char *path) {
   return buffer;
 }
 
+static void gc_begin(void);
+static void gc_step(void);
+
+static uint64_t clock_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// When the pause in progress started, 0 while the mutator runs
+static uint64_t pause_start = 0;
+
+// Returns false when a pause is already in progress, collections nested in
+// one like the collection compact_heap starts with are part of it
+static bool begin_pause(void) {
+  if (pause_start != 0)
+    return false;
+  // Samples of the CPU profiler may point to what the collector frees
+  drain_cpu_profile();
+  if (vm.bytes_allocated > gc_stats.peak_heap)
+    gc_stats.peak_heap = vm.bytes_allocated;
+  pause_start = clock_ns();
+  return true;
+}
+
+static void end_pause(void) {
+  uint64_t pause = clock_ns() - pause_start;
+  pause_start = 0;
+
+  gc_stats.pause_count++;
+  gc_stats.pause_total_ns += pause;
+  if (pause > gc_stats.pause_max_ns)
+    gc_stats.pause_max_ns = pause;
+  int bucket = 0;
+  for (uint64_t limit = 10000; bucket < GC_PAUSE_BUCKETS - 1 && pause > limit;
+       limit *= 10)
+    bucket++;
+  gc_stats.pause_buckets[bucket]++;
+}
+
+static bool sweep_slice(uint64_t deadline);
+static void finish_sweeping(void);
+
+// Collects the whole heap, and makes the allocation that went past
+// vm.gc_max_heap a runtime error unless that brought it back under. The
+// memory is handed out all the same, the error stops the script at the next
+// instruction
+static void enforce_heap_limit(void) {
+  if (vm.signal != SIG_NONE && vm.signal != SIG_TEST_ASSERT_FAIL)
+    return;
+
+  bool paused = begin_pause();
+  collect_garbage();
+  sweep_slice(UINT64_MAX);
+  finish_sweeping();
+  if (paused)
+    end_pause();
+
+  if (vm.bytes_allocated > vm.gc_max_heap)
+    runtime_error(vm.offset, "Heap limit of %zu bytes exceeded",
+                  vm.gc_max_heap);
+}
+
+static void collect_on_allocation(void) {
+  if (vm.gc_max_heap != 0 && vm.bytes_allocated > vm.gc_max_heap) {
+    enforce_heap_limit();
+    return;
+  }
+
+  bool paused = false;
+#ifdef DEBUG_STRESS_GC
+  static unsigned int stress_count = 0;
+  paused = begin_pause();
+  if (vm.gc_phase != GC_IDLE)
+    gc_step();
+  else if (++stress_count % STRESS_FULL_GC_INTERVAL == 0)
+    gc_begin();
+  if (vm.gc_phase != GC_MARK)
+    collect_nursery();
+#else
+  if (vm.gc_phase != GC_IDLE) {
+    if (vm.bytes_allocated > vm.gc_step_start + GC_STEP_SIZE) {
+      paused = begin_pause();
+      gc_step();
+    }
+  } else if (vm.bytes_allocated > vm.next_gc) {
+    paused = begin_pause();
+    gc_begin();
+  }
+
+  // Marking relies on the remembered set, so the nursery has to wait for it.
+  // A full collection that just ran has emptied it
+  if (vm.gc_phase != GC_MARK &&
+      vm.bytes_allocated > vm.nursery_start + NURSERY_SIZE) {
+    paused = begin_pause() || paused;
+    collect_nursery();
+  }
+#endif
+  if (paused)
+    end_pause();
+}
+
+void *allocate_slot(size_t size) {
+  vm.bytes_allocated += SLAB_ROUND(size);
+  collect_on_allocation();
+  return slab_alloc(size);
+}
+
 void *reallocate(void *ptr, size_t old_size, size_t new_size) {
   vm.bytes_allocated += new_size - old_size;
-  if (new_size > old_size) {
-#ifndef DEBUG_STRESS_GC
-    if (vm.bytes_allocated > vm.next_gc)
-#endif
-      collect_garbage();
-  }
+  if (new_size > old_size)
+    collect_on_allocation();
   if (new_size == 0) {
     if (old_size != 0)
       free(ptr);
@@ -69,9 +299,14 @@ void *reallocate(void *ptr, size_t old_size, size_t new_size) {
 void mark_object(obj_t *object) {
   if (object == NULL)
     return;
-  if (object->is_marked)
+  if (current_marker != NULL) {
+    if (set_marked_atomic(object))
+      push_gray(current_marker, object);
     return;
-  object->is_marked = true;
+  }
+  if ((young_only && object->is_old) || is_marked(object))
+    return;
+  set_marked(object);
 
   if (vm.gray_capacity <= vm.gray_count) {
     vm.gray_capacity = GROW_CAPACITY(vm.gray_capacity);
@@ -90,8 +325,87 @@ void mark_object(obj_t *object) {
 }
 
 void mark_value(value_t value) {
-  if (IS_OBJ(value))
-    mark_object(AS_OBJ(value));
+  if (IS_HEAP(value))
+    mark_object(AS_HEAP(value));
+}
+
+void remember_object(obj_t *object) {
+  if (vm.remembered_capacity <= vm.remembered_count) {
+    vm.remembered_capacity = GROW_CAPACITY(vm.remembered_capacity);
+    vm.remembered = (obj_t **)realloc(
+        vm.remembered, sizeof(obj_t *) * vm.remembered_capacity);
+    if (vm.remembered == NULL) {
+      perror("realloc");
+      exit(1);
+    }
+  }
+
+  object->is_remembered = true;
+  vm.remembered[vm.remembered_count++] = object;
+}
+
+// The card table of a vector or array along with its values, NULL for
+// everything else
+static card_table_t *card_table(obj_t *object, value_t **values, int *count) {
+  if (object->type == OBJ_VECTOR) {
+    obj_vector_t *vector = (obj_vector_t *)object;
+    *values = vector->values;
+    *count = vector->count;
+    return &vector->cards;
+  }
+  if (object->type == OBJ_ARRAY) {
+    obj_array_t *array = (obj_array_t *)object;
+    *values = array->values;
+    *count = array->count;
+    return &array->cards;
+  }
+  *values = NULL;
+  *count = 0;
+  return NULL;
+}
+
+void remember_values(obj_t *object, int from, int to) {
+  value_t *values;
+  int count;
+  card_table_t *cards = card_table(object, &values, &count);
+  if (cards->flags == NULL && count < CARD_MIN_COUNT) {
+    if (!object->is_remembered)
+      remember_object(object);
+    return;
+  }
+
+  int needed = ((count - 1) >> CARD_SHIFT) + 1;
+  if (cards->count < needed) {
+    // Remembered as a whole before, every card may hold young values
+    bool dirty = cards->flags == NULL && object->is_remembered;
+    cards->flags = (uint8_t *)realloc(cards->flags, needed);
+    if (cards->flags == NULL) {
+      perror("realloc");
+      exit(1);
+    }
+    memset(cards->flags + cards->count, dirty, needed - cards->count);
+    cards->count = needed;
+  }
+
+  if (to > from)
+    memset(cards->flags + (from >> CARD_SHIFT), 1,
+           ((to - 1) >> CARD_SHIFT) - (from >> CARD_SHIFT) + 1);
+  if (!object->is_remembered)
+    remember_object(object);
+}
+
+static void forget_remembered(void) {
+  for (int i = 0; i < vm.remembered_count; i++) {
+    obj_t *object = vm.remembered[i];
+    object->is_remembered = false;
+
+    value_t *values;
+    int count;
+    card_table_t *cards = card_table(object, &values, &count);
+    if (cards != NULL && cards->flags != NULL)
+      memset(cards->flags, 0, cards->count);
+  }
+  vm.remembered_count = 0;
 }
 
 static void mark_array(value_array_t *array) {
@@ -102,8 +416,15 @@ static void mark_array(value_array_t *array) {
 static void blacken_object(obj_t *object) {
   switch (object->type) {
   case OBJ_STRING:
+    if (IS_ROPE((obj_string_t *)object)) {
+      obj_rope_t *rope = (obj_rope_t *)object;
+      mark_object((obj_t *)rope->left);
+      mark_object((obj_t *)rope->right);
+    }
+    break;
   case OBJ_BUILTIN:
   case OBJ_FILE:
+  case OBJ_NUMBER:
   case OBJ_ANY:
     break;
   case OBJ_VECTOR: {
@@ -127,6 +448,7 @@ static void blacken_object(obj_t *object) {
     obj_class_t *clas = (obj_class_t *)object;
     mark_object((obj_t *)clas->name);
     mark_table(&clas->methods);
+    mark_shape(clas->shape);
   } break;
   case OBJ_BOUND_METHOD: {
     obj_bound_method_t *bound = (obj_bound_method_t *)object;
@@ -136,7 +458,12 @@ static void blacken_object(obj_t *object) {
   case OBJ_INSTANCE: {
     obj_instance_t *instance = (obj_instance_t *)object;
     mark_object((obj_t *)instance->clas);
-    mark_table(&instance->fields);
+    // Both are set while an instance is switching to dictionary mode
+    if (instance->shape != NULL)
+      for (int i = 0; i < instance->shape->slot_count; i++)
+        mark_value(instance->slots[i]);
+    if (instance->fields != NULL)
+      mark_table(instance->fields);
   } break;
   case OBJ_CLOSURE: {
     obj_closure_t *closure = (obj_closure_t *)object;
@@ -149,7 +476,7 @@ static void blacken_object(obj_t *object) {
     mark_object((obj_t *)function->name);
     mark_array(&function->chunk.constants);
     if (function->globals != NULL)
-      mark_table(function->globals);
+      mark_globals(function->globals);
   } break;
   case OBJ_UPVALUE:
     mark_value(((obj_upvalue_t *)object)->closed);
@@ -158,7 +485,7 @@ static void blacken_object(obj_t *object) {
     obj_module_t *module = (obj_module_t *)object;
     mark_object((obj_t *)module->name);
     mark_object((obj_t *)module->init);
-    mark_table(&module->globals);
+    mark_globals(&module->globals);
   } break;
   case OBJ_RANGE: {
     obj_range_t *range = (obj_range_t *)object;
@@ -176,29 +503,50 @@ static void blacken_object(obj_t *object) {
   }
 }
 
-static void free_object(obj_t *object) {
+// Traces what may have been written to a remembered object since the last
+// collection
+static void blacken_remembered(obj_t *object) {
+  value_t *values;
+  int count;
+  card_table_t *cards = card_table(object, &values, &count);
+  if (cards == NULL || cards->flags == NULL) {
+    blacken_object(object);
+    return;
+  }
+
+  for (int card = 0; card < cards->count; card++) {
+    if (!cards->flags[card])
+      continue;
+    int end = (card + 1) << CARD_SHIFT;
+    for (int i = card << CARD_SHIFT; i < end && i < count; i++)
+      mark_value(values[i]);
+  }
+}
+
+// Frees what object owns. Its slot is reclaimed by the sweep that found it
+// dead, see slab.c
+void free_object(obj_t *object) {
   switch (object->type) {
   case OBJ_STRING: {
     obj_string_t *string = (obj_string_t *)object;
-    FREE_ARRAY(char, string->chars, string->length + 1);
-    FREE(obj_string_t, object);
+    if (!IS_ROPE(string) && !STRING_IS_INLINE(string->length))
+      FREE_ARRAY(char, string->chars, string->length + 1);
   } break;
   case OBJ_VECTOR: {
     obj_vector_t *vector = (obj_vector_t *)object;
+    free(vector->cards.flags);
     FREE_ARRAY(value_t, vector->values, vector->capacity);
-    FREE(obj_vector_t, object);
   } break;
   case OBJ_LIST: {
     obj_list_t *list = (obj_list_t *)object;
-    if (list->count != 0)
+    if (!LIST_IS_INLINE(list->count))
       FREE_ARRAY(value_t, list->values, list->count);
-    FREE(obj_list_t, object);
   } break;
   case OBJ_ARRAY: {
     obj_array_t *array = (obj_array_t *)object;
+    free(array->cards.flags);
     if (array->count != 0)
       FREE_ARRAY(value_t, array->values, array->count);
-    FREE(obj_array_t, object);
   } break;
   case OBJ_FILE: {
     obj_file_t *file = (obj_file_t *)object;
@@ -208,68 +556,61 @@ static void free_object(obj_t *object) {
       file->readable = false;
       file->writable = false;
     }
-    FREE(obj_file_t, object);
   } break;
   case OBJ_CLASS: {
     obj_class_t *clas = (obj_class_t *)object;
     free_table(&clas->methods);
-    FREE(obj_class_t, object);
+    free_shape(clas->shape);
+    // Inline caches may still point at the freed shapes
+    vm.method_epoch++;
   } break;
-  case OBJ_BOUND_METHOD:
-    FREE(obj_bound_method_t, object);
-    break;
   case OBJ_INSTANCE: {
     obj_instance_t *instance = (obj_instance_t *)object;
-    free_table(&instance->fields);
-    FREE(obj_instance_t, object);
+    FREE_ARRAY(value_t, instance->slots, instance->slot_capacity);
+    if (instance->fields != NULL) {
+      free_table(instance->fields);
+      FREE(table_t, instance->fields);
+    }
   } break;
   case OBJ_CLOSURE: {
     obj_closure_t *closure = (obj_closure_t *)object;
-    FREE_ARRAY(obj_upvalue_t *, closure->upvalues, closure->upvalue_count);
-    FREE(obj_closure_t, object);
+    if (!CLOSURE_IS_INLINE(closure->upvalue_count))
+      FREE_ARRAY(obj_upvalue_t *, closure->upvalues, closure->upvalue_count);
   } break;
   case OBJ_FUNCTION: {
     obj_function_t *function = (obj_function_t *)object;
+#ifdef JIT
+    jit_free(function);
+#endif
     free_chunk(&function->chunk);
-    FREE(obj_function_t, object);
   } break;
-  case OBJ_BUILTIN:
-    FREE(obj_builtin_t, object);
-    break;
-  case OBJ_UPVALUE:
-    FREE(obj_upvalue_t, object);
-    break;
   case OBJ_MODULE: {
     obj_module_t *module = (obj_module_t *)object;
-    free_table(&module->globals);
-    FREE(obj_module_t, object);
+    free_globals(&module->globals);
   } break;
-  case OBJ_RANGE:
-    FREE(obj_range_t, object);
-    break;
-  case OBJ_RESULT:
-    FREE(obj_result_t, object);
-    break;
   case OBJ_ENUM: {
     obj_enum_t *enum_ = (obj_enum_t *)object;
     free_table(&enum_->values);
-    FREE(obj_enum_t, object);
   } break;
+  case OBJ_BOUND_METHOD:
+  case OBJ_BUILTIN:
+  case OBJ_UPVALUE:
+  case OBJ_RANGE:
+  case OBJ_RESULT:
+  case OBJ_NUMBER:
   case OBJ_ANY:
     break;
   }
 }
 
 void free_objects(void) {
-  obj_t *object = vm.objects;
-  while (object != NULL) {
-    obj_t *next = object->next;
-    free_object(object);
-    object = next;
-  }
+  free_slabs();
+  vm.gc_phase = GC_IDLE;
 
   if (vm.gray_stack != NULL)
     free(vm.gray_stack);
+  if (vm.remembered != NULL)
+    free(vm.remembered);
 }
 
 static void mark_roots(void) {
@@ -278,7 +619,7 @@ static void mark_roots(void) {
 
   for (int i = 0; i < vm.frame_count; i++) {
     mark_object((obj_t *)vm.frames[i].closure);
-    mark_table(vm.frames[i].globals);
+    mark_globals(vm.frames[i].globals);
   }
 
   for (obj_upvalue_t *upvalue = vm.open_upvalues; upvalue != NULL;
@@ -287,6 +628,8 @@ static void mark_roots(void) {
 
   for (int i = 0; i < VM_STR_MAX; i++)
     mark_object((obj_t *)vm.vm_strings[i]);
+  for (int i = 0; i < 256; i++)
+    mark_object((obj_t *)vm.byte_strings[i]);
 
   if (vm.args)
     mark_object((obj_t *)vm.args);
@@ -298,39 +641,554 @@ static void mark_roots(void) {
   mark_compiler_roots();
 }
 
+// Next gray object of the marker itself, refilling the deque from the
+// overflow so other markers can steal those too
+static obj_t *next_gray(marker_t *marker) {
+  obj_t *object = take_gray(marker);
+  if (object != NULL || marker->overflow_count == 0)
+    return object;
+
+  for (int i = 0; i < MARK_DEQUE_SIZE / 2 && marker->overflow_count > 1; i++)
+    push_gray(marker, marker->overflow[--marker->overflow_count]);
+  return marker->overflow[--marker->overflow_count];
+}
+
+static obj_t *steal_any_gray(marker_t *marker) {
+  int self = (int)(marker - markers);
+  for (int i = 1; i < marker_count; i++) {
+    obj_t *object = steal_gray(&markers[(self + i) % marker_count]);
+    if (object != NULL)
+      return object;
+  }
+  return NULL;
+}
+
+static bool can_steal(void) {
+  for (int i = 0; i < marker_count; i++)
+    if (__atomic_load_n(&markers[i].top, __ATOMIC_ACQUIRE) <
+        __atomic_load_n(&markers[i].bottom, __ATOMIC_ACQUIRE))
+      return true;
+  return false;
+}
+
+static void *run_marker(void *arg) {
+  marker_t *marker = (marker_t *)arg;
+  current_marker = marker;
+
+  for (;;) {
+    obj_t *object = next_gray(marker);
+    if (object == NULL)
+      object = steal_any_gray(marker);
+    if (object != NULL) {
+      blacken_object(object);
+      continue;
+    }
+
+    // Idle markers hold no work, so once all of them are idle the heap has
+    // been traced
+    __atomic_fetch_sub(&active_markers, 1, __ATOMIC_SEQ_CST);
+    while (!can_steal()) {
+      if (__atomic_load_n(&active_markers, __ATOMIC_SEQ_CST) == 0) {
+        current_marker = NULL;
+        return NULL;
+      }
+      sched_yield();
+    }
+    __atomic_fetch_add(&active_markers, 1, __ATOMIC_SEQ_CST);
+  }
+}
+
+// Traces from the gray stack on vm.gc_threads threads. The calling thread is
+// one of them and starts out with all of the gray objects
+static void trace_in_parallel(void) {
+  marker_count = vm.gc_threads;
+  markers = (marker_t *)calloc(marker_count, sizeof(marker_t));
+  if (markers == NULL) {
+    perror("calloc");
+    exit(1);
+  }
+  for (int i = 0; i < marker_count; i++) {
+    markers[i].deque = (obj_t **)malloc(sizeof(obj_t *) * MARK_DEQUE_SIZE);
+    if (markers[i].deque == NULL) {
+      perror("malloc");
+      exit(1);
+    }
+  }
+
+  while (vm.gray_count > 0)
+    push_gray(&markers[0], vm.gray_stack[--vm.gray_count]);
+
+  // Markers start with SIGPROF blocked, the ticks of the CPU profiler are
+  // for the thread running the script
+  sigset_t profiling, mask;
+  sigemptyset(&profiling);
+  sigaddset(&profiling, SIGPROF);
+  pthread_sigmask(SIG_BLOCK, &profiling, &mask);
+
+  active_markers = marker_count;
+  for (int i = 1; i < marker_count; i++) {
+    markers[i].started =
+        pthread_create(&markers[i].thread, NULL, run_marker, &markers[i]) == 0;
+    // One that never runs never goes idle either
+    if (!markers[i].started)
+      __atomic_fetch_sub(&active_markers, 1, __ATOMIC_SEQ_CST);
+  }
+  pthread_sigmask(SIG_SETMASK, &mask, NULL);
+  run_marker(&markers[0]);
+  for (int i = 1; i < marker_count; i++)
+    if (markers[i].started)
+      pthread_join(markers[i].thread, NULL);
+
+  for (int i = 0; i < marker_count; i++) {
+    free(markers[i].deque);
+    free(markers[i].overflow);
+  }
+  free(markers);
+  markers = NULL;
+  marker_count = 0;
+}
+
 static void trace_references(void) {
+  // Nursery collections are too small to be worth the threads
+  if (vm.gc_threads > 1 && !young_only) {
+    trace_in_parallel();
+    return;
+  }
+
   while (vm.gray_count > 0) {
     obj_t *obj = vm.gray_stack[--vm.gray_count];
     blacken_object(obj);
   }
 }
 
-static void sweep(void) {
-  obj_t *previous = NULL;
-  obj_t *object = vm.objects;
-  while (object != NULL) {
-    if (object->is_marked) {
-      object->is_marked = false;
-      previous = object;
-      object = object->next;
-    } else {
-      obj_t *unreached = object;
-      object = object->next;
-      if (previous == NULL)
-        vm.objects = object;
-      else
-        previous->next = object;
-
-      free_object(unreached);
-    }
+// Nothing records stores into globals, so a module that has already been
+// traced has to have its globals scanned again
+static void mark_module_globals(void) {
+  for (int i = 0; i < vm.module_lookup.capacity; i++) {
+    entry_t *entry = &vm.module_lookup.entries[i];
+    if (entry->key != NULL && IS_MODULE(entry->value))
+      mark_globals(&AS_MODULE(entry->value)->globals);
   }
 }
 
-void collect_garbage(void) {
+void collect_nursery(void) {
+  young_only = true;
   mark_roots();
+  mark_module_globals();
+  for (int i = 0; i < vm.remembered_count; i++)
+    blacken_remembered(vm.remembered[i]);
   trace_references();
+  young_only = false;
+
+  forget_remembered();
+  slab_sweep_young(false);
+
+  vm.nursery_start = vm.bytes_allocated;
+  gc_stats.minor_collections++;
+}
+
+// Both slices return true once there is nothing left to do
+static bool mark_slice(uint64_t deadline) {
+  while (vm.gray_count > 0) {
+    for (int i = 0; i < GC_STEP_BATCH && vm.gray_count > 0; i++)
+      blacken_object(vm.gray_stack[--vm.gray_count]);
+    if (clock_ns() >= deadline)
+      return vm.gray_count == 0;
+  }
+  return true;
+}
+
+static bool sweep_slice(uint64_t deadline) {
+  while (slab_sweep_next())
+    if (clock_ns() >= deadline)
+      return false;
+  return true;
+}
+
+// When the last full collection started sweeping, the pause time and the
+// slot bytes allocated by then
+static uint64_t cycle_start = 0;
+static uint64_t cycle_pauses = 0;
+static uint64_t cycle_allocated = 0;
+
+// Picks the growth factor that would have kept the time spent collecting
+// since the last full collection at GC_TARGET_OVERHEAD of the time spent
+// running the script. Collecting costs about the same however much garbage
+// there is, so the room the heap gets to grow scales with that ratio
+static void adapt_grow_factor(size_t live) {
+  uint64_t now = clock_ns();
+  uint64_t pauses = gc_stats.pause_total_ns;
+  if (pause_start != 0)
+    pauses += now - pause_start;
+  uint64_t allocated = 0;
+  for (int type = 0; type < OBJ_ANY; type++)
+    allocated += gc_stats.allocated_bytes[type];
+
+  uint64_t collecting = pauses - cycle_pauses;
+  if (cycle_start != 0 && live > 0 && now - cycle_start > collecting) {
+    double overhead = (double)collecting / (now - cycle_start - collecting);
+    double room = (allocated - cycle_allocated) * overhead / GC_TARGET_OVERHEAD;
+    double factor = 1 + room / live;
+    if (factor < GC_MIN_ADAPTIVE_GROWTH)
+      factor = GC_MIN_ADAPTIVE_GROWTH;
+    else if (factor > GC_MAX_ADAPTIVE_GROWTH)
+      factor = GC_MAX_ADAPTIVE_GROWTH;
+    vm.gc_grow_factor = factor;
+  }
+
+  cycle_start = now;
+  cycle_pauses = pauses;
+  cycle_allocated = allocated;
+}
+
+static void count_live(obj_t *object) {
+  gc_stats.live_objects[object->type]++;
+  gc_stats.live_bytes[object->type] += SLAB_OF(object)->slot_size;
+}
+
+// Every survivor ends up old, nothing can point into the nursery anymore.
+// Sweeping is left to the allocator and the steps that follow
+static void start_sweeping(void) {
   table_remove_white(&vm.strings);
-  sweep();
+  forget_remembered();
+  slab_sweep_young(true);
+
+  memset(gc_stats.live_objects, 0, sizeof(gc_stats.live_objects));
+  memset(gc_stats.live_bytes, 0, sizeof(gc_stats.live_bytes));
+  slab_each_marked(count_live);
+  gc_stats.collections++;
+
+  // The mutator keeps allocating while the heap is swept, so the next
+  // threshold comes from the share of it the marking found alive
+  size_t live_bytes;
+  slab_marked_usage(&marked_size, &live_bytes);
+  double survived = live_bytes > 0 ? (double)marked_size / live_bytes : 1;
+  size_t live = (size_t)(vm.bytes_allocated * survived);
+  if (vm.gc_adaptive)
+    adapt_grow_factor(live);
+  vm.next_gc = (size_t)(live * vm.gc_grow_factor);
+  if (vm.next_gc < vm.gc_initial_heap)
+    vm.next_gc = vm.gc_initial_heap;
+
+  slab_begin_sweep();
+  vm.gc_phase = GC_SWEEP;
+  vm.gc_step_start = vm.bytes_allocated;
+  vm.nursery_start = vm.bytes_allocated;
+}
+
+// The mutator ran between the slices, so marking is closed atomically. Old
+// objects written since are remembered and marked young ones may have been
+// written too, both get scanned again before the remaining gray objects
+static void finish_marking(void) {
+  mark_roots();
+  mark_module_globals();
+  for (int i = 0; i < vm.remembered_count; i++)
+    blacken_remembered(vm.remembered[i]);
+  slab_each_marked_young(blacken_object);
+  trace_references();
+  start_sweeping();
+}
+
+static void finish_sweeping(void) {
+  vm.gc_phase = GC_IDLE;
+  if (vm.gc_compact <= 0)
+    return;
+
+  // Objects allocated while sweeping don't count, most of them die young
+  size_t slab_bytes = slab_footprint();
+  if (slab_bytes >= GC_COMPACT_MIN_HEAP && slab_bytes > compacted_size &&
+      marked_size < slab_bytes * (1 - vm.gc_compact)) {
+    vm.gc_compact_pending = true;
+    // Gets the interpreter loop to look at it
+    vm.update_frame = true;
+  }
+}
+
+static void gc_begin(void) {
+  if (vm.gc_pause_ms <= 0) {
+    collect_garbage();
+    return;
+  }
+
+  mark_roots();
+  vm.gc_phase = GC_MARK;
+  vm.gc_step_start = vm.bytes_allocated;
+}
+
+static void gc_step(void) {
+#ifdef DEBUG_STRESS_GC
+  uint64_t deadline = 0;
+#else
+  uint64_t deadline = clock_ns() + (uint64_t)(vm.gc_pause_ms * 1000000);
+#endif
+
+  if (vm.gc_phase == GC_MARK) {
+    if (mark_slice(deadline))
+      finish_marking();
+  } else if (sweep_slice(deadline)) {
+    finish_sweeping();
+  }
+  vm.gc_step_start = vm.bytes_allocated;
+}
+
+void collect_garbage(void) {
+  // Finish the collection in progress first, so no object is marked
+  if (vm.gc_phase == GC_MARK) {
+    trace_references();
+    finish_marking();
+  }
+  if (vm.gc_phase == GC_SWEEP) {
+    sweep_slice(UINT64_MAX);
+    finish_sweeping();
+  }
 
-  vm.next_gc = vm.bytes_allocated * GC_HEAP_GROW_FACTOR;
+  mark_roots();
+  trace_references();
+  start_sweeping();
+}
+
+void update_value(value_t *value) {
+  if (!IS_HEAP(*value))
+    return;
+  obj_t *object = AS_HEAP(*value);
+#ifdef NAN_BOXING
+  // Keeps the tag, boxed numbers have one of their own
+  *value += (uintptr_t)forwarded(object) - (uintptr_t)object;
+#else
+  value->as.obj = forwarded(object);
+#endif
+}
+
+static void update_array(value_array_t *array) {
+  for (int i = 0; i < array->count; i++)
+    update_value(&array->values[i]);
+}
+
+// Modules hold the globals frames and functions point into, and compiled code
+// refers to the chunk of its function. Both stay where they are
+static bool can_move(obj_t *object) {
+  return object->type != OBJ_MODULE && object->type != OBJ_FUNCTION;
+}
+
+// Follows the same references as blacken_object. Inline storage moved along
+// with object, so the pointers to it are set again first
+static void update_references(obj_t *object) {
+  switch (object->type) {
+  case OBJ_STRING: {
+    obj_string_t *string = (obj_string_t *)object;
+    if (IS_ROPE(string)) {
+      obj_rope_t *rope = (obj_rope_t *)object;
+      UPDATE_OBJECT(rope->left);
+      UPDATE_OBJECT(rope->right);
+    } else if (STRING_IS_INLINE(string->length)) {
+      string->chars = STRING_INLINE_CHARS(string);
+    }
+  } break;
+  case OBJ_BUILTIN:
+  case OBJ_FILE:
+  case OBJ_NUMBER:
+  case OBJ_ANY:
+    break;
+  case OBJ_VECTOR: {
+    obj_vector_t *vector = (obj_vector_t *)object;
+    for (int i = 0; i < vector->count; i++)
+      update_value(&vector->values[i]);
+  } break;
+  case OBJ_LIST: {
+    obj_list_t *list = (obj_list_t *)object;
+    if (LIST_IS_INLINE(list->count))
+      list->values = list->inline_values;
+    if (list->values != NULL)
+      for (int i = 0; i < list->count; i++)
+        update_value(&list->values[i]);
+  } break;
+  case OBJ_ARRAY: {
+    obj_array_t *array = (obj_array_t *)object;
+    if (array->values != NULL)
+      for (int i = 0; i < array->count; i++)
+        update_value(&array->values[i]);
+  } break;
+  case OBJ_CLASS: {
+    obj_class_t *clas = (obj_class_t *)object;
+    UPDATE_OBJECT(clas->name);
+    update_table(&clas->methods);
+    update_shape(clas->shape);
+  } break;
+  case OBJ_BOUND_METHOD: {
+    obj_bound_method_t *bound = (obj_bound_method_t *)object;
+    update_value(&bound->receiver);
+    UPDATE_OBJECT(bound->method);
+  } break;
+  case OBJ_INSTANCE: {
+    obj_instance_t *instance = (obj_instance_t *)object;
+    UPDATE_OBJECT(instance->clas);
+    if (instance->shape != NULL)
+      for (int i = 0; i < instance->shape->slot_count; i++)
+        update_value(&instance->slots[i]);
+    if (instance->fields != NULL)
+      update_table(instance->fields);
+  } break;
+  case OBJ_CLOSURE: {
+    obj_closure_t *closure = (obj_closure_t *)object;
+    if (CLOSURE_IS_INLINE(closure->upvalue_count))
+      closure->upvalues = closure->inline_upvalues;
+    UPDATE_OBJECT(closure->function);
+    for (int i = 0; i < closure->upvalue_count; i++)
+      UPDATE_OBJECT(closure->upvalues[i]);
+  } break;
+  case OBJ_FUNCTION: {
+    obj_function_t *function = (obj_function_t *)object;
+    UPDATE_OBJECT(function->name);
+    update_array(&function->chunk.constants);
+    if (function->globals != NULL)
+      update_globals(function->globals);
+  } break;
+  case OBJ_UPVALUE: {
+    obj_upvalue_t *upvalue = (obj_upvalue_t *)object;
+    update_value(&upvalue->closed);
+    // Once closed an upvalue points at its own value, which moved with it
+    if (upvalue->location < vm.stack ||
+        upvalue->location >= vm.stack + vm.stack_capacity)
+      upvalue->location = &upvalue->closed;
+  } break;
+  case OBJ_MODULE: {
+    obj_module_t *module = (obj_module_t *)object;
+    UPDATE_OBJECT(module->name);
+    UPDATE_OBJECT(module->init);
+    update_globals(&module->globals);
+  } break;
+  case OBJ_RANGE: {
+    obj_range_t *range = (obj_range_t *)object;
+    update_value(&range->from);
+    update_value(&range->to);
+  } break;
+  case OBJ_RESULT: {
+    obj_result_t *result = (obj_result_t *)object;
+    update_value(&result->value);
+  } break;
+  case OBJ_ENUM: {
+    obj_enum_t *enum_ = (obj_enum_t *)object;
+    update_table(&enum_->values);
+  } break;
+  }
+}
+
+// Follows the same roots as mark_roots. The compiler only holds on to
+// functions, which never move
+static void update_roots(void) {
+  for (value_t *slot = vm.stack; slot < vm.stack_top; slot++)
+    update_value(slot);
+
+  for (int i = 0; i < vm.frame_count; i++) {
+    UPDATE_OBJECT(vm.frames[i].closure);
+    update_globals(vm.frames[i].globals);
+  }
+
+  for (obj_upvalue_t **upvalue = &vm.open_upvalues; *upvalue != NULL;
+       upvalue = &(*upvalue)->next)
+    UPDATE_OBJECT(*upvalue);
+
+  for (int i = 0; i < VM_STR_MAX; i++)
+    UPDATE_OBJECT(vm.vm_strings[i]);
+  for (int i = 0; i < 256; i++)
+    UPDATE_OBJECT(vm.byte_strings[i]);
+
+  UPDATE_OBJECT(vm.args);
+
+  update_table(&vm.module_lookup);
+  update_table(&vm.builtins);
+  update_table(&vm.strings);
+}
+
+void compact_heap(void) {
+  bool paused = begin_pause();
+  // Afterwards every live object is old and unmarked, and nothing is
+  // remembered
+  collect_garbage();
+  sweep_slice(UINT64_MAX);
+  finish_sweeping();
+  vm.gc_compact_pending = false;
+
+  // Samples taken since the pause began, and any taken while objects move,
+  // would point to where the functions were
+  profiler_hold++;
+  drain_cpu_profile();
+  int evacuated = slab_evacuate(can_move);
+  gc_stats.compactions++;
+  gc_stats.evacuated_slabs += evacuated;
+  if (evacuated > 0) {
+    update_roots();
+    slab_each_live(update_references);
+    slab_release_evacuated();
+    // Inline caches hold on to the methods they found
+    vm.method_epoch++;
+  }
+  profiler_hold--;
+
+  compacted_size = slab_footprint();
+  if (paused)
+    end_pause();
+}
+
+const gc_stats_t *read_gc_stats(void) {
+  if (vm.bytes_allocated > gc_stats.peak_heap)
+    gc_stats.peak_heap = vm.bytes_allocated;
+  return &gc_stats;
+}
+
+const char *gc_type_name(obj_type_t type) {
+  static const char *names[OBJ_ANY] = {
+      [OBJ_STRING] = "string",
+      [OBJ_VECTOR] = "vector",
+      [OBJ_LIST] = "list",
+      [OBJ_ARRAY] = "array",
+      [OBJ_FILE] = "file",
+      [OBJ_RANGE] = "range",
+      [OBJ_RESULT] = "result",
+      [OBJ_CLASS] = "class",
+      [OBJ_BOUND_METHOD] = "bound method",
+      [OBJ_INSTANCE] = "instance",
+      [OBJ_CLOSURE] = "closure",
+      [OBJ_FUNCTION] = "function",
+      [OBJ_BUILTIN] = "builtin",
+      [OBJ_UPVALUE] = "upvalue",
+      [OBJ_MODULE] = "module",
+      [OBJ_ENUM] = "enum",
+      [OBJ_NUMBER] = "number",
+  };
+  return names[type];
+}
+
+void print_gc_stats(FILE *out) {
+  static const char *buckets[GC_PAUSE_BUCKETS] = {
+      "<= 10us", "<= 100us", "<= 1ms", "<= 10ms", "<= 100ms", "> 100ms",
+  };
+
+  const gc_stats_t *stats = read_gc_stats();
+#ifdef COUNT_INSTRUCTIONS
+  fprintf(out, "Instructions:      %" PRIu64 "\n", vm.instruction_count);
+#else
+  // Printed anyway so the line is there for scripts in every build
+  fprintf(out, "Instructions:      not counted, see COUNT_INSTRUCTIONS\n");
+#endif
+  fprintf(out, "Peak heap:         %zu bytes\n", stats->peak_heap);
+  fprintf(out, "Collections:       %" PRIu64 " full, %" PRIu64 " minor\n",
+          stats->collections, stats->minor_collections);
+  fprintf(out, "Compactions:       %" PRIu64 ", %" PRIu64 " slabs emptied\n",
+          stats->compactions, stats->evacuated_slabs);
+  fprintf(out, "Pauses:            %" PRIu64 ", %.3f ms total, %.3f ms max\n",
+          stats->pause_count, stats->pause_total_ns / 1e6,
+          stats->pause_max_ns / 1e6);
+  for (int i = 0; i < GC_PAUSE_BUCKETS; i++)
+    fprintf(out, "  %-16s %" PRIu64 "\n", buckets[i], stats->pause_buckets[i]);
+
+  fprintf(out, "%-18s %14s %12s %14s\n", "Type", "Allocated", "Live",
+          "Live bytes");
+  for (int type = 0; type < OBJ_ANY; type++) {
+    if (stats->allocated_bytes[type] == 0 && stats->live_objects[type] == 0)
+      continue;
+    fprintf(out, "  %-16s %14" PRIu64 " %12" PRIu64 " %14" PRIu64 "\n",
+            gc_type_name(type), stats->allocated_bytes[type],
+            stats->live_objects[type], stats->live_bytes[type]);
+  }
 }
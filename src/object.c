@@ -2,8 +2,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "hash.h"
 #include "memory.h"
 #include "object.h"
+#include "profiler.h"
+#include "slab.h"
 #include "table.h"
 #include "value.h"
 #include "vm.h"
@@ -11,15 +14,39 @@
 #define ALLOCATE_OBJ(type, object_type)                                        \
   (type *)allocate_object(sizeof(type), object_type)
 
-static obj_t *allocate_object(size_t size, obj_type_t type) {
-  obj_t *object = (obj_t *)reallocate(NULL, 0, size);
+obj_t *allocate_object(size_t size, obj_type_t type) {
+  obj_t *object = (obj_t *)allocate_slot(size);
+  gc_stats.allocated_bytes[type] += SLAB_ROUND(size);
   object->type = type;
-  object->is_marked = false;
-  object->next = vm.objects;
-  vm.objects = object;
+  object->is_old = false;
+  object->is_remembered = false;
+  SAMPLE_ALLOCATION(SLAB_ROUND(size), type);
   return object;
 }
 
+#ifdef NAN_BOXING
+// NUMBER_VAL boxes wide integers anywhere a number is produced, and callers
+// don't root numbers. So a box never triggers a collection when it is made,
+// and it starts out marked to survive the first one that follows
+value_t box_number(int64_t number) {
+  vm.bytes_allocated += SLAB_ROUND(sizeof(obj_number_t));
+  gc_stats.allocated_bytes[OBJ_NUMBER] += SLAB_ROUND(sizeof(obj_number_t));
+  obj_number_t *box = (obj_number_t *)slab_alloc(sizeof(obj_number_t));
+
+  box->obj.type = OBJ_NUMBER;
+  box->obj.is_old = false;
+  box->obj.is_remembered = false;
+  set_marked(&box->obj);
+  box->value = number;
+  SAMPLE_ALLOCATION(SLAB_ROUND(sizeof(obj_number_t)), OBJ_NUMBER);
+  return SIGN_BIT | QNAN | INT_BIT | (uint64_t)(uintptr_t)box;
+}
+
+int64_t unbox_number(value_t value) {
+  return ((obj_number_t *)AS_HEAP(value))->value;
+}
+#endif
+
 obj_bound_method_t *new_bound_method(value_t receiver, obj_closure_t *method) {
   obj_bound_method_t *bound =
       ALLOCATE_OBJ(obj_bound_method_t, OBJ_BOUND_METHOD);
@@ -29,21 +56,34 @@ obj_bound_method_t *new_bound_method(value_t receiver, obj_closure_t *method) {
 }
 
 obj_class_t *new_class(obj_string_t *name) {
+  shape_t *shape = new_shape(NULL, NULL);
+
   obj_class_t *clas = ALLOCATE_OBJ(obj_class_t, OBJ_CLASS);
   clas->name = name;
   init_table(&clas->methods);
+  clas->shape = shape;
+  clas->shape_count = 1;
+  clas->slot_hint = 0;
   return clas;
 }
 
 obj_closure_t *new_closure(obj_function_t *function) {
-  obj_upvalue_t **upvalues = ALLOCATE(obj_upvalue_t *, function->upvalue_count);
-  for (int i = 0; i < function->upvalue_count; i++)
-    upvalues[i] = NULL;
+  int count = function->upvalue_count;
+  obj_closure_t *closure;
+  if (CLOSURE_IS_INLINE(count)) {
+    closure = (obj_closure_t *)allocate_object(
+        sizeof(obj_closure_t) + sizeof(obj_upvalue_t *) * count, OBJ_CLOSURE);
+    closure->upvalues = closure->inline_upvalues;
+  } else {
+    obj_upvalue_t **upvalues = ALLOCATE(obj_upvalue_t *, count);
+    closure = ALLOCATE_OBJ(obj_closure_t, OBJ_CLOSURE);
+    closure->upvalues = upvalues;
+  }
 
-  obj_closure_t *closure = ALLOCATE_OBJ(obj_closure_t, OBJ_CLOSURE);
+  for (int i = 0; i < count; i++)
+    closure->upvalues[i] = NULL;
   closure->function = function;
-  closure->upvalues = upvalues;
-  closure->upvalue_count = function->upvalue_count;
+  closure->upvalue_count = count;
   return closure;
 }
 
@@ -54,78 +94,279 @@ obj_function_t *new_function(void) {
   function->name = NULL;
   function->globals = NULL;
   function->has_varargs = false;
+#ifdef JIT
+  function->hotness = 0;
+  function->jit_failed = false;
+  function->jit = NULL;
+#endif
   init_chunk(&function->chunk);
   return function;
 }
 
 obj_instance_t *new_instance(obj_class_t *clas) {
+  int capacity = clas->slot_hint;
+  value_t *slots = capacity > 0 ? ALLOCATE(value_t, capacity) : NULL;
+
   obj_instance_t *instance = ALLOCATE_OBJ(obj_instance_t, OBJ_INSTANCE);
   instance->clas = clas;
-  init_table(&instance->fields);
+  instance->shape = clas->shape;
+  instance->slots = slots;
+  instance->slot_capacity = capacity;
+  instance->fields = NULL;
   return instance;
 }
 
-obj_builtin_t *new_builtin(builtin_fn_t function) {
+bool instance_get_field(obj_instance_t *instance, obj_string_t *name,
+                        value_t *value) {
+  if (instance->shape == NULL)
+    return table_get(instance->fields, name, value);
+
+  int slot = shape_find(instance->shape, name);
+  if (slot < 0)
+    return false;
+
+  *value = instance->slots[slot];
+  return true;
+}
+
+void instance_reserve_slots(obj_instance_t *instance, int count) {
+  if (count <= instance->slot_capacity)
+    return;
+
+  int old_capacity = instance->slot_capacity;
+  int capacity = old_capacity < 4 ? 4 : old_capacity * GROW_FACTOR;
+  while (capacity < count)
+    capacity *= GROW_FACTOR;
+
+  instance->slots =
+      GROW_ARRAY(value_t, instance->slots, old_capacity, capacity);
+  instance->slot_capacity = capacity;
+}
+
+// Moves the fields of instance out of its slots into a hash table. The
+// instance has to be reachable, since filling the table may collect garbage
+static void instance_to_dictionary(obj_instance_t *instance) {
+  table_t *fields = ALLOCATE(table_t, 1);
+  init_table(fields);
+  instance->fields = fields;
+
+  for (shape_t *shape = instance->shape; shape->parent != NULL;
+       shape = shape->parent)
+    table_set(fields, shape->name, instance->slots[shape->slot_count - 1]);
+
+  FREE_ARRAY(value_t, instance->slots, instance->slot_capacity);
+  instance->slots = NULL;
+  instance->slot_capacity = 0;
+  instance->shape = NULL;
+}
+
+void instance_set_field(obj_instance_t *instance, obj_string_t *name,
+                        value_t value) {
+  if (instance->shape != NULL) {
+    int slot = shape_find(instance->shape, name);
+    if (slot >= 0) {
+      instance->slots[slot] = value;
+      WRITE_BARRIER(instance);
+      return;
+    }
+
+    obj_class_t *clas = instance->clas;
+    shape_t *next =
+        shape_transition(instance->shape, name, &clas->shape_count);
+    if (next != NULL) {
+      push(value);
+      instance_reserve_slots(instance, next->slot_count);
+      pop();
+
+      instance->slots[next->slot_count - 1] = value;
+      instance->shape = next;
+      if (next->slot_count > clas->slot_hint)
+        clas->slot_hint = next->slot_count;
+      WRITE_BARRIER(instance);
+      // The class owns the shape tree holding the new field name
+      WRITE_BARRIER(clas);
+      return;
+    }
+
+    push(value);
+    instance_to_dictionary(instance);
+    pop();
+  }
+
+  push(value);
+  table_set(instance->fields, name, value);
+  WRITE_BARRIER(instance);
+  pop();
+}
+
+obj_builtin_t *new_builtin(builtin_fn_t function, int id) {
   obj_builtin_t *builtin = ALLOCATE_OBJ(obj_builtin_t, OBJ_BUILTIN);
   builtin->function = function;
+  builtin->id = id;
   return builtin;
 }
 
-static obj_string_t *allocate_string(char *chars, int length, uint32_t hash) {
+static obj_string_t *allocate_string(char *chars, int length) {
   obj_string_t *string = ALLOCATE_OBJ(obj_string_t, OBJ_STRING);
   string->length = length;
   string->chars = chars;
-  string->hash = hash;
-  string->interned = true;
+  string->hash = 0;
+  string->hashed = false;
+  string->interned = false;
+  return string;
+}
 
-  push(OBJ_VAL(string));
-  table_set(&vm.strings, string, NIL_VAL);
-  pop();
+// A string of length bytes whose chars the caller fills in, terminator
+// included. Short ones get them in the same slot
+static obj_string_t *new_string(int length) {
+  if (!STRING_IS_INLINE(length))
+    return allocate_string(ALLOCATE(char, length + 1), length);
 
+  obj_string_t *string = (obj_string_t *)allocate_object(
+      sizeof(obj_string_t) + length + 1, OBJ_STRING);
+  string->length = length;
+  string->chars = STRING_INLINE_CHARS(string);
+  string->hash = 0;
+  string->hashed = false;
+  string->interned = false;
   return string;
 }
 
-static uint32_t hash_string(const char *key, int length) {
-  uint32_t hash = 2166136261u;
-  for (int i = 0; i < length; i++) {
-    hash ^= (uint8_t)key[i];
-    hash *= 16777619;
+uint64_t string_hash(obj_string_t *string) {
+  if (!string->hashed) {
+    flat_string(string);
+    string->hash = hash_string(string->chars, string->length);
+    string->hashed = true;
   }
-  return hash;
+  return string->hash;
 }
 
-obj_string_t *take_string(char *chars, int length) {
-  uint32_t hash = hash_string(chars, length);
-  obj_string_t *interned = table_find_string(&vm.strings, chars, length, hash);
-  if (interned != NULL) {
-    FREE_ARRAY(char, chars, length + 1);
+obj_string_t *find_interned(obj_string_t *string) {
+  if (string->interned)
+    return string;
+  // Flattens a rope, which has to happen before chars is read
+  uint64_t hash = string_hash(string);
+  return table_find_string(&vm.strings, string->chars, string->length, hash);
+}
+
+obj_string_t *intern_string(obj_string_t *string) {
+  obj_string_t *interned = find_interned(string);
+  if (interned != NULL)
     return interned;
+
+  string->interned = true;
+  push(OBJ_VAL(string));
+  table_set(&vm.strings, string, NIL_VAL);
+  pop();
+  return string;
+}
+
+// Takes over chars, which has to be malloc()ed and hold length + 1 bytes
+obj_string_t *take_string(char *chars, int length) {
+  if (STRING_IS_INLINE(length)) {
+    obj_string_t *string = new_string(length);
+    memcpy(string->chars, chars, length + 1);
+    free(chars);
+    return string;
   }
 
-  return allocate_string(chars, length, hash);
+  // free_object gives the buffer back through FREE_ARRAY
+  vm.bytes_allocated += length + 1;
+  return allocate_string(chars, length);
 }
 
 obj_string_t *copy_string(const char *chars, int length, bool intern) {
+  uint64_t hash = 0;
   if (intern) {
-    uint32_t hash = hash_string(chars, length);
-
+    hash = hash_string(chars, length);
     obj_string_t *interned =
         table_find_string(&vm.strings, chars, length, hash);
     if (interned != NULL)
       return interned;
+  }
 
-    char *heap_chars = ALLOCATE(char, length + 1);
-    memcpy(heap_chars, chars, length);
-    heap_chars[length] = '\0';
+  obj_string_t *string = new_string(length);
+  memcpy(string->chars, chars, length);
+  string->chars[length] = '\0';
+  if (intern) {
+    string->hash = hash;
+    string->hashed = true;
+    intern_string(string);
+  }
+  return string;
+}
 
-    return allocate_string(heap_chars, length, hash);
-  } else {
-    obj_string_t *string = ALLOCATE_OBJ(obj_string_t, OBJ_STRING);
-    string->length = length;
-    string->chars = (char *)chars;
-    string->interned = false;
-    return string;
+obj_string_t *concat_strings(obj_string_t *a, obj_string_t *b) {
+  int length = a->length + b->length;
+  if (length >= ROPE_MIN_LENGTH) {
+    obj_rope_t *rope = ALLOCATE_OBJ(obj_rope_t, OBJ_STRING);
+    rope->string.length = length;
+    rope->string.chars = NULL;
+    rope->string.hash = 0;
+    rope->string.hashed = false;
+    rope->string.interned = false;
+    rope->left = a;
+    rope->right = b;
+    return &rope->string;
+  }
+
+  // Neither side is long enough to be a rope
+  obj_string_t *string = new_string(length);
+  memcpy(string->chars, a->chars, a->length);
+  memcpy(string->chars + a->length, b->chars, b->length);
+  string->chars[length] = '\0';
+  return string;
+}
+
+void flatten_string(obj_string_t *string) {
+  // Collecting here would free objects callers hold on to without a root, so
+  // the memory is only counted towards the next collection
+  char *chars = malloc(string->length + 1);
+  if (chars == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+  vm.bytes_allocated += string->length + 1;
+
+  // Fills chars from the end. Appending builds ropes whose left side is the
+  // longer one, those are walked with only a couple of pending pieces
+  int pending_capacity = 8;
+  int pending_count = 0;
+  obj_string_t **pending = malloc(sizeof(obj_string_t *) * pending_capacity);
+  if (pending == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+
+  int end = string->length;
+  pending[pending_count++] = string;
+  while (pending_count > 0) {
+    obj_string_t *piece = pending[--pending_count];
+    if (!IS_ROPE(piece)) {
+      end -= piece->length;
+      memcpy(chars + end, piece->chars, piece->length);
+      continue;
+    }
+
+    if (pending_count + 2 > pending_capacity) {
+      pending_capacity *= 2;
+      pending = realloc(pending, sizeof(obj_string_t *) * pending_capacity);
+      if (pending == NULL) {
+        perror("realloc");
+        exit(1);
+      }
+    }
+    obj_rope_t *rope = (obj_rope_t *)piece;
+    pending[pending_count++] = rope->left;
+    pending[pending_count++] = rope->right;
   }
+  free(pending);
+  chars[string->length] = '\0';
+
+  obj_rope_t *rope = (obj_rope_t *)string;
+  rope->left = NULL;
+  rope->right = NULL;
+  string->chars = chars;
 }
 
 obj_upvalue_t *new_upvalue(value_t *slot) {
@@ -138,6 +379,8 @@ obj_upvalue_t *new_upvalue(value_t *slot) {
 
 obj_vector_t *new_vector(int initial_capacity) {
   obj_vector_t *vector = ALLOCATE_OBJ(obj_vector_t, OBJ_VECTOR);
+  vector->cards.flags = NULL;
+  vector->cards.count = 0;
   vector->count = 0;
   vector->capacity = initial_capacity > 0 ? initial_capacity : 4;
   vector->spread = false;
@@ -149,20 +392,30 @@ obj_vector_t *new_vector(int initial_capacity) {
 }
 
 obj_list_t *new_list(int count) {
+  if (LIST_IS_INLINE(count)) {
+    obj_list_t *list = (obj_list_t *)allocate_object(
+        sizeof(obj_list_t) + sizeof(value_t) * count, OBJ_LIST);
+    list->values = list->inline_values;
+    list->count = count;
+    list->spread = false;
+    return list;
+  }
+
   obj_list_t *list = ALLOCATE_OBJ(obj_list_t, OBJ_LIST);
   list->values = NULL;
   list->count = count;
   list->spread = false;
 
   push(OBJ_VAL(list));
-  if (count != 0)
-    list->values = ALLOCATE(value_t, count);
+  list->values = ALLOCATE(value_t, count);
   pop();
   return list;
 }
 
 obj_array_t *new_array(int count) {
   obj_array_t *array = ALLOCATE_OBJ(obj_array_t, OBJ_ARRAY);
+  array->cards.flags = NULL;
+  array->cards.count = 0;
   array->values = NULL;
   array->count = count;
 
@@ -214,7 +467,7 @@ obj_module_t *new_module(obj_string_t *name) {
   module->name = name;
   module->init = NULL;
   push(OBJ_VAL(module));
-  init_table(&module->globals);
+  init_globals(&module->globals);
   pop();
   return module;
 }
@@ -249,7 +502,9 @@ obj_enum_t *new_enum(obj_string_t *name) {
 }
 
 void add_enum_value(obj_enum_t *enum_, obj_string_t *name) {
-  if (!table_set(&enum_->values, name, NUMBER_VAL(++enum_->last))) {
+  bool is_new = table_set(&enum_->values, name, NUMBER_VAL(++enum_->last));
+  WRITE_BARRIER(enum_);
+  if (!is_new) {
     runtime_error(-1, "Duplicate key in enum '%s'", enum_->name->chars);
     return;
   }
@@ -257,7 +512,9 @@ void add_enum_value(obj_enum_t *enum_, obj_string_t *name) {
 
 void add_enum_value_custom(obj_enum_t *enum_, obj_string_t *name,
                            value_t value) {
-  if (!table_set(&enum_->values, name, value)) {
+  bool is_new = table_set(&enum_->values, name, value);
+  WRITE_BARRIER(enum_);
+  if (!is_new) {
     runtime_error(-1, "Duplicate key in enum '%s'", enum_->name->chars);
     return;
   }
@@ -405,6 +662,7 @@ void print_object(FILE *stream, value_t value, bool literally) {
   case OBJ_ENUM:
     fprintf(stream, "<enum %s>", AS_ENUM(value)->name->chars);
     break;
+  case OBJ_NUMBER:
   case OBJ_ANY:
     break;
   }
@@ -0,0 +1,363 @@
+#include <inttypes.h>
+#include <math.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "chunk.h"
+#include "hash.h"
+#include "memory.h"
+#include "object.h"
+#include "profiler.h"
+#include "vm.h"
+
+int64_t alloc_sample_countdown = INT64_MAX;
+volatile sig_atomic_t profiler_hold = 0;
+
+// Both profilers aggregate their samples as the collapsed lines they are
+// written out as, the frames from the outermost call in
+typedef struct {
+  char *stack;
+  uint64_t hash;
+  double weight;
+} stack_entry_t;
+
+typedef struct {
+  stack_entry_t *entries;
+  int count;
+  int capacity;
+} stack_table_t;
+
+static stack_table_t alloc_sites;
+static size_t sample_mean;
+
+// xorshift64*, kept apart from the generator scripts seed and draw from
+static uint64_t random_state = 0x2545f4914f6cdd1dull;
+
+static uint64_t next_random(void) {
+  random_state ^= random_state >> 12;
+  random_state ^= random_state << 25;
+  random_state ^= random_state >> 27;
+  return random_state * 0x2545f4914f6cdd1dull;
+}
+
+// Exponentially distributed gaps make every byte equally likely to be picked,
+// however the allocations line up with the mean
+static int64_t next_sample_gap(void) {
+  double uniform = ((next_random() >> 11) + 1) / 9007199254740992.0;
+  return (int64_t)(-log(uniform) * sample_mean) + 1;
+}
+
+// Bytes one sample of an allocation of size bytes stands for. Small objects
+// are rarely picked, so each pick counts for about sample_mean bytes
+static double sample_weight(size_t size) {
+  return size / (1 - exp(-(double)size / sample_mean));
+}
+
+typedef struct {
+  char *chars;
+  size_t length;
+  size_t capacity;
+} buffer_t;
+
+static void append(buffer_t *buffer, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void append(buffer_t *buffer, const char *fmt, ...) {
+  for (;;) {
+    va_list args;
+    va_start(args, fmt);
+    size_t room = buffer->capacity - buffer->length;
+    int written = vsnprintf(buffer->chars + buffer->length, room, fmt, args);
+    va_end(args);
+    if (written < 0)
+      return;
+    if ((size_t)written < room) {
+      buffer->length += written;
+      return;
+    }
+
+    buffer->capacity = GROW_CAPACITY(buffer->capacity + written);
+    buffer->chars = realloc(buffer->chars, buffer->capacity);
+    if (buffer->chars == NULL) {
+      perror("realloc");
+      exit(1);
+    }
+  }
+}
+
+// Offset of the instruction frame i of the stack is at. The frame on top may
+// be running compiled code, which doesn't keep frame->ip current, but it
+// always sets vm.offset
+static int frame_offset(int i) {
+  call_frame_t *frame = &vm.frames[i];
+  if (i == vm.frame_count - 1)
+    return vm.offset - 1;
+  return (int)(frame->ip - frame->closure->function->chunk.code) - 1;
+}
+
+// Appends function at offset into its code, followed by a semicolon
+static void append_frame(buffer_t *buffer, obj_function_t *function,
+                         int offset) {
+  chunk_t *chunk = &function->chunk;
+  int row = function->row;
+  int col = function->col;
+  if (chunk->pos_count > 0) {
+    srcpos_t pos = chunk_get_srcpos(chunk, offset < 0 ? 0 : offset);
+    row = pos.row;
+    col = pos.col;
+  }
+
+  append(buffer, "%s (%s:%d:%d);",
+         function->name == NULL ? "script" : function->name->chars,
+         function->path->chars, row, col);
+}
+
+static stack_entry_t *find_stack(stack_table_t *table, const char *stack,
+                                 uint64_t hash) {
+  int index = hash & (table->capacity - 1);
+  for (;;) {
+    stack_entry_t *entry = &table->entries[index];
+    if (entry->stack == NULL ||
+        (entry->hash == hash && strcmp(entry->stack, stack) == 0))
+      return entry;
+    index = (index + 1) & (table->capacity - 1);
+  }
+}
+
+static void grow_stacks(stack_table_t *table) {
+  stack_entry_t *old = table->entries;
+  int old_capacity = table->capacity;
+
+  table->capacity = GROW_CAPACITY(table->capacity);
+  table->entries = calloc(table->capacity, sizeof(stack_entry_t));
+  if (table->entries == NULL) {
+    perror("calloc");
+    exit(1);
+  }
+  for (int i = 0; i < old_capacity; i++)
+    if (old[i].stack != NULL)
+      *find_stack(table, old[i].stack, old[i].hash) = old[i];
+  free(old);
+}
+
+// Adds weight to the stack collected in buffer, whose memory the table takes
+// over
+static void add_stack(stack_table_t *table, buffer_t *buffer, double weight) {
+  if ((table->count + 1) * 4 > table->capacity * 3)
+    grow_stacks(table);
+  uint64_t hash = hash_string(buffer->chars, buffer->length);
+  stack_entry_t *entry = find_stack(table, buffer->chars, hash);
+  if (entry->stack == NULL) {
+    entry->stack = buffer->chars;
+    entry->hash = hash;
+    table->count++;
+  } else {
+    free(buffer->chars);
+  }
+  entry->weight += weight;
+}
+
+static void free_stacks(stack_table_t *table) {
+  for (int i = 0; i < table->capacity; i++)
+    free(table->entries[i].stack);
+  free(table->entries);
+  table->entries = NULL;
+  table->count = 0;
+  table->capacity = 0;
+}
+
+static int compare_stacks(const void *a, const void *b) {
+  double difference =
+      (*(stack_entry_t **)b)->weight - (*(stack_entry_t **)a)->weight;
+  return (difference > 0) - (difference < 0);
+}
+
+static bool write_stacks(stack_table_t *table, const char *path) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL)
+    return false;
+
+  // Heaviest stacks first, for reading the file as it is
+  stack_entry_t **sorted =
+      malloc(sizeof(stack_entry_t *) * (table->count + 1));
+  int count = 0;
+  for (int i = 0; i < table->capacity; i++)
+    if (table->entries[i].stack != NULL)
+      sorted[count++] = &table->entries[i];
+  qsort(sorted, count, sizeof(stack_entry_t *), compare_stacks);
+
+  for (int i = 0; i < count; i++)
+    fprintf(file, "%s %" PRIu64 "\n", sorted[i]->stack,
+            (uint64_t)llround(sorted[i]->weight));
+  free(sorted);
+  return fclose(file) == 0;
+}
+
+void start_alloc_profile(size_t sample_bytes) {
+  free_stacks(&alloc_sites);
+  sample_mean = sample_bytes;
+  alloc_sample_countdown = next_sample_gap();
+}
+
+void stop_alloc_profile(void) {
+  alloc_sample_countdown = INT64_MAX;
+}
+
+// Only C memory is allocated, so this is safe in the middle of allocating an
+// object
+void sample_allocation(size_t size, obj_type_t type) {
+  alloc_sample_countdown = next_sample_gap();
+
+  buffer_t buffer = {0};
+  for (int i = 0; i < vm.frame_count; i++)
+    append_frame(&buffer, vm.frames[i].closure->function, frame_offset(i));
+  append(&buffer, "%s", gc_type_name(type));
+  add_stack(&alloc_sites, &buffer, sample_weight(size));
+}
+
+bool write_alloc_profile(const char *path) {
+  return write_stacks(&alloc_sites, path);
+}
+
+// Innermost frames a CPU sample keeps
+#define PROFILE_MAX_DEPTH 64
+// Samples the signal handler can queue before the interpreter takes them
+#define PROFILE_RING_SIZE 4096
+
+typedef struct {
+  obj_function_t *function;
+  int offset;
+} profile_frame_t;
+
+typedef struct {
+  int depth;
+  // Frames further out than PROFILE_MAX_DEPTH were left out
+  bool truncated;
+  profile_frame_t frames[PROFILE_MAX_DEPTH];
+} profile_sample_t;
+
+// The signal handler fills the slot at ring_head, drain_cpu_profile takes
+// the ones up to it. Both run on the thread running the script, so neither
+// needs a lock
+static profile_sample_t *ring;
+static uint32_t ring_head;
+static uint32_t ring_tail;
+static uint64_t samples_taken;
+// Counted from the signal handler
+static uint64_t samples_dropped;
+
+static stack_table_t cpu_stacks;
+static struct sigaction previous_action;
+
+// Copies the frame stack without following anything but the closures, the
+// names and positions are looked up once the sample is drained
+static void on_profile_tick(int sig) {
+  (void)sig;
+  if (vm.frame_count == 0)
+    return;
+
+  uint32_t head = ring_head;
+  uint32_t tail = __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE);
+  if (profiler_hold || head - tail >= PROFILE_RING_SIZE) {
+    __atomic_fetch_add(&samples_dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  profile_sample_t *sample = &ring[head % PROFILE_RING_SIZE];
+  int first = vm.frame_count > PROFILE_MAX_DEPTH
+                  ? vm.frame_count - PROFILE_MAX_DEPTH
+                  : 0;
+  sample->truncated = first > 0;
+  sample->depth = vm.frame_count - first;
+  for (int i = first; i < vm.frame_count; i++) {
+    sample->frames[i - first].function = vm.frames[i].closure->function;
+    sample->frames[i - first].offset = frame_offset(i);
+  }
+  __atomic_store_n(&ring_head, head + 1, __ATOMIC_RELEASE);
+
+  // Has the interpreter drain the ring at the next instruction
+  vm.update_frame = true;
+}
+
+bool start_cpu_profile(int hz) {
+  if (ring == NULL) {
+    ring = calloc(PROFILE_RING_SIZE, sizeof(profile_sample_t));
+    if (ring == NULL) {
+      perror("calloc");
+      exit(1);
+    }
+  }
+
+  struct sigaction action = {0};
+  action.sa_handler = on_profile_tick;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, &previous_action) != 0)
+    return false;
+
+  // ITIMER_PROF counts the CPU time of the whole process. Marker threads
+  // block SIGPROF, so the ticks are delivered to the one running the script
+  struct itimerval timer = {0};
+  timer.it_interval.tv_sec = 1 / hz;
+  timer.it_interval.tv_usec = hz == 1 ? 0 : 1000000 / hz;
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+    sigaction(SIGPROF, &previous_action, NULL);
+    return false;
+  }
+  return true;
+}
+
+void drain_cpu_profile(void) {
+  uint32_t head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+  uint32_t tail = ring_tail;
+  for (; tail != head; tail++) {
+    profile_sample_t *sample = &ring[tail % PROFILE_RING_SIZE];
+    buffer_t buffer = {0};
+    if (sample->truncated)
+      append(&buffer, "...;");
+    for (int i = 0; i < sample->depth; i++)
+      append_frame(&buffer, sample->frames[i].function,
+                   sample->frames[i].offset);
+    // Drops the semicolon after the innermost frame
+    buffer.chars[--buffer.length] = '\0';
+    add_stack(&cpu_stacks, &buffer, 1);
+    samples_taken++;
+  }
+  __atomic_store_n(&ring_tail, tail, __ATOMIC_RELEASE);
+}
+
+static void stop_cpu_profile(void) {
+  if (ring == NULL)
+    return;
+
+  struct itimerval timer = {0};
+  setitimer(ITIMER_PROF, &timer, NULL);
+  sigaction(SIGPROF, &previous_action, NULL);
+  drain_cpu_profile();
+}
+
+bool write_cpu_profile(const char *path) {
+  stop_cpu_profile();
+  uint64_t dropped = __atomic_load_n(&samples_dropped, __ATOMIC_RELAXED);
+  if (dropped > 0)
+    fprintf(stderr,
+            "Warning: The profiler dropped %" PRIu64 " of %" PRIu64
+            " samples\n",
+            dropped, samples_taken + dropped);
+  return write_stacks(&cpu_stacks, path);
+}
+
+void free_profiles(void) {
+  stop_alloc_profile();
+  free_stacks(&alloc_sites);
+
+  stop_cpu_profile();
+  free_stacks(&cpu_stacks);
+  free(ring);
+  ring = NULL;
+}
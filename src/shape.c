@@ -0,0 +1,70 @@
+#include "shape.h"
+#include "memory.h"
+#include "object.h" // IWYU pragma: keep
+#include "slab.h"
+
+shape_t *new_shape(shape_t *parent, obj_string_t *name) {
+  shape_t *shape = ALLOCATE(shape_t, 1);
+  shape->parent = parent;
+  shape->name = name;
+  shape->slot_count = parent == NULL ? 0 : parent->slot_count + 1;
+  shape->transitions = NULL;
+  shape->transition_count = 0;
+  shape->transition_capacity = 0;
+  return shape;
+}
+
+// Frees shape together with every shape reachable through its transitions
+void free_shape(shape_t *shape) {
+  for (int i = 0; i < shape->transition_count; i++)
+    free_shape(shape->transitions[i]);
+  FREE_ARRAY(shape_t *, shape->transitions, shape->transition_capacity);
+  FREE(shape_t, shape);
+}
+
+// Returns the slot holding name in instances of this shape, or -1
+int shape_find(shape_t *shape, obj_string_t *name) {
+  for (; shape->parent != NULL; shape = shape->parent)
+    if (shape->name == name)
+      return shape->slot_count - 1;
+  return -1;
+}
+
+// Returns the shape reached by adding name to shape, creating it if needed.
+// shape_count is the number of shapes in the tree and is bumped for every new
+// one. Returns NULL once the tree or the shape would grow past its limit
+shape_t *shape_transition(shape_t *shape, obj_string_t *name,
+                          int *shape_count) {
+  for (int i = 0; i < shape->transition_count; i++)
+    if (shape->transitions[i]->name == name)
+      return shape->transitions[i];
+
+  if (shape->slot_count >= SHAPE_MAX_FIELDS ||
+      *shape_count >= SHAPE_MAX_PER_CLASS)
+    return NULL;
+
+  if (shape->transition_count >= shape->transition_capacity) {
+    int old_capacity = shape->transition_capacity;
+    shape->transition_capacity = old_capacity < 2 ? 2 : old_capacity * 2;
+    shape->transitions =
+        GROW_ARRAY(shape_t *, shape->transitions, old_capacity,
+                   shape->transition_capacity);
+  }
+
+  shape_t *next = new_shape(shape, name);
+  shape->transitions[shape->transition_count++] = next;
+  (*shape_count)++;
+  return next;
+}
+
+void mark_shape(shape_t *shape) {
+  mark_object((obj_t *)shape->name);
+  for (int i = 0; i < shape->transition_count; i++)
+    mark_shape(shape->transitions[i]);
+}
+
+void update_shape(shape_t *shape) {
+  UPDATE_OBJECT(shape->name);
+  for (int i = 0; i < shape->transition_count; i++)
+    update_shape(shape->transitions[i]);
+}
@@ -0,0 +1,437 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "object.h"
+#include "profiler.h"
+#include "slab.h"
+#include "vm.h"
+
+// Keep AddressSanitizer able to catch use of freed objects
+#ifdef __SANITIZE_ADDRESS__
+#include <sanitizer/asan_interface.h>
+#define POISON(ptr, size) ASAN_POISON_MEMORY_REGION(ptr, size)
+#define UNPOISON(ptr, size) ASAN_UNPOISON_MEMORY_REGION(ptr, size)
+#else
+#define POISON(ptr, size) ((void)(ptr), (void)(size))
+#define UNPOISON(ptr, size) ((void)(ptr), (void)(size))
+#endif
+
+#define SLAB_CLASSES (SLAB_MAX_SIZE / SLAB_GRANULE)
+
+#define SLAB_HEADER                                                            \
+  ((sizeof(slab_t) + SLAB_GRANULE - 1) / SLAB_GRANULE * SLAB_GRANULE)
+
+struct free_slot {
+  struct free_slot *next;
+};
+
+typedef struct {
+  // Swept slabs with a free slot, allocation takes from the first one
+  slab_t *available;
+  // Swept slabs without one
+  slab_t *full;
+  // Slabs the last marking hasn't been applied to yet, their free slots are
+  // unknown until they are swept
+  slab_t *unswept;
+} slab_class_t;
+
+static slab_class_t classes[SLAB_CLASSES];
+// Slabs young objects have been allocated in since the last sweep of the
+// nursery, linked through next_young
+static slab_t *young_slabs = NULL;
+// Size class slab_sweep_next looks at first
+static int sweep_class = 0;
+// Slabs emptied by slab_evacuate, waiting for slab_release_evacuated
+static slab_t *evacuated = NULL;
+
+static slab_class_t *class_of(size_t size) {
+  return &classes[(size - 1) / SLAB_GRANULE];
+}
+
+static void link_slab(slab_t **list, slab_t *slab) {
+  slab->prev = NULL;
+  slab->next = *list;
+  if (*list != NULL)
+    (*list)->prev = slab;
+  *list = slab;
+}
+
+static void unlink_slab(slab_t **list, slab_t *slab) {
+  if (slab->prev != NULL)
+    slab->prev->next = slab->next;
+  else
+    *list = slab->next;
+  if (slab->next != NULL)
+    slab->next->prev = slab->prev;
+}
+
+static bool is_full(slab_t *slab) {
+  return slab->free == NULL && slab->unused == slab->end;
+}
+
+static slab_t *new_slab(slab_class_t *class, int slot_size) {
+  slab_t *slab = (slab_t *)aligned_alloc(SLAB_SIZE, SLAB_SIZE);
+  if (slab == NULL) {
+    perror("aligned_alloc");
+    exit(1);
+  }
+
+  slab->next_young = NULL;
+  slab->has_young = false;
+  slab->evacuated = false;
+  slab->free = NULL;
+  slab->unused = (char *)slab + SLAB_HEADER;
+  slab->end =
+      slab->unused + (SLAB_SIZE - SLAB_HEADER) / slot_size * slot_size;
+  slab->slot_size = slot_size;
+  slab->live = 0;
+  memset(slab->live_bits, 0, sizeof(slab->live_bits));
+  memset(slab->mark_bits, 0, sizeof(slab->mark_bits));
+  memset(slab->young_bits, 0, sizeof(slab->young_bits));
+  POISON(slab->unused, slab->end - slab->unused);
+  link_slab(&class->available, slab);
+  return slab;
+}
+
+static int capacity_of(slab_t *slab) {
+  return (SLAB_SIZE - SLAB_HEADER) / slab->slot_size;
+}
+
+static obj_t *object_at(slab_t *slab, int word, uint64_t bits) {
+  int bit = word * 64 + __builtin_ctzll(bits);
+  return (obj_t *)((char *)slab + bit * SLAB_GRANULE);
+}
+
+// Frees a dead object and puts its slot on the free list. Its live bit is
+// left to the caller
+static void free_slot(slab_t *slab, obj_t *object) {
+  free_object(object);
+
+  free_slot_t *slot = (free_slot_t *)object;
+  slot->next = slab->free;
+  slab->free = slot;
+  POISON(slot, slab->slot_size);
+
+  slab->live--;
+  vm.bytes_allocated -= slab->slot_size;
+}
+
+// Frees what the last marking left white. Slabs that end up empty go back to
+// the system, unless the size class has nothing else to allocate from
+static void sweep_slab(slab_class_t *class, slab_t *slab) {
+  unlink_slab(&class->unswept, slab);
+
+  for (int word = 0; word < SLAB_BITMAP_WORDS; word++) {
+    uint64_t dead = slab->live_bits[word] & ~slab->mark_bits[word];
+    slab->live_bits[word] &= slab->mark_bits[word];
+    for (; dead != 0; dead &= dead - 1)
+      free_slot(slab, object_at(slab, word, dead));
+  }
+  memset(slab->mark_bits, 0, sizeof(slab->mark_bits));
+
+  if (slab->live == 0 && class->available != NULL)
+    free(slab);
+  else
+    link_slab(is_full(slab) ? &class->full : &class->available, slab);
+}
+
+// Hands out a free slot of slab, which has to be on the available list
+static void *take_slot(slab_class_t *class, slab_t *slab) {
+  void *slot;
+  if (slab->free != NULL) {
+    slot = slab->free;
+    UNPOISON(slot, slab->slot_size);
+    slab->free = slab->free->next;
+  } else {
+    slot = slab->unused;
+    UNPOISON(slot, slab->slot_size);
+    slab->unused += slab->slot_size;
+  }
+
+  int bit = slab_bit(slot);
+  slab->live_bits[bit / 64] |= (uint64_t)1 << (bit % 64);
+  slab->live++;
+  if (is_full(slab)) {
+    unlink_slab(&class->available, slab);
+    link_slab(&class->full, slab);
+  }
+  return slot;
+}
+
+void *slab_alloc(size_t size) {
+  if (size > SLAB_MAX_SIZE) {
+    fprintf(stderr, "Error: Objects of %zu bytes don't fit into a slab\n",
+            size);
+    exit(1);
+  }
+
+  slab_class_t *class = class_of(size);
+  // Samples of the CPU profiler may point to what the sweep frees
+  if (class->available == NULL && class->unswept != NULL)
+    drain_cpu_profile();
+  while (class->available == NULL && class->unswept != NULL)
+    sweep_slab(class, class->unswept);
+
+  slab_t *slab = class->available;
+  if (slab == NULL)
+    slab = new_slab(class, SLAB_ROUND(size));
+  void *slot = take_slot(class, slab);
+
+  int bit = slab_bit(slot);
+  slab->young_bits[bit / 64] |= (uint64_t)1 << (bit % 64);
+  if (!slab->has_young) {
+    slab->has_young = true;
+    slab->next_young = young_slabs;
+    young_slabs = slab;
+  }
+  return slot;
+}
+
+void slab_sweep_young(bool keep_marks) {
+  slab_t *slab = young_slabs;
+  while (slab != NULL) {
+    slab_t *next = slab->next_young;
+    slab->next_young = NULL;
+    slab->has_young = false;
+    bool was_full = is_full(slab);
+
+    for (int word = 0; word < SLAB_BITMAP_WORDS; word++) {
+      uint64_t young = slab->young_bits[word];
+      if (young == 0)
+        continue;
+
+      uint64_t survivors = young & slab->mark_bits[word];
+      uint64_t dead = young & ~survivors;
+      slab->young_bits[word] = 0;
+      slab->live_bits[word] &= ~dead;
+      if (!keep_marks)
+        slab->mark_bits[word] &= ~survivors;
+
+      for (; survivors != 0; survivors &= survivors - 1)
+        object_at(slab, word, survivors)->is_old = true;
+      for (; dead != 0; dead &= dead - 1)
+        free_slot(slab, object_at(slab, word, dead));
+    }
+
+    if (was_full && !is_full(slab)) {
+      slab_class_t *class = class_of(slab->slot_size);
+      unlink_slab(&class->full, slab);
+      link_slab(&class->available, slab);
+    }
+    slab = next;
+  }
+  young_slabs = NULL;
+}
+
+void slab_each_marked_young(void (*visit)(obj_t *object)) {
+  for (slab_t *slab = young_slabs; slab != NULL; slab = slab->next_young) {
+    for (int word = 0; word < SLAB_BITMAP_WORDS; word++) {
+      uint64_t marked = slab->young_bits[word] & slab->mark_bits[word];
+      for (; marked != 0; marked &= marked - 1)
+        visit(object_at(slab, word, marked));
+    }
+  }
+}
+
+static void each_marked(slab_t *slab, void (*visit)(obj_t *object)) {
+  for (; slab != NULL; slab = slab->next) {
+    for (int word = 0; word < SLAB_BITMAP_WORDS; word++)
+      for (uint64_t marked = slab->mark_bits[word]; marked != 0;
+           marked &= marked - 1)
+        visit(object_at(slab, word, marked));
+  }
+}
+
+void slab_each_marked(void (*visit)(obj_t *object)) {
+  for (int i = 0; i < SLAB_CLASSES; i++) {
+    each_marked(classes[i].available, visit);
+    each_marked(classes[i].full, visit);
+  }
+}
+
+static void add_marked(slab_t *slab, size_t *marked_bytes,
+                       size_t *live_bytes) {
+  for (; slab != NULL; slab = slab->next) {
+    for (int word = 0; word < SLAB_BITMAP_WORDS; word++)
+      *marked_bytes += (size_t)__builtin_popcountll(slab->mark_bits[word]) *
+                       slab->slot_size;
+    *live_bytes += (size_t)slab->live * slab->slot_size;
+  }
+}
+
+void slab_marked_usage(size_t *marked_bytes, size_t *live_bytes) {
+  *marked_bytes = 0;
+  *live_bytes = 0;
+  for (int i = 0; i < SLAB_CLASSES; i++) {
+    add_marked(classes[i].available, marked_bytes, live_bytes);
+    add_marked(classes[i].full, marked_bytes, live_bytes);
+  }
+}
+
+static void queue_all(slab_t **list, slab_t **unswept) {
+  while (*list != NULL) {
+    slab_t *slab = *list;
+    unlink_slab(list, slab);
+    link_slab(unswept, slab);
+  }
+}
+
+void slab_begin_sweep(void) {
+  for (int i = 0; i < SLAB_CLASSES; i++) {
+    queue_all(&classes[i].available, &classes[i].unswept);
+    queue_all(&classes[i].full, &classes[i].unswept);
+  }
+  sweep_class = 0;
+}
+
+bool slab_sweep_next(void) {
+  for (; sweep_class < SLAB_CLASSES; sweep_class++) {
+    slab_class_t *class = &classes[sweep_class];
+    if (class->unswept != NULL) {
+      sweep_slab(class, class->unswept);
+      return true;
+    }
+  }
+  return false;
+}
+
+static size_t footprint(slab_t *slab) {
+  size_t bytes = 0;
+  for (; slab != NULL; slab = slab->next)
+    bytes += SLAB_SIZE;
+  return bytes;
+}
+
+size_t slab_footprint(void) {
+  size_t bytes = 0;
+  for (int i = 0; i < SLAB_CLASSES; i++)
+    bytes += footprint(classes[i].available) + footprint(classes[i].full) +
+             footprint(classes[i].unswept);
+  return bytes;
+}
+
+// Less than half full and nothing in it that has to stay put
+static bool is_sparse(slab_t *slab, bool (*can_move)(obj_t *object)) {
+  if (slab->live * 2 >= capacity_of(slab))
+    return false;
+  for (int word = 0; word < SLAB_BITMAP_WORDS; word++)
+    for (uint64_t live = slab->live_bits[word]; live != 0; live &= live - 1)
+      if (!can_move(object_at(slab, word, live)))
+        return false;
+  return true;
+}
+
+static void move_objects(slab_class_t *class, slab_t *from) {
+  for (int word = 0; word < SLAB_BITMAP_WORDS; word++) {
+    for (uint64_t live = from->live_bits[word]; live != 0; live &= live - 1) {
+      obj_t *object = object_at(from, word, live);
+      slab_t *to = class->available;
+      if (to == NULL)
+        to = new_slab(class, from->slot_size);
+
+      obj_t *moved = (obj_t *)take_slot(class, to);
+      memcpy(moved, object, from->slot_size);
+      ((obj_t **)object)[1] = moved;
+    }
+  }
+}
+
+// Full slabs can't be sparse, so only the available ones are looked at
+static int evacuate_class(slab_class_t *class,
+                          bool (*can_move)(obj_t *object)) {
+  int sparse = 0;
+  int moving = 0;
+  int room = 0;
+  int capacity = 0;
+  for (slab_t *slab = class->available; slab != NULL; slab = slab->next) {
+    capacity = capacity_of(slab);
+    slab->evacuated = is_sparse(slab, can_move);
+    if (slab->evacuated) {
+      sparse++;
+      moving += slab->live;
+    } else {
+      room += capacity - slab->live;
+    }
+  }
+
+  // Worth it only if the moved objects need fewer new slabs than are emptied
+  int new_slabs = moving > room ? (moving - room + capacity - 1) / capacity : 0;
+  bool worth_it = sparse > new_slabs;
+
+  // Taken off the available list first, so nothing is moved into them
+  slab_t *emptied = NULL;
+  slab_t *slab = class->available;
+  while (slab != NULL) {
+    slab_t *next = slab->next;
+    if (slab->evacuated && !worth_it) {
+      slab->evacuated = false;
+    } else if (slab->evacuated) {
+      unlink_slab(&class->available, slab);
+      link_slab(&emptied, slab);
+    }
+    slab = next;
+  }
+
+  while (emptied != NULL) {
+    slab = emptied;
+    unlink_slab(&emptied, slab);
+    move_objects(class, slab);
+    link_slab(&evacuated, slab);
+  }
+  return worth_it ? sparse : 0;
+}
+
+int slab_evacuate(bool (*can_move)(obj_t *object)) {
+  int emptied = 0;
+  for (int i = 0; i < SLAB_CLASSES; i++)
+    emptied += evacuate_class(&classes[i], can_move);
+  return emptied;
+}
+
+static void each_live(slab_t *slab, void (*visit)(obj_t *object)) {
+  for (; slab != NULL; slab = slab->next)
+    for (int word = 0; word < SLAB_BITMAP_WORDS; word++)
+      for (uint64_t live = slab->live_bits[word]; live != 0; live &= live - 1)
+        visit(object_at(slab, word, live));
+}
+
+void slab_each_live(void (*visit)(obj_t *object)) {
+  for (int i = 0; i < SLAB_CLASSES; i++) {
+    each_live(classes[i].available, visit);
+    each_live(classes[i].full, visit);
+    each_live(classes[i].unswept, visit);
+  }
+}
+
+void slab_release_evacuated(void) {
+  while (evacuated != NULL) {
+    slab_t *next = evacuated->next;
+    free(evacuated);
+    evacuated = next;
+  }
+}
+
+static void free_all(slab_t *slab) {
+  while (slab != NULL) {
+    slab_t *next = slab->next;
+    for (int word = 0; word < SLAB_BITMAP_WORDS; word++)
+      for (uint64_t live = slab->live_bits[word]; live != 0; live &= live - 1)
+        free_object(object_at(slab, word, live));
+    free(slab);
+    slab = next;
+  }
+}
+
+void free_slabs(void) {
+  for (int i = 0; i < SLAB_CLASSES; i++) {
+    free_all(classes[i].available);
+    free_all(classes[i].full);
+    free_all(classes[i].unswept);
+    classes[i].available = NULL;
+    classes[i].full = NULL;
+    classes[i].unswept = NULL;
+  }
+  young_slabs = NULL;
+}
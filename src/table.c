@@ -3,6 +3,7 @@
 
 #include "memory.h"
 #include "object.h" // IWYU pragma: keep
+#include "slab.h"
 #include "table.h"
 
 void init_table(table_t *table) {
@@ -58,7 +59,13 @@ static void adjust_capacity(table_t *table, int capacity) {
   table->capacity = capacity;
 }
 
+// Keys are interned strings, found by identity. A string made at runtime is
+// interned when it is first stored as a key, and a lookup with one that has
+// no interned copy can't find anything
 bool table_set(table_t *table, obj_string_t *key, value_t value) {
+  if (!key->interned)
+    key = intern_string(key);
+
   if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
     int capacity = GROW_CAPACITY(table->capacity);
     adjust_capacity(table, capacity);
@@ -77,6 +84,8 @@ bool table_set(table_t *table, obj_string_t *key, value_t value) {
 bool table_delete(table_t *table, obj_string_t *key) {
   if (table->count == 0)
     return false;
+  if (!key->interned && (key = find_interned(key)) == NULL)
+    return false;
 
   entry_t *entry = find_entry(table->entries, table->capacity, key);
   if (entry->key == NULL)
@@ -90,6 +99,8 @@ bool table_delete(table_t *table, obj_string_t *key) {
 bool table_get(table_t *table, obj_string_t *key, value_t *value) {
   if (table->count == 0)
     return false;
+  if (!key->interned && (key = find_interned(key)) == NULL)
+    return false;
 
   entry_t *entry = find_entry(table->entries, table->capacity, key);
   if (entry->key == NULL)
@@ -108,7 +119,7 @@ void table_add_all(table_t *from, table_t *to) {
 }
 
 obj_string_t *table_find_string(table_t *table, const char *chars, int length,
-                                uint32_t hash) {
+                                uint64_t hash) {
   if (table->count == 0)
     return NULL;
 
@@ -129,7 +140,7 @@ obj_string_t *table_find_string(table_t *table, const char *chars, int length,
 void table_remove_white(table_t *table) {
   for (int i = 0; i < table->capacity; i++) {
     entry_t *entry = &table->entries[i];
-    if (entry->key != NULL && !entry->key->obj.is_marked)
+    if (entry->key != NULL && !is_marked(&entry->key->obj))
       table_delete(table, entry->key);
   }
 }
@@ -141,3 +152,86 @@ void mark_table(table_t *table) {
     mark_value(entry->value);
   }
 }
+
+void update_table(table_t *table) {
+  for (int i = 0; i < table->capacity; i++) {
+    entry_t *entry = &table->entries[i];
+    UPDATE_OBJECT(entry->key);
+    update_value(&entry->value);
+  }
+}
+
+void init_globals(globals_t *globals) {
+  init_table(&globals->slots);
+  globals->count = 0;
+  globals->capacity = 0;
+  globals->values = NULL;
+}
+
+void free_globals(globals_t *globals) {
+  free_table(&globals->slots);
+  FREE_ARRAY(global_t, globals->values, globals->capacity);
+  init_globals(globals);
+}
+
+// Returns the slot of name, allocating an undefined one on first use. name
+// has to be reachable, since growing the globals may collect garbage
+int globals_slot(globals_t *globals, obj_string_t *name) {
+  value_t slot;
+  if (table_get(&globals->slots, name, &slot))
+    return (int)AS_NUMBER(slot);
+
+  if (globals->count >= globals->capacity) {
+    int old_capacity = globals->capacity;
+    globals->capacity = GROW_CAPACITY(old_capacity);
+    globals->values = GROW_ARRAY(global_t, globals->values, old_capacity,
+                                 globals->capacity);
+  }
+
+  int index = globals->count;
+  globals->values[index].name = name;
+  globals->values[index].value = UNDEFINED_VAL;
+  globals->count++;
+
+  table_set(&globals->slots, name, NUMBER_VAL(index));
+  return index;
+}
+
+bool globals_get(globals_t *globals, obj_string_t *name, value_t *value) {
+  value_t slot;
+  if (!table_get(&globals->slots, name, &slot))
+    return false;
+
+  value_t global = globals->values[AS_NUMBER(slot)].value;
+  if (IS_UNDEFINED(global))
+    return false;
+
+  *value = global;
+  return true;
+}
+
+void globals_add_all(globals_t *from, globals_t *to) {
+  for (int i = 0; i < from->count; i++) {
+    global_t *global = &from->values[i];
+    if (!IS_UNDEFINED(global->value)) {
+      int slot = globals_slot(to, global->name);
+      to->values[slot].value = from->values[i].value;
+    }
+  }
+}
+
+void mark_globals(globals_t *globals) {
+  mark_table(&globals->slots);
+  for (int i = 0; i < globals->count; i++) {
+    mark_object((obj_t *)globals->values[i].name);
+    mark_value(globals->values[i].value);
+  }
+}
+
+void update_globals(globals_t *globals) {
+  update_table(&globals->slots);
+  for (int i = 0; i < globals->count; i++) {
+    UPDATE_OBJECT(globals->values[i].name);
+    update_value(&globals->values[i].value);
+  }
+}
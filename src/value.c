@@ -28,7 +28,7 @@ void free_value_array(value_array_t *array) {
 }
 
 void print_value(FILE *stream, value_t value, bool literally) {
-  switch (value.type) {
+  switch (VALUE_TYPE(value)) {
   case VAL_BOOL:
     fputs(AS_BOOL(value) ? "true" : "false", stream);
     break;
@@ -55,10 +55,10 @@ bool values_equal(value_t a, value_t b) {
   if (IS_FLOAT(a) && IS_NUMBER(b))
     return AS_FLOAT(a) == (double)AS_NUMBER(b);
 
-  if (a.type != b.type)
+  if (VALUE_TYPE(a) != VALUE_TYPE(b))
     return false;
 
-  switch (a.type) {
+  switch (VALUE_TYPE(a)) {
   case VAL_BOOL:
     return AS_BOOL(a) == AS_BOOL(b);
   case VAL_NIL:
@@ -73,10 +73,14 @@ bool values_equal(value_t a, value_t b) {
       obj_string_t *a_str = AS_STRING(a);
       obj_string_t *b_str = AS_STRING(b);
 
+      if (a_str == b_str)
+        return true;
       if (a_str->interned && b_str->interned)
-        return a_str == b_str;
+        return false;
       if (a_str->length != b_str->length)
         return false;
+      if (a_str->hashed && b_str->hashed && a_str->hash != b_str->hash)
+        return false;
       return memcmp(a_str->chars, b_str->chars, a_str->length) == 0;
     } break;
     case OBJ_VECTOR: {
@@ -10,8 +10,11 @@
 #include "builtins.h"
 #include "chunk.h"
 #include "compiler.h"
+#include "heap_snapshot.h"
+#include "jit.h"
 #include "memory.h"
 #include "object.h"
+#include "profiler.h"
 #include "table.h"
 #include "value.h"
 #include "vm.h"
@@ -20,6 +23,10 @@
 #include "debug.h"
 #endif
 
+#if defined(__GNUC__) && !defined(NO_COMPUTED_GOTO)
+#define USE_COMPUTED_GOTO
+#endif
+
 vm_t vm;
 
 void set_signal(vm_singal_t sig, int exit_code) {
@@ -81,9 +88,10 @@ void runtime_error(int offset, const char *fmt, ...) {
 
 static void define_method(obj_string_t *name);
 
-static void define_builtin(const char *name, builtin_fn_t function) {
-  push(OBJ_VAL(copy_string(name, strlen(name), true)));
-  push(OBJ_VAL(new_builtin(function)));
+static void define_builtin(int id) {
+  const builtin_entry_t *entry = &builtin_registry[id];
+  push(OBJ_VAL(copy_string(entry->name, strlen(entry->name), true)));
+  push(OBJ_VAL(new_builtin(entry->function, id)));
   table_set(&vm.builtins, AS_STRING(vm.stack[0]), vm.stack[1]);
   pop();
   pop();
@@ -120,6 +128,8 @@ static void free_frames(void) {
 static void init_vm_string(void) {
   for (int i = 0; i < VM_STR_MAX; i++)
     vm.vm_strings[i] = NULL;
+  for (int i = 0; i < 256; i++)
+    vm.byte_strings[i] = NULL;
 
   vm.vm_strings[VM_STR_INIT] = copy_string("init", 4, true);
   vm.vm_strings[VM_STR_BOOL] = copy_string("bool", 4, true);
@@ -168,15 +178,37 @@ static void init_vm_string(void) {
       copy_string("__set_slice__", 13, true);
   vm.vm_strings[VM_STR_OVERLOAD_GET_SLICE] =
       copy_string("__get_slice__", 13, true);
+
+  for (int i = 0; i < 256; i++) {
+    char byte = (char)i;
+    vm.byte_strings[i] = copy_string(&byte, 1, true);
+  }
 }
 
 void init_vm(void) {
+  // Set first, so allocating the stack doesn't start a collection
+  vm.bytes_allocated = 0;
+  vm.next_gc = GC_INITIAL_HEAP;
+
   init_stack(0);
   init_frames(0);
 
-  vm.bytes_allocated = 0;
-  vm.next_gc = 1024 * 1024;
-  vm.objects = NULL;
+  vm.nursery_start = 0;
+
+  vm.remembered = NULL;
+  vm.remembered_capacity = 0;
+  vm.remembered_count = 0;
+
+  vm.gc_initial_heap = GC_INITIAL_HEAP;
+  vm.gc_grow_factor = GC_GROW_FACTOR;
+  vm.gc_max_heap = 0;
+  vm.gc_adaptive = false;
+  vm.gc_pause_ms = 0;
+  vm.gc_threads = 1;
+  vm.gc_compact = 0;
+  vm.gc_compact_pending = false;
+  vm.gc_phase = GC_IDLE;
+  vm.gc_step_start = 0;
 
   vm.gray_capacity = 0;
   vm.gray_count = 0;
@@ -184,6 +216,8 @@ void init_vm(void) {
 
   vm.args = NULL;
 
+  vm.method_epoch = 1;
+
   init_table(&vm.module_lookup);
   init_table(&vm.builtins);
   init_table(&vm.strings);
@@ -192,111 +226,27 @@ void init_vm(void) {
 
   init_vm_string();
 
-#define BUILTIN(name) define_builtin("__builtin___" #name, builtin_##name)
-#define BUILTIN_CLEAN(name) define_builtin(#name, builtin_##name)
-
-  // IO
-  BUILTIN(print);
-  BUILTIN(println);
-  BUILTIN(printf);
-
-  BUILTIN(fprint);
-  BUILTIN(fprintln);
-  BUILTIN(fprintf);
-
-  BUILTIN(stdin);
-  BUILTIN(stdout);
-  BUILTIN(stderr);
-
-  BUILTIN(input);
-
-  BUILTIN(open);
-  BUILTIN(close);
-  BUILTIN(read);
-  BUILTIN(write);
-
-  // Vectors
-  BUILTIN_CLEAN(len);
-  BUILTIN(append);
-  BUILTIN(pop);
-  BUILTIN(insert);
-  BUILTIN(remove);
-  BUILTIN(slice);
-
-  // Arrays
-  BUILTIN(array);
-  BUILTIN(resize);
-
-  // Utils
-  BUILTIN_CLEAN(typeof);
-  BUILTIN_CLEAN(isinstance);
-  BUILTIN_CLEAN(hasmethod);
-  BUILTIN_CLEAN(getclass);
-  BUILTIN_CLEAN(exit);
-  BUILTIN_CLEAN(argv);
-  BUILTIN(hash);
-  BUILTIN_CLEAN(import);
-
-  // Casts
-  BUILTIN_CLEAN(string);
-  BUILTIN_CLEAN(number);
-  BUILTIN_CLEAN(float);
-  BUILTIN_CLEAN(bool);
-  BUILTIN_CLEAN(vector);
-  BUILTIN_CLEAN(list);
-
-  // Results
-  BUILTIN_CLEAN(ok);
-  BUILTIN_CLEAN(err);
-  BUILTIN_CLEAN(is_ok);
-  BUILTIN_CLEAN(is_err);
-  BUILTIN_CLEAN(unwrap);
-  BUILTIN_CLEAN(unwrap_or);
-  BUILTIN_CLEAN(unwrap_err);
-  BUILTIN_CLEAN(expect);
-
-  // Math
-  BUILTIN(abs);
-  BUILTIN(min);
-  BUILTIN(max);
-
-  BUILTIN(sin);
-  BUILTIN(cos);
-  BUILTIN(tan);
-  BUILTIN(asin);
-  BUILTIN(acos);
-  BUILTIN(atan);
-  BUILTIN(atan2);
-
-  BUILTIN(sqrt);
-  BUILTIN(pow);
-  BUILTIN(log);
-  BUILTIN(exp);
-
-  BUILTIN(floor);
-  BUILTIN(ceil);
-  BUILTIN(round);
-
-  // Random
-  BUILTIN(random);
-  BUILTIN(randomseed);
-
-  // Time
-  BUILTIN(now);
-  BUILTIN(clock);
-  BUILTIN(sleep);
-  BUILTIN(localtime);
-
-#undef BUILTIN_CLEAN
-#undef BUILTIN
+  for (int id = 0; id < builtin_registry_count; id++)
+    if (!builtin_registry[id].test_only)
+      define_builtin(id);
 
   vm.offset = 0;
+  vm.heap_snapshot_path = NULL;
+  vm.instruction_count = 0;
+
+#ifdef JIT
+  vm.jit_enabled = false;
+  vm.jit_threshold = JIT_HOT_THRESHOLD;
+  vm.jit_depth = 0;
+#endif
 
   set_signal(SIG_NONE, -1);
   vm.update_frame = false;
 }
 
 void free_vm(void) {
+  remove_temp_dir();
+  free_profiles();
   free_stack();
   free_frames();
 
@@ -306,6 +256,8 @@ void free_vm(void) {
 
   for (int i = 0; i < VM_STR_MAX; i++)
     vm.vm_strings[i] = NULL;
+  for (int i = 0; i < 256; i++)
+    vm.byte_strings[i] = NULL;
 
   free_objects();
 }
@@ -313,26 +265,45 @@ void free_vm(void) {
 void set_args(int argc, char **argv) {
   vm.args = new_list(argc);
   for (int i = 0; i < argc; i++)
-    vm.args->values[i] = OBJ_VAL(copy_string(argv[i], strlen(argv[i]), true));
+    vm.args->values[i] = OBJ_VAL(copy_string(argv[i], strlen(argv[i]), false));
+  WRITE_BARRIER(vm.args);
 }
 
 void load_test_functions(void) {
-  define_builtin("case_failed", builtin_case_failed);
-  define_builtin("assert_true", builtin_assert_true);
-  define_builtin("assert_false", builtin_assert_false);
-  define_builtin("assert_eq", builtin_assert_eq);
-  define_builtin("assert_neq", builtin_assert_neq);
+  for (int id = 0; id < builtin_registry_count; id++)
+    if (builtin_registry[id].test_only)
+      define_builtin(id);
+}
+
+void reserve_stack(int count) {
+  size_t used = vm.stack_top - vm.stack;
+  if (used + count <= (size_t)vm.stack_capacity)
+    return;
+
+  int old_capacity = vm.stack_capacity;
+  int capacity = old_capacity;
+  while (used + count > (size_t)capacity)
+    capacity = GROW_CAPACITY(capacity);
+
+  value_t *old_stack = vm.stack;
+  vm.stack = GROW_ARRAY(value_t, vm.stack, old_capacity, capacity);
+  vm.stack_capacity = capacity;
+  vm.stack_top = vm.stack + used;
+  if (vm.stack == old_stack)
+    return;
+
+  // Frames and open upvalues point into the stack, move them along with it
+  for (int i = 0; i < vm.frame_count; i++)
+    vm.frames[i].slots = vm.stack + (vm.frames[i].slots - old_stack);
+  for (obj_upvalue_t *upvalue = vm.open_upvalues; upvalue != NULL;
+       upvalue = upvalue->next)
+    upvalue->location = vm.stack + (upvalue->location - old_stack);
 }
 
 void push(value_t value) {
-  size_t count = vm.stack_top - vm.stack;
-  if (count >= vm.stack_capacity) {
-    int old_capacity = vm.stack_capacity;
-    vm.stack_capacity = GROW_CAPACITY(old_capacity);
-    vm.stack = GROW_ARRAY(value_t, vm.stack, old_capacity, vm.stack_capacity);
-  }
+  if (vm.stack_top - vm.stack >= vm.stack_capacity)
+    reserve_stack(1);
 
-  vm.stack_top = vm.stack + count;
   *vm.stack_top = value;
   vm.stack_top++;
 }
@@ -350,17 +321,23 @@ value_t pop(void) {
 void push_frame(obj_closure_t *closure, int argc) {
   if (vm.frame_count >= vm.frame_capacity) {
     int old_capacity = vm.frame_capacity;
+    // The profiler reads the frames from a signal handler
+    profiler_hold++;
     vm.frame_capacity = GROW_CAPACITY(old_capacity);
     vm.frames =
         GROW_ARRAY(call_frame_t, vm.frames, old_capacity, vm.frame_capacity);
+    profiler_hold--;
   }
 
-  call_frame_t *frame = &vm.frames[vm.frame_count++];
+  call_frame_t *frame = &vm.frames[vm.frame_count];
   frame->closure = closure;
   frame->globals = closure->function->globals;
   frame->ip = closure->function->chunk.code;
   frame->slots = vm.stack_top - argc - 1;
   frame->is_module = false;
+  // The frame is complete before the profiler can see it
+  __atomic_signal_fence(__ATOMIC_RELEASE);
+  vm.frame_count++;
 }
 
 static value_t peek(int distance) {
@@ -398,6 +375,11 @@ static bool call(obj_closure_t *closure, int argc) {
     return false;
   }
 
+  if (vm.frame_count >= FRAMES_MAX) {
+    set_signal(SIG_STACK_OVERFLOW, -1);
+    return false;
+  }
+
   value_t stack[argc];
   for (int i = 0; i < argc; i++)
     stack[i] = pop();
@@ -466,6 +448,37 @@ static bool call_value(value_t callee, int argc) {
   return false;
 }
 
+// Calls builtin_registry[id] with the argc values on top of the stack. When
+// the module has since defined a global of the same name that value is called
+// instead, so the callee is slotted in below the arguments first
+static bool call_builtin(unsigned int slot, int id, int argc) {
+  value_t shadow = vm.globals->values[slot].value;
+  if (!IS_UNDEFINED(shadow)) {
+    push(NIL_VAL);
+    value_t *args = vm.stack_top - argc - 1;
+    memmove(args + 1, args, argc * sizeof(value_t));
+    args[0] = shadow;
+    return call_value(shadow, argc);
+  }
+
+  const builtin_entry_t *entry = &builtin_registry[id];
+  value_t *argv = vm.stack_top - argc;
+  value_t result = UNDEFINED_VAL;
+  if (entry->fast != NULL && argc == entry->fast_argc) {
+    bool typed = true;
+    for (int i = 0; i < argc; i++)
+      typed &= VALUE_TYPE(argv[i]) == entry->fast_args[i];
+    if (typed)
+      result = entry->fast(argv);
+  }
+
+  if (IS_UNDEFINED(result))
+    result = entry->function(argc, argv);
+  vm.stack_top -= argc;
+  push(result);
+  return true;
+}
+
 static bool invoke_from_class(obj_class_t *clas, obj_string_t *name, int argc) {
   value_t method;
   if (!table_get(&clas->methods, name, &method)) {
@@ -548,7 +561,7 @@ static bool invoke(obj_string_t *name, int argc) {
     obj_instance_t *instance = AS_INSTANCE(receiver);
 
     value_t value;
-    if (table_get(&instance->fields, name, &value)) {
+    if (instance_get_field(instance, name, &value)) {
       vm.stack_top[-argc - 1] = value;
       return call_value(value, argc);
     }
@@ -558,7 +571,7 @@ static bool invoke(obj_string_t *name, int argc) {
     obj_module_t *moduele = AS_MODULE(receiver);
 
     value_t value;
-    if (table_get(&moduele->globals, name, &value)) {
+    if (globals_get(&moduele->globals, name, &value)) {
       vm.stack_top[-argc - 1] = value;
       return call_value(value, argc);
     }
@@ -591,6 +604,168 @@ static bool bind_method(obj_class_t *clas, obj_string_t *name) {
   return true;
 }
 
+static inline_cache_entry_t *cache_lookup(inline_cache_t *cache,
+                                          shape_t *shape) {
+  if (cache->epoch != vm.method_epoch)
+    return NULL;
+
+  for (int i = 0; i < INLINE_CACHE_WAYS; i++)
+    if (cache->entries[i].shape == shape)
+      return &cache->entries[i];
+  return NULL;
+}
+
+// Returns the entry for shape, claiming a free way for it if needed. Once all
+// ways are taken the oldest entry is evicted
+static inline_cache_entry_t *cache_insert(inline_cache_t *cache,
+                                          shape_t *shape) {
+  inline_cache_entry_t *entries = cache->entries;
+  if (cache->epoch != vm.method_epoch) {
+    memset(entries, 0, sizeof(cache->entries));
+    cache->epoch = vm.method_epoch;
+  }
+
+  int i = 0;
+  while (i < INLINE_CACHE_WAYS - 1 && entries[i].shape != NULL &&
+         entries[i].shape != shape)
+    i++;
+
+  if (entries[i].shape != shape) {
+    memmove(&entries[1], &entries[0], i * sizeof(inline_cache_entry_t));
+    entries[0].shape = shape;
+    entries[0].slot = -1;
+    entries[0].transition = NULL;
+    entries[0].method = NULL;
+    i = 0;
+  }
+  return &entries[i];
+}
+
+static bool get_property(obj_string_t *name, inline_cache_t *cache) {
+  value_t object = peek(0);
+  if (!IS_INSTANCE(object)) {
+    runtime_error(vm.offset, "Only instances have properties");
+    return false;
+  }
+
+  obj_instance_t *instance = AS_INSTANCE(object);
+  shape_t *shape = instance->shape;
+
+  // Dictionary mode instances are never cached
+  if (shape == NULL) {
+    value_t value;
+    if (table_get(instance->fields, name, &value)) {
+      vm.stack_top[-1] = value;
+      return true;
+    }
+    return bind_method(instance->clas, name);
+  }
+
+  inline_cache_entry_t *entry = cache_lookup(cache, shape);
+  if (entry == NULL) {
+    int slot = shape_find(shape, name);
+    value_t method = NIL_VAL;
+    if (slot < 0 && !table_get(&instance->clas->methods, name, &method)) {
+      runtime_error(vm.offset, "Undefined property '%s'", name->chars);
+      return false;
+    }
+
+    entry = cache_insert(cache, shape);
+    entry->slot = slot;
+    entry->method = slot < 0 ? AS_CLOSURE(method) : NULL;
+  }
+
+  if (entry->slot >= 0)
+    vm.stack_top[-1] = instance->slots[entry->slot];
+  else {
+    obj_bound_method_t *bound = new_bound_method(peek(0), entry->method);
+    vm.stack_top[-1] = OBJ_VAL(bound);
+  }
+  return true;
+}
+
+static bool set_property(obj_string_t *name, inline_cache_t *cache) {
+  value_t object = peek(1);
+  if (!IS_INSTANCE(object)) {
+    runtime_error(vm.offset, "Only instances have fields");
+    return false;
+  }
+
+  obj_instance_t *instance = AS_INSTANCE(object);
+  shape_t *shape = instance->shape;
+
+  inline_cache_entry_t *entry =
+      shape != NULL ? cache_lookup(cache, shape) : NULL;
+  if (entry != NULL) {
+    if (entry->transition != NULL) {
+      instance_reserve_slots(instance, entry->transition->slot_count);
+      instance->shape = entry->transition;
+    }
+    instance->slots[entry->slot] = peek(0);
+    WRITE_BARRIER(instance);
+  } else {
+    instance_set_field(instance, name, peek(0));
+
+    // Only cache stores that left the instance in shape mode
+    if (shape != NULL && instance->shape != NULL) {
+      entry = cache_insert(cache, shape);
+      entry->slot = shape_find(instance->shape, name);
+      entry->transition = instance->shape != shape ? instance->shape : NULL;
+    }
+  }
+
+  value_t value = pop();
+  vm.stack_top[-1] = value;
+  return true;
+}
+
+static bool invoke_cached(obj_string_t *name, int argc,
+                          inline_cache_t *cache) {
+  value_t receiver = peek(argc);
+  if (!IS_INSTANCE(receiver) || AS_INSTANCE(receiver)->shape == NULL)
+    return invoke(name, argc);
+
+  obj_instance_t *instance = AS_INSTANCE(receiver);
+  inline_cache_entry_t *entry = cache_lookup(cache, instance->shape);
+  if (entry != NULL && entry->method != NULL)
+    return call(entry->method, argc);
+
+  // A field holding a callable shadows the method, leave that to invoke()
+  value_t method;
+  if (shape_find(instance->shape, name) >= 0 ||
+      !table_get(&instance->clas->methods, name, &method))
+    return invoke(name, argc);
+
+  cache_insert(cache, instance->shape)->method = AS_CLOSURE(method);
+  return call(AS_CLOSURE(method), argc);
+}
+
+static bool get_global(unsigned int slot) {
+  global_t *global = &vm.globals->values[slot];
+  if (!IS_UNDEFINED(global->value)) {
+    push(global->value);
+    return true;
+  }
+
+  value_t value;
+  if (!table_get(&vm.builtins, global->name, &value)) {
+    runtime_error(vm.offset, "Undefined variable '%s'", global->name->chars);
+    return false;
+  }
+  push(value);
+  return true;
+}
+
+static bool set_global(unsigned int slot) {
+  global_t *global = &vm.globals->values[slot];
+  if (IS_UNDEFINED(global->value)) {
+    runtime_error(vm.offset, "Undefined variable '%s'", global->name->chars);
+    return false;
+  }
+  global->value = peek(0);
+  return true;
+}
+
 static obj_upvalue_t *capture_upvalue(value_t *local) {
   obj_upvalue_t *prev_upvalue = NULL;
   obj_upvalue_t *upvalue = vm.open_upvalues;
@@ -618,6 +793,7 @@ static void close_upvalues(value_t *last) {
     obj_upvalue_t *upvalue = vm.open_upvalues;
     upvalue->closed = *upvalue->location;
     upvalue->location = &upvalue->closed;
+    WRITE_BARRIER(upvalue);
     vm.open_upvalues = upvalue->next;
   }
 }
@@ -626,6 +802,8 @@ static void define_method(obj_string_t *name) {
   value_t method = peek(0);
   obj_class_t *clas = AS_CLASS(peek(1));
   table_set(&clas->methods, name, method);
+  WRITE_BARRIER(clas);
+  vm.method_epoch++;
   pop();
 }
 
@@ -644,16 +822,11 @@ static bool is_falsey(value_t value) {
 }
 
 static void concatenate(void) {
-  obj_string_t *b = AS_STRING(peek(0));
-  obj_string_t *a = AS_STRING(peek(1));
+  // Long strings stay ropes, see concat_strings
+  obj_string_t *b = (obj_string_t *)AS_OBJ(peek(0));
+  obj_string_t *a = (obj_string_t *)AS_OBJ(peek(1));
 
-  int length = a->length + b->length;
-  char *chars = ALLOCATE(char, length + 1);
-  memcpy(chars, a->chars, a->length);
-  memcpy(chars + a->length, b->chars, b->length);
-  chars[length] = '\0';
-
-  obj_string_t *result = take_string(chars, length);
+  obj_string_t *result = concat_strings(a, b);
   pop();
   pop();
   push(OBJ_VAL(result));
@@ -666,8 +839,7 @@ static value_t get_index(value_t object, int index) {
       runtime_error(vm.offset, "String index '%d' out of bounds", index);
       return NIL_VAL;
     }
-    char c[2] = {string->chars[index], '\0'};
-    return OBJ_VAL(copy_string(c, 1, true));
+    return OBJ_VAL(vm.byte_strings[(uint8_t)string->chars[index]]);
   } else if (IS_VECTOR(object)) {
     obj_vector_t *vector = AS_VECTOR(object);
     if (index < 0 || index >= vector->count) {
@@ -703,6 +875,7 @@ static void set_index(value_t object, int index, value_t value) {
       return;
     }
     vector->values[index] = value;
+    WRITE_BARRIER_VALUES(vector, index, index + 1);
   } else if (IS_ARRAY(object)) {
     obj_array_t *array = AS_ARRAY(object);
     if (index < 0 || index >= array->count) {
@@ -710,225 +883,381 @@ static void set_index(value_t object, int index, value_t value) {
       return;
     }
     array->values[index] = value;
+    WRITE_BARRIER_VALUES(array, index, index + 1);
   } else {
     runtime_error(vm.offset, "Invalid index operation");
   }
 }
 
-static result_t run(void) {
+// Integer arithmetic is exact for the whole int64 range. A result that doesn't
+// fit is computed as a float instead, the same as for mixed operands
+static inline value_t add_numbers(int64_t a, int64_t b) {
+  int64_t result;
+  if (__builtin_add_overflow(a, b, &result))
+    return FLOAT_VAL((double)a + (double)b);
+  return NUMBER_VAL(result);
+}
+
+static inline value_t sub_numbers(int64_t a, int64_t b) {
+  int64_t result;
+  if (__builtin_sub_overflow(a, b, &result))
+    return FLOAT_VAL((double)a - (double)b);
+  return NUMBER_VAL(result);
+}
+
+static inline value_t mul_numbers(int64_t a, int64_t b) {
+  int64_t result;
+  if (__builtin_mul_overflow(a, b, &result))
+    return FLOAT_VAL((double)a * (double)b);
+  return NUMBER_VAL(result);
+}
+
+// Number of times a generic instruction has to see operand types it can be
+// specialized for before it is rewritten. Other types in between don't reset
+// the count, deoptimize() does
+#define QUICKEN_THRESHOLD 16
+
+// Called from a generic instruction handler (right after it has been fetched)
+// whenever its operands match a specialized variant
+static inline void quicken(call_frame_t *frame, op_code_t specialized) {
+  chunk_t *chunk = &frame->closure->function->chunk;
+  int offset = vm.offset - 1;
+  if (++chunk->feedback[offset] >= QUICKEN_THRESHOLD) {
+    chunk->code[offset] = specialized;
+    chunk->feedback[offset] = 0;
+  }
+}
+
+// Called from a specialized instruction handler whose guard failed. Rewrites
+// the instruction back to its generic form and rewinds so it is re-executed
+static inline void deoptimize(call_frame_t *frame, op_code_t generic) {
+  chunk_t *chunk = &frame->closure->function->chunk;
+  int offset = vm.offset - 1;
+  chunk->code[offset] = generic;
+  chunk->feedback[offset] = 0;
+  frame->ip--;
+}
+
+// Runs the top frame until the frame count drops back to base. Compiled code
+// calling back into the VM nests a loop with base above zero
+static result_t run(int base) {
   call_frame_t *frame = &vm.frames[vm.frame_count - 1];
 
 #define READ_BYTE() (*frame->ip++)
-#define READ_SHORT() (READ_BYTE() | (READ_BYTE() << 8))
-#define READ_LONG() (READ_BYTE() | (READ_BYTE() << 8) | (READ_BYTE() << 16))
+// The operand bytes are read after moving ip past them, so the order they are
+// combined in doesn't depend on the order the compiler evaluates them in
+#define READ_SHORT() (frame->ip += 2, frame->ip[-2] | (frame->ip[-1] << 8))
+#define READ_LONG()                                                            \
+  (frame->ip += 3,                                                             \
+   frame->ip[-3] | (frame->ip[-2] << 8) | (frame->ip[-1] << 16))
 #define READ_CONSTANT()                                                        \
   (frame->closure->function->chunk.constants.values[READ_BYTE()])
 #define READ_CONSTANT_LONG()                                                   \
   (frame->closure->function->chunk.constants.values[READ_LONG()])
 #define READ_STRING() AS_STRING(READ_CONSTANT())
 #define READ_STRING_LONG() AS_STRING(READ_CONSTANT_LONG())
+#define READ_CACHE()                                                           \
+  (frame->ip += 2, &frame->closure->function->chunk                           \
+                        .caches[frame->ip[-2] | (frame->ip[-1] << 8)])
 
 #define IS_NUM_OR_FLT(value) (IS_NUMBER(value) || IS_FLOAT(value))
 #define UPDATE_FRAME() frame = &vm.frames[vm.frame_count - 1]
 
-  if (vm.globals != NULL && frame->globals != NULL)
-    table_add_all(vm.globals, frame->globals);
+#ifdef JIT
+// Hands the top frame to compiled code where there is some for frame->ip
+#define JIT_RESUME()                                                           \
+  do {                                                                         \
+    if (vm.jit_enabled) {                                                      \
+      jit_resume(frame);                                                       \
+      UPDATE_FRAME();                                                          \
+      if (vm.signal != SIG_NONE)                                               \
+        goto check_signal;                                                     \
+    }                                                                          \
+  } while (0)
+#else
+#define JIT_RESUME() ((void)0)
+#endif
 
-  while (true) {
 #ifdef DECOMPILE
-    printf("     ");
-    for (value_t *slot = vm.stack; slot < vm.stack_top; slot++) {
-      printf("[ ");
-      print_value(*slot, true);
-      printf(" ]");
-    }
-    printf("\n");
-    disassemble_instruction(&frame->closure->function->chunk,
-                            frame->ip - frame->closure->function->chunk.code);
+#define TRACE_INSTRUCTION()                                                    \
+  do {                                                                         \
+    printf("     ");                                                           \
+    for (value_t *slot = vm.stack; slot < vm.stack_top; slot++) {              \
+      printf("[ ");                                                            \
+      print_value(stdout, *slot, true);                                        \
+      printf(" ]");                                                            \
+    }                                                                          \
+    printf("\n");                                                              \
+    disassemble_instruction(&frame->closure->function->chunk,                  \
+                            frame->ip - frame->closure->function->chunk.code); \
+  } while (0)
+#else
+#define TRACE_INSTRUCTION() ((void)0)
 #endif
-    op_code_t op = READ_BYTE();
-    vm.offset = (int)(frame->ip - frame->closure->function->chunk.code);
-
-    // table_t *globals = frame->globals;
-    vm.globals = frame->globals;
-    if (vm.globals == NULL) {
-      runtime_error(vm.offset, "No globals table found");
-      return RESULT_RUNTIME_ERROR;
-    }
 
-    switch (op) {
-    case OP_CONSTANT:
+#ifdef COUNT_INSTRUCTIONS
+#define COUNT_INSTRUCTION() (vm.instruction_count++)
+#else
+#define COUNT_INSTRUCTION() ((void)0)
+#endif
+
+#define FETCH()                                                                \
+  do {                                                                         \
+    TRACE_INSTRUCTION();                                                       \
+    COUNT_INSTRUCTION();                                                       \
+    op = READ_BYTE();                                                          \
+    vm.offset = (int)(frame->ip - frame->closure->function->chunk.code);       \
+    vm.globals = frame->globals;                                               \
+    if (vm.globals == NULL) {                                                  \
+      runtime_error(vm.offset, "No globals table found");                      \
+      return RESULT_RUNTIME_ERROR;                                             \
+    }                                                                          \
+  } while (0)
+
+#ifdef USE_COMPUTED_GOTO
+  // Every handler ends in its own indirect jump, so the branch predictor gets
+  // one history per opcode instead of sharing the single switch jump. Labels
+  // as values are a GNU extension, -Wpedantic would flag every handler
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+  static void *dispatch_table[] = {
+      [OP_CONSTANT] = &&DO_OP_CONSTANT,
+      [OP_CONSTANT_LONG] = &&DO_OP_CONSTANT_LONG,
+      [OP_DEFINE_GLOBAL] = &&DO_OP_DEFINE_GLOBAL,
+      [OP_DEFINE_GLOBAL_LONG] = &&DO_OP_DEFINE_GLOBAL_LONG,
+      [OP_GET_GLOBAL] = &&DO_OP_GET_GLOBAL,
+      [OP_GET_GLOBAL_LONG] = &&DO_OP_GET_GLOBAL_LONG,
+      [OP_SET_GLOBAL] = &&DO_OP_SET_GLOBAL,
+      [OP_SET_GLOBAL_LONG] = &&DO_OP_SET_GLOBAL_LONG,
+      [OP_GET_LOCAL] = &&DO_OP_GET_LOCAL,
+      [OP_GET_LOCAL_LONG] = &&DO_OP_GET_LOCAL_LONG,
+      [OP_SET_LOCAL] = &&DO_OP_SET_LOCAL,
+      [OP_SET_LOCAL_LONG] = &&DO_OP_SET_LOCAL_LONG,
+      [OP_GET_UPVALUE] = &&DO_OP_GET_UPVALUE,
+      [OP_GET_UPVALUE_LONG] = &&DO_OP_GET_UPVALUE_LONG,
+      [OP_SET_UPVALUE] = &&DO_OP_SET_UPVALUE,
+      [OP_SET_UPVALUE_LONG] = &&DO_OP_SET_UPVALUE_LONG,
+      [OP_GET_SUPER] = &&DO_OP_GET_SUPER,
+      [OP_GET_SUPER_LONG] = &&DO_OP_GET_SUPER_LONG,
+      [OP_GET_PROPERTY] = &&DO_OP_GET_PROPERTY,
+      [OP_GET_PROPERTY_LONG] = &&DO_OP_GET_PROPERTY_LONG,
+      [OP_SET_PROPERTY] = &&DO_OP_SET_PROPERTY,
+      [OP_SET_PROPERTY_LONG] = &&DO_OP_SET_PROPERTY_LONG,
+      [OP_GET_ACCESS] = &&DO_OP_GET_ACCESS,
+      [OP_GET_ACCESS_LONG] = &&DO_OP_GET_ACCESS_LONG,
+      [OP_GET_INDEX] = &&DO_OP_GET_INDEX,
+      [OP_SET_INDEX] = &&DO_OP_SET_INDEX,
+      [OP_INVOKE] = &&DO_OP_INVOKE,
+      [OP_INVOKE_LONG] = &&DO_OP_INVOKE_LONG,
+      [OP_INVOKE_ACCESS] = &&DO_OP_INVOKE_ACCESS,
+      [OP_INVOKE_ACCESS_LONG] = &&DO_OP_INVOKE_ACCESS_LONG,
+      [OP_SUPER_INVOKE] = &&DO_OP_SUPER_INVOKE,
+      [OP_SUPER_INVOKE_LONG] = &&DO_OP_SUPER_INVOKE_LONG,
+      [OP_VECTOR] = &&DO_OP_VECTOR,
+      [OP_VECTOR_LONG] = &&DO_OP_VECTOR_LONG,
+      [OP_LIST] = &&DO_OP_LIST,
+      [OP_LIST_LONG] = &&DO_OP_LIST_LONG,
+      [OP_CLASS] = &&DO_OP_CLASS,
+      [OP_CLASS_LONG] = &&DO_OP_CLASS_LONG,
+      [OP_ENUM] = &&DO_OP_ENUM,
+      [OP_ENUM_LONG] = &&DO_OP_ENUM_LONG,
+      [OP_CLOSURE] = &&DO_OP_CLOSURE,
+      [OP_CLOSURE_LONG] = &&DO_OP_CLOSURE_LONG,
+      [OP_METHOD] = &&DO_OP_METHOD,
+      [OP_METHOD_LONG] = &&DO_OP_METHOD_LONG,
+      [OP_ENUM_VALUE] = &&DO_OP_ENUM_VALUE,
+      [OP_ENUM_VALUE_LONG] = &&DO_OP_ENUM_VALUE_LONG,
+      [OP_ENUM_VALUE_CUSTOM] = &&DO_OP_ENUM_VALUE_CUSTOM,
+      [OP_ENUM_VALUE_CUSTOM_LONG] = &&DO_OP_ENUM_VALUE_CUSTOM_LONG,
+      [OP_TRUE] = &&DO_OP_TRUE,
+      [OP_FALSE] = &&DO_OP_FALSE,
+      [OP_NIL] = &&DO_OP_NIL,
+      [OP_POP] = &&DO_OP_POP,
+      [OP_SPREAD] = &&DO_OP_SPREAD,
+      [OP_RANGE] = &&DO_OP_RANGE,
+      [OP_ADD] = &&DO_OP_ADD,
+      [OP_SUB] = &&DO_OP_SUB,
+      [OP_MUL] = &&DO_OP_MUL,
+      [OP_DIV] = &&DO_OP_DIV,
+      [OP_MOD] = &&DO_OP_MOD,
+      [OP_SHIFTL] = &&DO_OP_SHIFTL,
+      [OP_SHIFTR] = &&DO_OP_SHIFTR,
+      [OP_BIT_AND] = &&DO_OP_BIT_AND,
+      [OP_BIT_OR] = &&DO_OP_BIT_OR,
+      [OP_XOR] = &&DO_OP_XOR,
+      [OP_EQ] = &&DO_OP_EQ,
+      [OP_GT] = &&DO_OP_GT,
+      [OP_GE] = &&DO_OP_GE,
+      [OP_LT] = &&DO_OP_LT,
+      [OP_LE] = &&DO_OP_LE,
+      [OP_NEG] = &&DO_OP_NEG,
+      [OP_LOG_NOT] = &&DO_OP_LOG_NOT,
+      [OP_BIT_NOT] = &&DO_OP_BIT_NOT,
+      [OP_CLOSE_UPVALUE] = &&DO_OP_CLOSE_UPVALUE,
+      [OP_INHERIT] = &&DO_OP_INHERIT,
+      [OP_ASSERT] = &&DO_OP_ASSERT,
+      [OP_ASSERT_MSG] = &&DO_OP_ASSERT_MSG,
+      [OP_CALL] = &&DO_OP_CALL,
+      [OP_CALL_BUILTIN] = &&DO_OP_CALL_BUILTIN,
+      [OP_LOOP] = &&DO_OP_LOOP,
+      [OP_JUMP] = &&DO_OP_JUMP,
+      [OP_JUMP_IF_FALSE] = &&DO_OP_JUMP_IF_FALSE,
+      [OP_RETURN] = &&DO_OP_RETURN,
+      [OP_ADD_NUM_NUM] = &&DO_OP_ADD_NUM_NUM,
+      [OP_ADD_FLT_FLT] = &&DO_OP_ADD_FLT_FLT,
+      [OP_SUB_NUM_NUM] = &&DO_OP_SUB_NUM_NUM,
+      [OP_SUB_FLT_FLT] = &&DO_OP_SUB_FLT_FLT,
+      [OP_MUL_NUM_NUM] = &&DO_OP_MUL_NUM_NUM,
+      [OP_MUL_FLT_FLT] = &&DO_OP_MUL_FLT_FLT,
+      [OP_GT_NUM_NUM] = &&DO_OP_GT_NUM_NUM,
+      [OP_GT_FLT_FLT] = &&DO_OP_GT_FLT_FLT,
+      [OP_GE_NUM_NUM] = &&DO_OP_GE_NUM_NUM,
+      [OP_GE_FLT_FLT] = &&DO_OP_GE_FLT_FLT,
+      [OP_LT_NUM_NUM] = &&DO_OP_LT_NUM_NUM,
+      [OP_LT_FLT_FLT] = &&DO_OP_LT_FLT_FLT,
+      [OP_LE_NUM_NUM] = &&DO_OP_LE_NUM_NUM,
+      [OP_LE_FLT_FLT] = &&DO_OP_LE_FLT_FLT,
+      [OP_GET_INDEX_VEC_NUM] = &&DO_OP_GET_INDEX_VEC_NUM,
+      [OP_GET_INDEX_LIST_NUM] = &&DO_OP_GET_INDEX_LIST_NUM,
+      [OP_GET_INDEX_ARRAY_NUM] = &&DO_OP_GET_INDEX_ARRAY_NUM,
+      [OP_SET_INDEX_VEC_NUM] = &&DO_OP_SET_INDEX_VEC_NUM,
+      [OP_SET_INDEX_ARRAY_NUM] = &&DO_OP_SET_INDEX_ARRAY_NUM,
+  };
+
+#define SWITCH(op) goto *dispatch_table[op];
+#define CASE(op) DO_##op
+#define DISPATCH()                                                             \
+  do {                                                                         \
+    if (vm.signal != SIG_NONE || vm.update_frame)                              \
+      goto check_signal;                                                       \
+    FETCH();                                                                   \
+    goto *dispatch_table[op];                                                  \
+  } while (0)
+#else
+#define SWITCH(op) switch (op)
+#define CASE(op) case op
+#define DISPATCH() break
+#endif
+
+  op_code_t op;
+
+  JIT_RESUME();
+
+  while (true) {
+    FETCH();
+
+    SWITCH(op) {
+    CASE(OP_CONSTANT):
       push(READ_CONSTANT());
-      break;
-    case OP_CONSTANT_LONG:
+      DISPATCH();
+    CASE(OP_CONSTANT_LONG):
       push(READ_CONSTANT_LONG());
-      break;
-    case OP_DEFINE_GLOBAL: {
-      obj_string_t *name = READ_STRING();
-      table_set(vm.globals, name, peek(0));
-      pop();
-    } break;
-    case OP_DEFINE_GLOBAL_LONG: {
-      obj_string_t *name = READ_STRING_LONG();
-      table_set(vm.globals, name, peek(0));
-      pop();
-    } break;
-    case OP_GET_GLOBAL: {
-      obj_string_t *name = READ_STRING();
-      value_t value;
-      if (!table_get(vm.globals, name, &value)) {
-        if (!table_get(&vm.builtins, name, &value)) {
-          runtime_error(vm.offset, "Undefined variable '%s'", name->chars);
-          return RESULT_RUNTIME_ERROR;
-        }
-      }
-      push(value);
-    } break;
-    case OP_GET_GLOBAL_LONG: {
-      obj_string_t *name = READ_STRING_LONG();
-      value_t value;
-      if (!table_get(vm.globals, name, &value)) {
-        if (!table_get(&vm.builtins, name, &value)) {
-          runtime_error(vm.offset, "Undefined variable '%s'", name->chars);
-          return RESULT_RUNTIME_ERROR;
-        }
-      }
-      push(value);
-    } break;
-    case OP_SET_GLOBAL: {
-      obj_string_t *name = READ_STRING();
-      if (table_set(vm.globals, name, peek(0))) {
-        table_delete(vm.globals, name);
-        runtime_error(vm.offset, "Undefined variable '%s'", name->chars);
+      DISPATCH();
+    CASE(OP_DEFINE_GLOBAL):
+      vm.globals->values[READ_BYTE()].value = pop();
+      DISPATCH();
+    CASE(OP_DEFINE_GLOBAL_LONG): {
+      unsigned int slot = READ_LONG();
+      vm.globals->values[slot].value = pop();
+    } DISPATCH();
+    CASE(OP_GET_GLOBAL):
+      if (!get_global(READ_BYTE()))
         return RESULT_RUNTIME_ERROR;
-      }
-    } break;
-    case OP_SET_GLOBAL_LONG: {
-      obj_string_t *name = READ_STRING_LONG();
-      if (table_set(vm.globals, name, peek(0))) {
-        table_delete(vm.globals, name);
-        runtime_error(vm.offset, "Undefined variable '%s'", name->chars);
+      DISPATCH();
+    CASE(OP_GET_GLOBAL_LONG): {
+      unsigned int slot = READ_LONG();
+      if (!get_global(slot))
         return RESULT_RUNTIME_ERROR;
-      }
-    } break;
-    case OP_GET_LOCAL: {
+    } DISPATCH();
+    CASE(OP_SET_GLOBAL):
+      if (!set_global(READ_BYTE()))
+        return RESULT_RUNTIME_ERROR;
+      DISPATCH();
+    CASE(OP_SET_GLOBAL_LONG): {
+      unsigned int slot = READ_LONG();
+      if (!set_global(slot))
+        return RESULT_RUNTIME_ERROR;
+    } DISPATCH();
+    CASE(OP_GET_LOCAL): {
       unsigned int slot = READ_BYTE();
       push(frame->slots[slot]);
-    } break;
-    case OP_GET_LOCAL_LONG: {
+    } DISPATCH();
+    CASE(OP_GET_LOCAL_LONG): {
       unsigned int slot = READ_LONG();
       push(frame->slots[slot]);
-    } break;
-    case OP_SET_LOCAL: {
+    } DISPATCH();
+    CASE(OP_SET_LOCAL): {
       unsigned int slot = READ_BYTE();
       frame->slots[slot] = peek(0);
-    } break;
-    case OP_SET_LOCAL_LONG: {
+    } DISPATCH();
+    CASE(OP_SET_LOCAL_LONG): {
       unsigned int slot = READ_LONG();
       frame->slots[slot] = peek(0);
-    } break;
-    case OP_GET_UPVALUE: {
+    } DISPATCH();
+    CASE(OP_GET_UPVALUE): {
       unsigned int slot = READ_BYTE();
       push(*frame->closure->upvalues[slot]->location);
-    } break;
-    case OP_GET_UPVALUE_LONG: {
+    } DISPATCH();
+    CASE(OP_GET_UPVALUE_LONG): {
       unsigned int slot = READ_LONG();
       push(*frame->closure->upvalues[slot]->location);
-    } break;
-    case OP_SET_UPVALUE: {
+    } DISPATCH();
+    CASE(OP_SET_UPVALUE): {
       unsigned int slot = READ_BYTE();
-      *frame->closure->upvalues[slot]->location = peek(0);
-    } break;
-    case OP_SET_UPVALUE_LONG: {
+      obj_upvalue_t *upvalue = frame->closure->upvalues[slot];
+      *upvalue->location = peek(0);
+      WRITE_BARRIER(upvalue);
+    } DISPATCH();
+    CASE(OP_SET_UPVALUE_LONG): {
       unsigned int slot = READ_LONG();
-      *frame->closure->upvalues[slot]->location = peek(0);
-    } break;
-    case OP_GET_SUPER: {
+      obj_upvalue_t *upvalue = frame->closure->upvalues[slot];
+      *upvalue->location = peek(0);
+      WRITE_BARRIER(upvalue);
+    } DISPATCH();
+    CASE(OP_GET_SUPER): {
       obj_string_t *name = READ_STRING();
       obj_class_t *super_class = AS_CLASS(pop());
 
       if (!bind_method(super_class, name))
         return RESULT_RUNTIME_ERROR;
-    } break;
-    case OP_GET_SUPER_LONG: {
+    } DISPATCH();
+    CASE(OP_GET_SUPER_LONG): {
       obj_string_t *name = READ_STRING_LONG();
       obj_class_t *super_class = AS_CLASS(pop());
 
       if (!bind_method(super_class, name))
         return RESULT_RUNTIME_ERROR;
-    } break;
-    case OP_GET_PROPERTY: {
-      if (!IS_INSTANCE(peek(0))) {
-        runtime_error(vm.offset, "Only instances have properties");
-        return RESULT_RUNTIME_ERROR;
-      }
-
-      obj_instance_t *instance = AS_INSTANCE(peek(0));
+    } DISPATCH();
+    CASE(OP_GET_PROPERTY): {
       obj_string_t *name = READ_STRING();
-
-      value_t value;
-      if (table_get(&instance->fields, name, &value)) {
-        pop();
-        push(value);
-        break;
-      }
-
-      if (!bind_method(instance->clas, name))
+      if (!get_property(name, READ_CACHE()))
         return RESULT_RUNTIME_ERROR;
-    } break;
-    case OP_GET_PROPERTY_LONG: {
-      if (!IS_INSTANCE(peek(0))) {
-        runtime_error(vm.offset, "Only instances have properties");
-        return RESULT_RUNTIME_ERROR;
-      }
-
-      obj_instance_t *instance = AS_INSTANCE(peek(0));
+    } DISPATCH();
+    CASE(OP_GET_PROPERTY_LONG): {
       obj_string_t *name = READ_STRING_LONG();
-
-      value_t value;
-      if (table_get(&instance->fields, name, &value)) {
-        pop();
-        push(value);
-        break;
-      }
-
-      if (!bind_method(instance->clas, name))
+      if (!get_property(name, READ_CACHE()))
         return RESULT_RUNTIME_ERROR;
-    } break;
-    case OP_SET_PROPERTY: {
-      if (!IS_INSTANCE(peek(1))) {
-        runtime_error(vm.offset, "Only instances have fields");
+    } DISPATCH();
+    CASE(OP_SET_PROPERTY): {
+      obj_string_t *name = READ_STRING();
+      if (!set_property(name, READ_CACHE()))
         return RESULT_RUNTIME_ERROR;
-      }
-
-      obj_instance_t *instance = AS_INSTANCE(peek(1));
-      table_set(&instance->fields, READ_STRING(), peek(0));
-      value_t value = pop();
-      pop();
-      push(value);
-    } break;
-    case OP_SET_PROPERTY_LONG: {
-      if (!IS_INSTANCE(peek(1))) {
-        runtime_error(vm.offset, "Only instances have fields");
+    } DISPATCH();
+    CASE(OP_SET_PROPERTY_LONG): {
+      obj_string_t *name = READ_STRING_LONG();
+      if (!set_property(name, READ_CACHE()))
         return RESULT_RUNTIME_ERROR;
-      }
-
-      obj_instance_t *instance = AS_INSTANCE(peek(1));
-      table_set(&instance->fields, READ_STRING_LONG(), peek(0));
-      value_t value = pop();
-      pop();
-      push(value);
-    } break;
-    case OP_GET_ACCESS: {
+    } DISPATCH();
+    CASE(OP_GET_ACCESS): {
       if (IS_MODULE(peek(0))) {
         obj_module_t *module = AS_MODULE(peek(0));
         obj_string_t *name = READ_STRING();
 
         value_t value;
-        if (table_get(&module->globals, name, &value)) {
+        if (globals_get(&module->globals, name, &value)) {
           pop();
           push(value);
-          break;
+          DISPATCH();
         }
 
         runtime_error(vm.offset, "Object does not have property '%s'",
@@ -951,17 +1280,17 @@ static result_t run(void) {
         runtime_error(vm.offset, "Only modules and enums have accessors");
         return RESULT_RUNTIME_ERROR;
       }
-    } break;
-    case OP_GET_ACCESS_LONG: {
+    } DISPATCH();
+    CASE(OP_GET_ACCESS_LONG): {
       if (IS_MODULE(peek(0))) {
         obj_module_t *module = AS_MODULE(peek(0));
         obj_string_t *name = READ_STRING_LONG();
 
         value_t value;
-        if (table_get(&module->globals, name, &value)) {
+        if (globals_get(&module->globals, name, &value)) {
           pop();
           push(value);
-          break;
+          DISPATCH();
         }
 
         runtime_error(vm.offset, "Object does not have property '%s'",
@@ -985,8 +1314,8 @@ static result_t run(void) {
         return RESULT_RUNTIME_ERROR;
       }
 
-    } break;
-    case OP_GET_INDEX: {
+    } DISPATCH();
+    CASE(OP_GET_INDEX): {
       value_t index = peek(0);
       value_t object = peek(1);
 
@@ -997,11 +1326,11 @@ static result_t run(void) {
           push(range->to);
           if (invoke_overload(VM_STR_OVERLOAD_GET_SLICE, 2)) {
             UPDATE_FRAME();
-            break;
+            DISPATCH();
           }
         } else if (invoke_overload(VM_STR_OVERLOAD_GET_INDEX, 1)) {
           UPDATE_FRAME();
-          break;
+          DISPATCH();
         }
       }
 
@@ -1011,13 +1340,20 @@ static result_t run(void) {
         return RESULT_RUNTIME_ERROR;
       }
 
+      if (IS_VECTOR(object))
+        quicken(frame, OP_GET_INDEX_VEC_NUM);
+      else if (IS_LIST(object))
+        quicken(frame, OP_GET_INDEX_LIST_NUM);
+      else if (IS_ARRAY(object))
+        quicken(frame, OP_GET_INDEX_ARRAY_NUM);
+
       value_t result = get_index(object, AS_NUMBER(index));
 
       pop();
       pop();
       push(result);
-    } break;
-    case OP_SET_INDEX: {
+    } DISPATCH();
+    CASE(OP_SET_INDEX): {
       value_t value = peek(0);
       value_t index = peek(1);
       value_t object = peek(2);
@@ -1031,11 +1367,11 @@ static result_t run(void) {
           push(value);
           if (invoke_overload(VM_STR_OVERLOAD_SET_SLICE, 3)) {
             UPDATE_FRAME();
-            break;
+            DISPATCH();
           }
         } else if (invoke_overload(VM_STR_OVERLOAD_SET_INDEX, 2)) {
           UPDATE_FRAME();
-          break;
+          DISPATCH();
         }
       }
 
@@ -1045,16 +1381,22 @@ static result_t run(void) {
         return RESULT_RUNTIME_ERROR;
       }
 
+      if (IS_VECTOR(object))
+        quicken(frame, OP_SET_INDEX_VEC_NUM);
+      else if (IS_ARRAY(object))
+        quicken(frame, OP_SET_INDEX_ARRAY_NUM);
+
       set_index(object, AS_NUMBER(index), value);
 
       pop();
       pop();
       pop();
       push(value);
-    } break;
-    case OP_INVOKE: {
+    } DISPATCH();
+    CASE(OP_INVOKE): {
       obj_string_t *method = READ_STRING();
       unsigned int argc = READ_BYTE();
+      inline_cache_t *cache = READ_CACHE();
 
       value_t receiver = peek(argc);
       if (!IS_INSTANCE(receiver) && !IS_RESULT(receiver)) {
@@ -1062,13 +1404,15 @@ static result_t run(void) {
         return RESULT_RUNTIME_ERROR;
       }
 
-      if (!invoke(method, argc))
+      if (!invoke_cached(method, argc, cache))
         return RESULT_RUNTIME_ERROR;
       UPDATE_FRAME();
-    } break;
-    case OP_INVOKE_LONG: {
+      JIT_RESUME();
+    } DISPATCH();
+    CASE(OP_INVOKE_LONG): {
       obj_string_t *method = READ_STRING_LONG();
       unsigned int argc = READ_BYTE();
+      inline_cache_t *cache = READ_CACHE();
 
       value_t receiver = peek(argc);
       if (!IS_INSTANCE(receiver) && !IS_RESULT(receiver)) {
@@ -1076,11 +1420,12 @@ static result_t run(void) {
         return RESULT_RUNTIME_ERROR;
       }
 
-      if (!invoke(method, argc))
+      if (!invoke_cached(method, argc, cache))
         return RESULT_RUNTIME_ERROR;
       UPDATE_FRAME();
-    } break;
-    case OP_INVOKE_ACCESS: {
+      JIT_RESUME();
+    } DISPATCH();
+    CASE(OP_INVOKE_ACCESS): {
       obj_string_t *method = READ_STRING();
       unsigned int argc = READ_BYTE();
 
@@ -1093,8 +1438,8 @@ static result_t run(void) {
       if (!invoke(method, argc))
         return RESULT_RUNTIME_ERROR;
       UPDATE_FRAME();
-    } break;
-    case OP_INVOKE_ACCESS_LONG: {
+    } DISPATCH();
+    CASE(OP_INVOKE_ACCESS_LONG): {
       obj_string_t *method = READ_STRING_LONG();
       unsigned int argc = READ_BYTE();
 
@@ -1107,66 +1452,66 @@ static result_t run(void) {
       if (!invoke(method, argc))
         return RESULT_RUNTIME_ERROR;
       UPDATE_FRAME();
-    } break;
-    case OP_SUPER_INVOKE: {
+    } DISPATCH();
+    CASE(OP_SUPER_INVOKE): {
       obj_string_t *method = READ_STRING();
       unsigned int argc = READ_BYTE();
       obj_class_t *super_class = AS_CLASS(pop());
       if (!invoke_from_class(super_class, method, argc))
         return RESULT_RUNTIME_ERROR;
       UPDATE_FRAME();
-    } break;
-    case OP_SUPER_INVOKE_LONG: {
+    } DISPATCH();
+    CASE(OP_SUPER_INVOKE_LONG): {
       obj_string_t *method = READ_STRING_LONG();
       unsigned int argc = READ_BYTE();
       obj_class_t *super_class = AS_CLASS(pop());
       if (!invoke_from_class(super_class, method, argc))
         return RESULT_RUNTIME_ERROR;
       UPDATE_FRAME();
-    } break;
-    case OP_VECTOR: {
+    } DISPATCH();
+    CASE(OP_VECTOR): {
       unsigned int size = READ_BYTE();
       obj_vector_t *vector = new_vector(size);
       vector->count = size;
       for (int i = size - 1; i >= 0; i--)
         vector->values[i] = pop();
       push(OBJ_VAL(vector));
-    } break;
-    case OP_VECTOR_LONG: {
+    } DISPATCH();
+    CASE(OP_VECTOR_LONG): {
       unsigned int size = READ_LONG();
       obj_vector_t *vector = new_vector(size);
       vector->count = size;
       for (int i = size - 1; i >= 0; i--)
         vector->values[i] = pop();
       push(OBJ_VAL(vector));
-    } break;
-    case OP_LIST: {
+    } DISPATCH();
+    CASE(OP_LIST): {
       unsigned int size = READ_BYTE();
       obj_list_t *list = new_list(size);
       for (int i = size - 1; i >= 0; i--)
         list->values[i] = pop();
       push(OBJ_VAL(list));
-    } break;
-    case OP_LIST_LONG: {
+    } DISPATCH();
+    CASE(OP_LIST_LONG): {
       unsigned int size = READ_LONG();
       obj_list_t *list = new_list(size);
       for (int i = size - 1; i >= 0; i--)
         list->values[i] = pop();
       push(OBJ_VAL(list));
-    } break;
-    case OP_CLASS:
+    } DISPATCH();
+    CASE(OP_CLASS):
       push(OBJ_VAL(new_class(READ_STRING())));
-      break;
-    case OP_CLASS_LONG:
+      DISPATCH();
+    CASE(OP_CLASS_LONG):
       push(OBJ_VAL(new_class(READ_STRING_LONG())));
-      break;
-    case OP_ENUM:
+      DISPATCH();
+    CASE(OP_ENUM):
       push(OBJ_VAL(new_enum(READ_STRING())));
-      break;
-    case OP_ENUM_LONG:
+      DISPATCH();
+    CASE(OP_ENUM_LONG):
       push(OBJ_VAL(new_enum(READ_STRING_LONG())));
-      break;
-    case OP_CLOSURE: {
+      DISPATCH();
+    CASE(OP_CLOSURE): {
       obj_function_t *function = AS_FUNCTION(READ_CONSTANT());
       obj_closure_t *closure = new_closure(function);
       push(OBJ_VAL(closure));
@@ -1178,8 +1523,9 @@ static result_t run(void) {
         else
           closure->upvalues[i] = frame->closure->upvalues[index];
       }
-    } break;
-    case OP_CLOSURE_LONG: {
+      WRITE_BARRIER(closure);
+    } DISPATCH();
+    CASE(OP_CLOSURE_LONG): {
       obj_function_t *function = AS_FUNCTION(READ_CONSTANT_LONG());
       obj_closure_t *closure = new_closure(function);
       push(OBJ_VAL(closure));
@@ -1191,38 +1537,39 @@ static result_t run(void) {
         else
           closure->upvalues[i] = frame->closure->upvalues[index];
       }
-    } break;
-    case OP_METHOD:
+      WRITE_BARRIER(closure);
+    } DISPATCH();
+    CASE(OP_METHOD):
       define_method(READ_STRING());
-      break;
-    case OP_METHOD_LONG:
+      DISPATCH();
+    CASE(OP_METHOD_LONG):
       define_method(READ_STRING_LONG());
-      break;
-    case OP_ENUM_VALUE:
+      DISPATCH();
+    CASE(OP_ENUM_VALUE):
       define_enum_value(READ_STRING());
-      break;
-    case OP_ENUM_VALUE_LONG:
+      DISPATCH();
+    CASE(OP_ENUM_VALUE_LONG):
       define_enum_value(READ_STRING_LONG());
-      break;
-    case OP_ENUM_VALUE_CUSTOM:
+      DISPATCH();
+    CASE(OP_ENUM_VALUE_CUSTOM):
       define_enum_value_custom(READ_STRING(), peek(0));
-      break;
-    case OP_ENUM_VALUE_CUSTOM_LONG:
+      DISPATCH();
+    CASE(OP_ENUM_VALUE_CUSTOM_LONG):
       define_enum_value_custom(READ_STRING_LONG(), peek(0));
-      break;
-    case OP_TRUE:
+      DISPATCH();
+    CASE(OP_TRUE):
       push(BOOL_VAL(true));
-      break;
-    case OP_FALSE:
+      DISPATCH();
+    CASE(OP_FALSE):
       push(BOOL_VAL(false));
-      break;
-    case OP_NIL:
+      DISPATCH();
+    CASE(OP_NIL):
       push(NIL_VAL);
-      break;
-    case OP_POP:
+      DISPATCH();
+    CASE(OP_POP):
       pop();
-      break;
-    case OP_SPREAD: {
+      DISPATCH();
+    CASE(OP_SPREAD): {
       if (IS_LIST(peek(0)))
         AS_LIST(peek(0))->spread = true;
       else if (IS_VECTOR(peek(0)))
@@ -1231,15 +1578,20 @@ static result_t run(void) {
         runtime_error(vm.offset, "Can spread only 'list' and 'vector'");
         return RESULT_RUNTIME_ERROR;
       }
-    } break;
-    case OP_RANGE: {
+    } DISPATCH();
+    CASE(OP_RANGE): {
       obj_range_t *range = new_range(peek(1), peek(0));
       pop();
       pop();
       push(OBJ_VAL(range));
-    } break;
-    case OP_ADD: {
-      if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+    } DISPATCH();
+    CASE(OP_ADD): {
+      if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
+        quicken(frame, OP_ADD_NUM_NUM);
+        int64_t b = AS_NUMBER(pop());
+        int64_t a = AS_NUMBER(peek(0));
+        vm.stack_top[-1] = add_numbers(a, b);
+      } else if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
         concatenate();
       } else if (IS_NUM_OR_FLT(peek(0)) && IS_NUM_OR_FLT(peek(1))) {
         value_t b = pop();
@@ -1248,10 +1600,9 @@ static result_t run(void) {
         double b_flt = IS_FLOAT(b) ? AS_FLOAT(b) : (double)AS_NUMBER(b);
         double a_flt = IS_FLOAT(a) ? AS_FLOAT(a) : (double)AS_NUMBER(a);
 
-        if (IS_NUMBER(a) && IS_NUMBER(b))
-          push(NUMBER_VAL((int64_t)(a_flt + b_flt)));
-        else
-          push(FLOAT_VAL(a_flt + b_flt));
+        if (IS_FLOAT(a) && IS_FLOAT(b))
+          quicken(frame, OP_ADD_FLT_FLT);
+        push(FLOAT_VAL(a_flt + b_flt));
       } else {
         if (invoke_overload(VM_STR_OVERLOAD_ADD, 1))
           UPDATE_FRAME();
@@ -1263,19 +1614,23 @@ static result_t run(void) {
           return RESULT_RUNTIME_ERROR;
         }
       }
-    } break;
-    case OP_SUB: {
-      if (IS_NUM_OR_FLT(peek(0)) && IS_NUM_OR_FLT(peek(1))) {
+    } DISPATCH();
+    CASE(OP_SUB): {
+      if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
+        quicken(frame, OP_SUB_NUM_NUM);
+        int64_t b = AS_NUMBER(pop());
+        int64_t a = AS_NUMBER(peek(0));
+        vm.stack_top[-1] = sub_numbers(a, b);
+      } else if (IS_NUM_OR_FLT(peek(0)) && IS_NUM_OR_FLT(peek(1))) {
         value_t b = pop();
         value_t a = pop();
 
         double b_flt = IS_FLOAT(b) ? AS_FLOAT(b) : (double)AS_NUMBER(b);
         double a_flt = IS_FLOAT(a) ? AS_FLOAT(a) : (double)AS_NUMBER(a);
 
-        if (IS_NUMBER(a) && IS_NUMBER(b))
-          push(NUMBER_VAL((int64_t)(a_flt - b_flt)));
-        else
-          push(FLOAT_VAL(a_flt - b_flt));
+        if (IS_FLOAT(a) && IS_FLOAT(b))
+          quicken(frame, OP_SUB_FLT_FLT);
+        push(FLOAT_VAL(a_flt - b_flt));
       } else {
         if (invoke_overload(VM_STR_OVERLOAD_SUB, 1))
           UPDATE_FRAME();
@@ -1286,19 +1641,23 @@ static result_t run(void) {
           return RESULT_RUNTIME_ERROR;
         }
       }
-    } break;
-    case OP_MUL: {
-      if (IS_NUM_OR_FLT(peek(0)) && IS_NUM_OR_FLT(peek(1))) {
+    } DISPATCH();
+    CASE(OP_MUL): {
+      if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
+        quicken(frame, OP_MUL_NUM_NUM);
+        int64_t b = AS_NUMBER(pop());
+        int64_t a = AS_NUMBER(peek(0));
+        vm.stack_top[-1] = mul_numbers(a, b);
+      } else if (IS_NUM_OR_FLT(peek(0)) && IS_NUM_OR_FLT(peek(1))) {
         value_t b = pop();
         value_t a = pop();
 
         double b_flt = IS_FLOAT(b) ? AS_FLOAT(b) : (double)AS_NUMBER(b);
         double a_flt = IS_FLOAT(a) ? AS_FLOAT(a) : (double)AS_NUMBER(a);
 
-        if (IS_NUMBER(a) && IS_NUMBER(b))
-          push(NUMBER_VAL((int64_t)(a_flt * b_flt)));
-        else
-          push(FLOAT_VAL(a_flt * b_flt));
+        if (IS_FLOAT(a) && IS_FLOAT(b))
+          quicken(frame, OP_MUL_FLT_FLT);
+        push(FLOAT_VAL(a_flt * b_flt));
       } else {
         if (invoke_overload(VM_STR_OVERLOAD_MUL, 1))
           UPDATE_FRAME();
@@ -1309,8 +1668,8 @@ static result_t run(void) {
           return RESULT_RUNTIME_ERROR;
         }
       }
-    } break;
-    case OP_DIV: {
+    } DISPATCH();
+    CASE(OP_DIV): {
       if (IS_NUM_OR_FLT(peek(0)) && IS_NUM_OR_FLT(peek(1))) {
         value_t b = pop();
         value_t a = pop();
@@ -1329,8 +1688,8 @@ static result_t run(void) {
           return RESULT_RUNTIME_ERROR;
         }
       }
-    } break;
-    case OP_MOD: {
+    } DISPATCH();
+    CASE(OP_MOD): {
       if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
         int64_t b = AS_NUMBER(pop());
         int64_t a = AS_NUMBER(pop());
@@ -1353,8 +1712,8 @@ static result_t run(void) {
           return RESULT_RUNTIME_ERROR;
         }
       }
-    } break;
-    case OP_SHIFTL: {
+    } DISPATCH();
+    CASE(OP_SHIFTL): {
       if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
         int64_t b = AS_NUMBER(pop());
         int64_t a = AS_NUMBER(pop());
@@ -1369,8 +1728,8 @@ static result_t run(void) {
           return RESULT_RUNTIME_ERROR;
         }
       }
-    } break;
-    case OP_SHIFTR: {
+    } DISPATCH();
+    CASE(OP_SHIFTR): {
       if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
         int64_t b = AS_NUMBER(pop());
         int64_t a = AS_NUMBER(pop());
@@ -1385,8 +1744,8 @@ static result_t run(void) {
           return RESULT_RUNTIME_ERROR;
         }
       }
-    } break;
-    case OP_BIT_AND: {
+    } DISPATCH();
+    CASE(OP_BIT_AND): {
       if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
         int64_t b = AS_NUMBER(pop());
         int64_t a = AS_NUMBER(pop());
@@ -1401,8 +1760,8 @@ static result_t run(void) {
           return RESULT_RUNTIME_ERROR;
         }
       }
-    } break;
-    case OP_BIT_OR: {
+    } DISPATCH();
+    CASE(OP_BIT_OR): {
       if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
         int64_t b = AS_NUMBER(pop());
         int64_t a = AS_NUMBER(pop());
@@ -1417,8 +1776,8 @@ static result_t run(void) {
           return RESULT_RUNTIME_ERROR;
         }
       }
-    } break;
-    case OP_XOR: {
+    } DISPATCH();
+    CASE(OP_XOR): {
       if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
         int64_t b = AS_NUMBER(pop());
         int64_t a = AS_NUMBER(pop());
@@ -1433,30 +1792,37 @@ static result_t run(void) {
           return RESULT_RUNTIME_ERROR;
         }
       }
-    } break;
-    case OP_EQ: {
+    } DISPATCH();
+    CASE(OP_EQ): {
       value_t b = peek(0);
       value_t a = peek(1);
 
       if (IS_INSTANCE(a)) {
         if (invoke_overload(VM_STR_OVERLOAD_EQ, 1)) {
           UPDATE_FRAME();
-          break;
+          DISPATCH();
         }
       }
 
       pop();
       pop();
       push(BOOL_VAL(values_equal(a, b)));
-    } break;
-    case OP_GT: {
-      if (IS_NUM_OR_FLT(peek(0)) && IS_NUM_OR_FLT(peek(1))) {
+    } DISPATCH();
+    CASE(OP_GT): {
+      if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
+        quicken(frame, OP_GT_NUM_NUM);
+        int64_t b = AS_NUMBER(pop());
+        int64_t a = AS_NUMBER(peek(0));
+        vm.stack_top[-1] = BOOL_VAL(a > b);
+      } else if (IS_NUM_OR_FLT(peek(0)) && IS_NUM_OR_FLT(peek(1))) {
         value_t b = pop();
         value_t a = pop();
 
         double b_flt = IS_FLOAT(b) ? AS_FLOAT(b) : (double)AS_NUMBER(b);
         double a_flt = IS_FLOAT(a) ? AS_FLOAT(a) : (double)AS_NUMBER(a);
 
+        if (IS_FLOAT(a) && IS_FLOAT(b))
+          quicken(frame, OP_GT_FLT_FLT);
         push(BOOL_VAL(a_flt > b_flt));
       } else {
         if (invoke_overload(VM_STR_OVERLOAD_GT, 1))
@@ -1468,15 +1834,22 @@ static result_t run(void) {
           return RESULT_RUNTIME_ERROR;
         }
       }
-    } break;
-    case OP_GE: {
-      if (IS_NUM_OR_FLT(peek(0)) && IS_NUM_OR_FLT(peek(1))) {
+    } DISPATCH();
+    CASE(OP_GE): {
+      if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
+        quicken(frame, OP_GE_NUM_NUM);
+        int64_t b = AS_NUMBER(pop());
+        int64_t a = AS_NUMBER(peek(0));
+        vm.stack_top[-1] = BOOL_VAL(a >= b);
+      } else if (IS_NUM_OR_FLT(peek(0)) && IS_NUM_OR_FLT(peek(1))) {
         value_t b = pop();
         value_t a = pop();
 
         double b_flt = IS_FLOAT(b) ? AS_FLOAT(b) : (double)AS_NUMBER(b);
         double a_flt = IS_FLOAT(a) ? AS_FLOAT(a) : (double)AS_NUMBER(a);
 
+        if (IS_FLOAT(a) && IS_FLOAT(b))
+          quicken(frame, OP_GE_FLT_FLT);
         push(BOOL_VAL(a_flt >= b_flt));
       } else {
         if (invoke_overload(VM_STR_OVERLOAD_GE, 1))
@@ -1488,15 +1861,22 @@ static result_t run(void) {
           return RESULT_RUNTIME_ERROR;
         }
       }
-    } break;
-    case OP_LT: {
-      if (IS_NUM_OR_FLT(peek(0)) && IS_NUM_OR_FLT(peek(1))) {
+    } DISPATCH();
+    CASE(OP_LT): {
+      if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
+        quicken(frame, OP_LT_NUM_NUM);
+        int64_t b = AS_NUMBER(pop());
+        int64_t a = AS_NUMBER(peek(0));
+        vm.stack_top[-1] = BOOL_VAL(a < b);
+      } else if (IS_NUM_OR_FLT(peek(0)) && IS_NUM_OR_FLT(peek(1))) {
         value_t b = pop();
         value_t a = pop();
 
         double b_flt = IS_FLOAT(b) ? AS_FLOAT(b) : (double)AS_NUMBER(b);
         double a_flt = IS_FLOAT(a) ? AS_FLOAT(a) : (double)AS_NUMBER(a);
 
+        if (IS_FLOAT(a) && IS_FLOAT(b))
+          quicken(frame, OP_LT_FLT_FLT);
         push(BOOL_VAL(a_flt < b_flt));
       } else {
         if (invoke_overload(VM_STR_OVERLOAD_LT, 1))
@@ -1508,15 +1888,22 @@ static result_t run(void) {
           return RESULT_RUNTIME_ERROR;
         }
       }
-    } break;
-    case OP_LE: {
-      if (IS_NUM_OR_FLT(peek(0)) && IS_NUM_OR_FLT(peek(1))) {
+    } DISPATCH();
+    CASE(OP_LE): {
+      if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
+        quicken(frame, OP_LE_NUM_NUM);
+        int64_t b = AS_NUMBER(pop());
+        int64_t a = AS_NUMBER(peek(0));
+        vm.stack_top[-1] = BOOL_VAL(a <= b);
+      } else if (IS_NUM_OR_FLT(peek(0)) && IS_NUM_OR_FLT(peek(1))) {
         value_t b = pop();
         value_t a = pop();
 
         double b_flt = IS_FLOAT(b) ? AS_FLOAT(b) : (double)AS_NUMBER(b);
         double a_flt = IS_FLOAT(a) ? AS_FLOAT(a) : (double)AS_NUMBER(a);
 
+        if (IS_FLOAT(a) && IS_FLOAT(b))
+          quicken(frame, OP_LE_FLT_FLT);
         push(BOOL_VAL(a_flt <= b_flt));
       } else {
         if (invoke_overload(VM_STR_OVERLOAD_LE, 1))
@@ -1528,13 +1915,226 @@ static result_t run(void) {
           return RESULT_RUNTIME_ERROR;
         }
       }
-    } break;
-    case OP_NEG: {
+    } DISPATCH();
+    // Quickened instructions, see quicken() and deoptimize()
+    CASE(OP_ADD_NUM_NUM): {
+      if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+        deoptimize(frame, OP_ADD);
+        DISPATCH();
+      }
+      int64_t b = AS_NUMBER(pop());
+      int64_t a = AS_NUMBER(peek(0));
+      vm.stack_top[-1] = add_numbers(a, b);
+    } DISPATCH();
+    CASE(OP_ADD_FLT_FLT): {
+      if (!IS_FLOAT(peek(0)) || !IS_FLOAT(peek(1))) {
+        deoptimize(frame, OP_ADD);
+        DISPATCH();
+      }
+      double b = AS_FLOAT(pop());
+      double a = AS_FLOAT(peek(0));
+      vm.stack_top[-1] = FLOAT_VAL(a + b);
+    } DISPATCH();
+    CASE(OP_SUB_NUM_NUM): {
+      if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+        deoptimize(frame, OP_SUB);
+        DISPATCH();
+      }
+      int64_t b = AS_NUMBER(pop());
+      int64_t a = AS_NUMBER(peek(0));
+      vm.stack_top[-1] = sub_numbers(a, b);
+    } DISPATCH();
+    CASE(OP_SUB_FLT_FLT): {
+      if (!IS_FLOAT(peek(0)) || !IS_FLOAT(peek(1))) {
+        deoptimize(frame, OP_SUB);
+        DISPATCH();
+      }
+      double b = AS_FLOAT(pop());
+      double a = AS_FLOAT(peek(0));
+      vm.stack_top[-1] = FLOAT_VAL(a - b);
+    } DISPATCH();
+    CASE(OP_MUL_NUM_NUM): {
+      if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+        deoptimize(frame, OP_MUL);
+        DISPATCH();
+      }
+      int64_t b = AS_NUMBER(pop());
+      int64_t a = AS_NUMBER(peek(0));
+      vm.stack_top[-1] = mul_numbers(a, b);
+    } DISPATCH();
+    CASE(OP_MUL_FLT_FLT): {
+      if (!IS_FLOAT(peek(0)) || !IS_FLOAT(peek(1))) {
+        deoptimize(frame, OP_MUL);
+        DISPATCH();
+      }
+      double b = AS_FLOAT(pop());
+      double a = AS_FLOAT(peek(0));
+      vm.stack_top[-1] = FLOAT_VAL(a * b);
+    } DISPATCH();
+    CASE(OP_GT_NUM_NUM): {
+      if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+        deoptimize(frame, OP_GT);
+        DISPATCH();
+      }
+      int64_t b = AS_NUMBER(pop());
+      int64_t a = AS_NUMBER(peek(0));
+      vm.stack_top[-1] = BOOL_VAL(a > b);
+    } DISPATCH();
+    CASE(OP_GT_FLT_FLT): {
+      if (!IS_FLOAT(peek(0)) || !IS_FLOAT(peek(1))) {
+        deoptimize(frame, OP_GT);
+        DISPATCH();
+      }
+      double b = AS_FLOAT(pop());
+      double a = AS_FLOAT(peek(0));
+      vm.stack_top[-1] = BOOL_VAL(a > b);
+    } DISPATCH();
+    CASE(OP_GE_NUM_NUM): {
+      if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+        deoptimize(frame, OP_GE);
+        DISPATCH();
+      }
+      int64_t b = AS_NUMBER(pop());
+      int64_t a = AS_NUMBER(peek(0));
+      vm.stack_top[-1] = BOOL_VAL(a >= b);
+    } DISPATCH();
+    CASE(OP_GE_FLT_FLT): {
+      if (!IS_FLOAT(peek(0)) || !IS_FLOAT(peek(1))) {
+        deoptimize(frame, OP_GE);
+        DISPATCH();
+      }
+      double b = AS_FLOAT(pop());
+      double a = AS_FLOAT(peek(0));
+      vm.stack_top[-1] = BOOL_VAL(a >= b);
+    } DISPATCH();
+    CASE(OP_LT_NUM_NUM): {
+      if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+        deoptimize(frame, OP_LT);
+        DISPATCH();
+      }
+      int64_t b = AS_NUMBER(pop());
+      int64_t a = AS_NUMBER(peek(0));
+      vm.stack_top[-1] = BOOL_VAL(a < b);
+    } DISPATCH();
+    CASE(OP_LT_FLT_FLT): {
+      if (!IS_FLOAT(peek(0)) || !IS_FLOAT(peek(1))) {
+        deoptimize(frame, OP_LT);
+        DISPATCH();
+      }
+      double b = AS_FLOAT(pop());
+      double a = AS_FLOAT(peek(0));
+      vm.stack_top[-1] = BOOL_VAL(a < b);
+    } DISPATCH();
+    CASE(OP_LE_NUM_NUM): {
+      if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+        deoptimize(frame, OP_LE);
+        DISPATCH();
+      }
+      int64_t b = AS_NUMBER(pop());
+      int64_t a = AS_NUMBER(peek(0));
+      vm.stack_top[-1] = BOOL_VAL(a <= b);
+    } DISPATCH();
+    CASE(OP_LE_FLT_FLT): {
+      if (!IS_FLOAT(peek(0)) || !IS_FLOAT(peek(1))) {
+        deoptimize(frame, OP_LE);
+        DISPATCH();
+      }
+      double b = AS_FLOAT(pop());
+      double a = AS_FLOAT(peek(0));
+      vm.stack_top[-1] = BOOL_VAL(a <= b);
+    } DISPATCH();
+    CASE(OP_GET_INDEX_VEC_NUM): {
+      value_t position = peek(0);
+      value_t object = peek(1);
+      if (!IS_NUMBER(position) || !IS_VECTOR(object)) {
+        deoptimize(frame, OP_GET_INDEX);
+        DISPATCH();
+      }
+      int index = AS_NUMBER(position);
+      obj_vector_t *vector = AS_VECTOR(object);
+      if (index < 0 || index >= vector->count) {
+        runtime_error(vm.offset, "Vector index '%d' out of bounds", index);
+        return RESULT_RUNTIME_ERROR;
+      }
+      pop();
+      vm.stack_top[-1] = vector->values[index];
+    } DISPATCH();
+    CASE(OP_GET_INDEX_LIST_NUM): {
+      value_t position = peek(0);
+      value_t object = peek(1);
+      if (!IS_NUMBER(position) || !IS_LIST(object)) {
+        deoptimize(frame, OP_GET_INDEX);
+        DISPATCH();
+      }
+      int index = AS_NUMBER(position);
+      obj_list_t *list = AS_LIST(object);
+      if (index < 0 || index >= list->count) {
+        runtime_error(vm.offset, "List index '%d' out of bounds", index);
+        return RESULT_RUNTIME_ERROR;
+      }
+      pop();
+      vm.stack_top[-1] = list->values[index];
+    } DISPATCH();
+    CASE(OP_GET_INDEX_ARRAY_NUM): {
+      value_t position = peek(0);
+      value_t object = peek(1);
+      if (!IS_NUMBER(position) || !IS_ARRAY(object)) {
+        deoptimize(frame, OP_GET_INDEX);
+        DISPATCH();
+      }
+      int index = AS_NUMBER(position);
+      obj_array_t *array = AS_ARRAY(object);
+      if (index < 0 || index >= array->count) {
+        runtime_error(vm.offset, "Array index '%d' out of bounds", index);
+        return RESULT_RUNTIME_ERROR;
+      }
+      pop();
+      vm.stack_top[-1] = array->values[index];
+    } DISPATCH();
+    CASE(OP_SET_INDEX_VEC_NUM): {
+      value_t position = peek(1);
+      value_t object = peek(2);
+      if (!IS_NUMBER(position) || !IS_VECTOR(object)) {
+        deoptimize(frame, OP_SET_INDEX);
+        DISPATCH();
+      }
+      int index = AS_NUMBER(position);
+      obj_vector_t *vector = AS_VECTOR(object);
+      if (index < 0 || index >= vector->count) {
+        runtime_error(vm.offset, "Vector index '%d' out of bounds", index);
+        return RESULT_RUNTIME_ERROR;
+      }
+      value_t value = pop();
+      vector->values[index] = value;
+      WRITE_BARRIER_VALUES(vector, index, index + 1);
+      pop();
+      vm.stack_top[-1] = value;
+    } DISPATCH();
+    CASE(OP_SET_INDEX_ARRAY_NUM): {
+      value_t position = peek(1);
+      value_t object = peek(2);
+      if (!IS_NUMBER(position) || !IS_ARRAY(object)) {
+        deoptimize(frame, OP_SET_INDEX);
+        DISPATCH();
+      }
+      int index = AS_NUMBER(position);
+      obj_array_t *array = AS_ARRAY(object);
+      if (index < 0 || index >= array->count) {
+        runtime_error(vm.offset, "Array index '%d' out of bounds", index);
+        return RESULT_RUNTIME_ERROR;
+      }
+      value_t value = pop();
+      array->values[index] = value;
+      WRITE_BARRIER_VALUES(array, index, index + 1);
+      pop();
+      vm.stack_top[-1] = value;
+    } DISPATCH();
+    CASE(OP_NEG): {
       if (!IS_NUM_OR_FLT(peek(0))) {
         if (IS_INSTANCE(peek(0))) {
           if (invoke_overload(VM_STR_OVERLOAD_NEG, 0)) {
             UPDATE_FRAME();
-            break;
+            DISPATCH();
           }
         }
         runtime_error(vm.offset,
@@ -1547,8 +2147,8 @@ static result_t run(void) {
         push(NUMBER_VAL(-AS_NUMBER(pop())));
       else
         push(FLOAT_VAL(-AS_FLOAT(pop())));
-    } break;
-    case OP_LOG_NOT: {
+    } DISPATCH();
+    CASE(OP_LOG_NOT): {
       if (IS_NIL(peek(0)) || IS_BOOL(peek(0)))
         push(BOOL_VAL(is_falsey(pop())));
       else {
@@ -1561,8 +2161,8 @@ static result_t run(void) {
           return RESULT_RUNTIME_ERROR;
         }
       }
-    } break;
-    case OP_BIT_NOT: {
+    } DISPATCH();
+    CASE(OP_BIT_NOT): {
       if (IS_NUMBER(peek(0)))
         push(NUMBER_VAL(~AS_NUMBER(pop())));
       else {
@@ -1575,12 +2175,12 @@ static result_t run(void) {
           return RESULT_RUNTIME_ERROR;
         }
       }
-    } break;
-    case OP_CLOSE_UPVALUE:
+    } DISPATCH();
+    CASE(OP_CLOSE_UPVALUE):
       close_upvalues(vm.stack_top - 1);
       pop();
-      break;
-    case OP_INHERIT: {
+      DISPATCH();
+    CASE(OP_INHERIT): {
       value_t super_class = peek(1);
       if (!IS_CLASS(super_class)) {
         runtime_error(vm.offset, "Superclass must be a class");
@@ -1589,56 +2189,74 @@ static result_t run(void) {
 
       obj_class_t *sub_class = AS_CLASS(peek(0));
       table_add_all(&AS_CLASS(super_class)->methods, &sub_class->methods);
+      WRITE_BARRIER(sub_class);
+      vm.method_epoch++;
       pop();
-    } break;
-    case OP_ASSERT: {
+    } DISPATCH();
+    CASE(OP_ASSERT): {
       value_t value = pop();
 
       int row = READ_LONG();
       int col = READ_LONG();
-      obj_string_t *file = READ_STRING_LONG();
+      // Only flattened when the assertion fails
+      obj_string_t *file = (obj_string_t *)AS_OBJ(READ_CONSTANT_LONG());
 
       if (is_falsey(value)) {
-        runtime_error(vm.offset, "%s at row:%d col:%d", file->chars, row, col);
+        runtime_error(vm.offset, "%s at row:%d col:%d",
+                      flat_string(file)->chars, row, col);
         set_signal(SIG_ASSERT_FAIL, -1);
         return RESULT_RUNTIME_ERROR;
       }
-    } break;
-    case OP_ASSERT_MSG: {
+    } DISPATCH();
+    CASE(OP_ASSERT_MSG): {
       value_t msg = pop();
       value_t value = pop();
 
       int row = READ_LONG();
       int col = READ_LONG();
-      obj_string_t *file = READ_STRING_LONG();
+      obj_string_t *file = (obj_string_t *)AS_OBJ(READ_CONSTANT_LONG());
 
       if (is_falsey(value)) {
-        runtime_error(vm.offset, "%s at row:%d col:%d\n  %s", file->chars, row,
-                      col, value_to_string(msg, false)->chars);
+        runtime_error(vm.offset, "%s at row:%d col:%d\n  %s",
+                      flat_string(file)->chars, row, col,
+                      value_to_string(msg, false)->chars);
         set_signal(SIG_ASSERT_FAIL, -1);
         return RESULT_RUNTIME_ERROR;
       }
-    } break;
-    case OP_CALL: {
+    } DISPATCH();
+    CASE(OP_CALL): {
       unsigned int argc = READ_BYTE();
       if (!call_value(peek(argc), argc))
         return RESULT_RUNTIME_ERROR;
       UPDATE_FRAME();
-    } break;
-    case OP_LOOP: {
+      JIT_RESUME();
+    } DISPATCH();
+    CASE(OP_CALL_BUILTIN): {
+      unsigned int slot = READ_BYTE();
+      slot |= READ_BYTE() << 8;
+      slot |= READ_BYTE() << 16;
+      uint16_t id = READ_BYTE();
+      id |= READ_BYTE() << 8;
+      unsigned int argc = READ_BYTE();
+      if (!call_builtin(slot, id, argc))
+        return RESULT_RUNTIME_ERROR;
+      UPDATE_FRAME();
+    } DISPATCH();
+    CASE(OP_LOOP): {
       uint16_t offset = READ_SHORT();
       frame->ip -= offset;
-    } break;
-    case OP_JUMP: {
+      JIT_RESUME();
+    } DISPATCH();
+    CASE(OP_JUMP): {
       uint16_t offset = READ_SHORT();
       frame->ip += offset;
-    } break;
-    case OP_JUMP_IF_FALSE: {
+    } DISPATCH();
+    CASE(OP_JUMP_IF_FALSE): {
       uint16_t offset = READ_SHORT();
       if (is_falsey(peek(0)))
         frame->ip += offset;
-    } break;
-    case OP_RETURN: {
+    } DISPATCH();
+    CASE(OP_RETURN): {
       value_t result = pop();
       close_upvalues(frame->slots);
       bool is_module = frame->is_module;
@@ -1651,10 +2269,22 @@ static result_t run(void) {
       vm.stack_top = frame->slots;
       if (!is_module)
         push(result);
+      if (vm.frame_count == base)
+        return RESULT_OK;
       UPDATE_FRAME();
-    } break;
+#ifdef JIT
+      // Only re-enter callers that are compiled already, returns don't count
+      // towards hotness
+      if (frame->closure->function->jit != NULL)
+        JIT_RESUME();
+#endif
+    } DISPATCH();
     }
 
+    // Jumped to by DISPATCH() and JIT_RESUME(), a switch just falls through
+#if defined(USE_COMPUTED_GOTO) || defined(JIT)
+  check_signal:
+#endif
     if (vm.signal != SIG_NONE)
       switch (vm.signal) {
       case SIG_NONE: // Unreachable
@@ -1671,13 +2301,29 @@ static result_t run(void) {
 
     if (vm.update_frame) {
       vm.update_frame = false;
+      drain_cpu_profile();
+      // Between instructions every object is reached through the roots.
+      // Compiled code below a nested loop keeps none in its registers, and
+      // the helper that called into the loop touches none once it returns
+      if (vm.gc_compact_pending)
+        compact_heap();
       UPDATE_FRAME();
     }
   }
+#ifdef USE_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
 
+#undef DISPATCH
+#undef CASE
+#undef SWITCH
+#undef FETCH
+#undef TRACE_INSTRUCTION
+#undef JIT_RESUME
 #undef UPDATE_FRAME
 #undef IS_NUM_OR_FLT
 
+#undef READ_CACHE
 #undef READ_STRING_LONG
 #undef READ_STRING
 #undef READ_CONSTANT_LONG
@@ -1687,6 +2333,304 @@ static result_t run(void) {
 #undef READ_BYTE
 }
 
+#ifdef JIT
+
+// Helpers for compiled code, see jit.h. A helper either completes its
+// instruction, or returns JIT_FALLBACK before touching anything so the
+// interpreter re-runs the instruction and reports the error itself
+
+static bool jit_failed(void) {
+  return vm.signal != SIG_NONE && vm.signal != SIG_TEST_ASSERT_FAIL;
+}
+
+// Runs the frame a call pushed on top of the compiled one until it returns
+static jit_status_t finish_call(int base) {
+  if (vm.frame_count > base) {
+    // Compiled code doesn't keep frame->ip current, profilers walking the
+    // frames of the callee need to know where the caller is
+    call_frame_t *caller = &vm.frames[base - 1];
+    caller->ip = caller->closure->function->chunk.code + vm.offset;
+    vm.jit_depth++;
+    run(base);
+    vm.jit_depth--;
+  }
+  vm.globals = vm.frames[base - 1].globals;
+  return jit_failed() ? JIT_ABORT : JIT_CONTINUE;
+}
+
+static jit_status_t jit_overload(vm_strings_t overload, int argc) {
+  if (vm.jit_depth >= JIT_MAX_DEPTH)
+    return JIT_FALLBACK;
+  int base = vm.frame_count;
+  if (!invoke_overload(overload, argc))
+    return jit_failed() ? JIT_ABORT : JIT_FALLBACK;
+  return finish_call(base);
+}
+
+jit_status_t jit_get_global(unsigned int slot) {
+  value_t value;
+  if (!table_get(&vm.builtins, vm.globals->values[slot].name, &value))
+    return JIT_FALLBACK;
+  push(value);
+  return JIT_CONTINUE;
+}
+
+jit_status_t jit_binary(op_code_t op) {
+  static const vm_strings_t overloads[] = {
+      [OP_ADD] = VM_STR_OVERLOAD_ADD,       [OP_SUB] = VM_STR_OVERLOAD_SUB,
+      [OP_MUL] = VM_STR_OVERLOAD_MUL,       [OP_DIV] = VM_STR_OVERLOAD_DIV,
+      [OP_MOD] = VM_STR_OVERLOAD_MOD,       [OP_SHIFTL] = VM_STR_OVERLOAD_SHIFTL,
+      [OP_SHIFTR] = VM_STR_OVERLOAD_SHIFTR, [OP_BIT_AND] = VM_STR_OVERLOAD_BIT_AND,
+      [OP_BIT_OR] = VM_STR_OVERLOAD_BIT_OR, [OP_XOR] = VM_STR_OVERLOAD_XOR,
+      [OP_EQ] = VM_STR_OVERLOAD_EQ,         [OP_GT] = VM_STR_OVERLOAD_GT,
+      [OP_GE] = VM_STR_OVERLOAD_GE,         [OP_LT] = VM_STR_OVERLOAD_LT,
+      [OP_LE] = VM_STR_OVERLOAD_LE,
+  };
+
+  value_t b = peek(0);
+  value_t a = peek(1);
+  value_t result;
+
+  // Without an overload == falls back to identity, which the interpreter
+  // takes care of
+  if (IS_INSTANCE(a))
+    return jit_overload(overloads[op], 1);
+
+  if (op == OP_EQ) {
+    result = BOOL_VAL(values_equal(a, b));
+  } else if (IS_NUMBER(a) && IS_NUMBER(b)) {
+    int64_t x = AS_NUMBER(a);
+    int64_t y = AS_NUMBER(b);
+    switch (op) {
+    case OP_ADD:
+      result = add_numbers(x, y);
+      break;
+    case OP_SUB:
+      result = sub_numbers(x, y);
+      break;
+    case OP_MUL:
+      result = mul_numbers(x, y);
+      break;
+    case OP_DIV:
+      result = FLOAT_VAL((double)x / (double)y);
+      break;
+    case OP_MOD:
+      result = NUMBER_VAL(x % y);
+      break;
+    case OP_SHIFTL:
+      result = NUMBER_VAL(x << y);
+      break;
+    case OP_SHIFTR:
+      result = NUMBER_VAL(x >> y);
+      break;
+    case OP_BIT_AND:
+      result = NUMBER_VAL(x & y);
+      break;
+    case OP_BIT_OR:
+      result = NUMBER_VAL(x | y);
+      break;
+    case OP_XOR:
+      result = NUMBER_VAL(x ^ y);
+      break;
+    case OP_GT:
+      result = BOOL_VAL(x > y);
+      break;
+    case OP_GE:
+      result = BOOL_VAL(x >= y);
+      break;
+    case OP_LT:
+      result = BOOL_VAL(x < y);
+      break;
+    case OP_LE:
+      result = BOOL_VAL(x <= y);
+      break;
+    default:
+      return JIT_FALLBACK;
+    }
+  } else if ((IS_NUMBER(a) || IS_FLOAT(a)) && (IS_NUMBER(b) || IS_FLOAT(b))) {
+    double x = IS_FLOAT(a) ? AS_FLOAT(a) : (double)AS_NUMBER(a);
+    double y = IS_FLOAT(b) ? AS_FLOAT(b) : (double)AS_NUMBER(b);
+    switch (op) {
+    case OP_ADD:
+      result = FLOAT_VAL(x + y);
+      break;
+    case OP_SUB:
+      result = FLOAT_VAL(x - y);
+      break;
+    case OP_MUL:
+      result = FLOAT_VAL(x * y);
+      break;
+    case OP_DIV:
+      result = FLOAT_VAL(x / y);
+      break;
+    case OP_MOD:
+      result = FLOAT_VAL(fmod(x, y));
+      break;
+    case OP_GT:
+      result = BOOL_VAL(x > y);
+      break;
+    case OP_GE:
+      result = BOOL_VAL(x >= y);
+      break;
+    case OP_LT:
+      result = BOOL_VAL(x < y);
+      break;
+    case OP_LE:
+      result = BOOL_VAL(x <= y);
+      break;
+    default:
+      return JIT_FALLBACK;
+    }
+  } else if (op == OP_ADD && IS_STRING(a) && IS_STRING(b)) {
+    // Allocating may have gone past vm.gc_max_heap
+    concatenate();
+    return jit_failed() ? JIT_ABORT : JIT_CONTINUE;
+  } else
+    return JIT_FALLBACK;
+
+  vm.stack_top--;
+  vm.stack_top[-1] = result;
+  return JIT_CONTINUE;
+}
+
+jit_status_t jit_unary(op_code_t op) {
+  value_t value = peek(0);
+  if (IS_INSTANCE(value)) {
+    vm_strings_t overload = op == OP_NEG       ? VM_STR_OVERLOAD_NEG
+                            : op == OP_LOG_NOT ? VM_STR_OVERLOAD_LOG_NOT
+                                               : VM_STR_OVERLOAD_BIT_NOT;
+    return jit_overload(overload, 0);
+  }
+
+  if (op == OP_NEG && IS_NUMBER(value))
+    vm.stack_top[-1] = NUMBER_VAL(-AS_NUMBER(value));
+  else if (op == OP_NEG && IS_FLOAT(value))
+    vm.stack_top[-1] = FLOAT_VAL(-AS_FLOAT(value));
+  else if (op == OP_LOG_NOT && (IS_NIL(value) || IS_BOOL(value)))
+    vm.stack_top[-1] = BOOL_VAL(is_falsey(value));
+  else if (op == OP_BIT_NOT && IS_NUMBER(value))
+    vm.stack_top[-1] = NUMBER_VAL(~AS_NUMBER(value));
+  else
+    return JIT_FALLBACK;
+  return JIT_CONTINUE;
+}
+
+// Whether get_index() and set_index() can't fail for object and index
+static bool index_in_bounds(value_t object, value_t index, bool store) {
+  if (!IS_NUMBER(index))
+    return false;
+
+  int count = -1;
+  if (IS_VECTOR(object))
+    count = AS_VECTOR(object)->count;
+  else if (IS_ARRAY(object))
+    count = AS_ARRAY(object)->count;
+  else if (IS_LIST(object) && !store)
+    count = AS_LIST(object)->count;
+  else if (IS_STRING(object) && !store)
+    count = AS_STRING(object)->length;
+
+  int i = AS_NUMBER(index);
+  return i >= 0 && i < count;
+}
+
+jit_status_t jit_get_index(void) {
+  value_t index = peek(0);
+  value_t object = peek(1);
+
+  // Slices reshuffle the stack before trying the overload, leave them to the
+  // interpreter
+  if (IS_INSTANCE(object))
+    return IS_RANGE(index) ? JIT_FALLBACK
+                           : jit_overload(VM_STR_OVERLOAD_GET_INDEX, 1);
+  if (!index_in_bounds(object, index, false))
+    return JIT_FALLBACK;
+
+  value_t result = get_index(object, AS_NUMBER(index));
+  vm.stack_top--;
+  vm.stack_top[-1] = result;
+  return JIT_CONTINUE;
+}
+
+jit_status_t jit_set_index(void) {
+  value_t value = peek(0);
+  value_t index = peek(1);
+  value_t object = peek(2);
+
+  if (IS_INSTANCE(object))
+    return IS_RANGE(index) ? JIT_FALLBACK
+                           : jit_overload(VM_STR_OVERLOAD_SET_INDEX, 2);
+  if (!index_in_bounds(object, index, true))
+    return JIT_FALLBACK;
+
+  set_index(object, AS_NUMBER(index), value);
+  vm.stack_top -= 2;
+  vm.stack_top[-1] = value;
+  return JIT_CONTINUE;
+}
+
+jit_status_t jit_get_property(unsigned int name, unsigned int cache) {
+  chunk_t *chunk = &vm.frames[vm.frame_count - 1].closure->function->chunk;
+  obj_string_t *string = AS_STRING(chunk->constants.values[name]);
+  if (!IS_INSTANCE(peek(0)))
+    return JIT_FALLBACK;
+
+  obj_instance_t *instance = AS_INSTANCE(peek(0));
+  value_t value;
+  if ((instance->shape == NULL ||
+       cache_lookup(&chunk->caches[cache], instance->shape) == NULL) &&
+      !instance_get_field(instance, string, &value) &&
+      !table_get(&instance->clas->methods, string, &value))
+    return JIT_FALLBACK;
+
+  get_property(string, &chunk->caches[cache]);
+  return jit_failed() ? JIT_ABORT : JIT_CONTINUE;
+}
+
+jit_status_t jit_set_property(unsigned int name, unsigned int cache) {
+  chunk_t *chunk = &vm.frames[vm.frame_count - 1].closure->function->chunk;
+  if (!IS_INSTANCE(peek(1)))
+    return JIT_FALLBACK;
+
+  set_property(AS_STRING(chunk->constants.values[name]),
+               &chunk->caches[cache]);
+  return jit_failed() ? JIT_ABORT : JIT_CONTINUE;
+}
+
+jit_status_t jit_call(int argc) {
+  if (vm.jit_depth >= JIT_MAX_DEPTH)
+    return JIT_FALLBACK;
+  int base = vm.frame_count;
+  if (!call_value(peek(argc), argc))
+    return jit_failed() ? JIT_ABORT : JIT_FALLBACK;
+  return finish_call(base);
+}
+
+jit_status_t jit_call_builtin(unsigned int slot, int id, int argc) {
+  if (vm.jit_depth >= JIT_MAX_DEPTH)
+    return JIT_FALLBACK;
+  int base = vm.frame_count;
+  if (!call_builtin(slot, id, argc))
+    return jit_failed() ? JIT_ABORT : JIT_FALLBACK;
+  return finish_call(base);
+}
+
+jit_status_t jit_invoke(unsigned int name, int argc, unsigned int cache) {
+  chunk_t *chunk = &vm.frames[vm.frame_count - 1].closure->function->chunk;
+  value_t receiver = peek(argc);
+  if ((!IS_INSTANCE(receiver) && !IS_RESULT(receiver)) ||
+      vm.jit_depth >= JIT_MAX_DEPTH)
+    return JIT_FALLBACK;
+
+  int base = vm.frame_count;
+  if (!invoke_cached(AS_STRING(chunk->constants.values[name]), argc,
+                     &chunk->caches[cache]))
+    return jit_failed() ? JIT_ABORT : JIT_FALLBACK;
+  return finish_call(base);
+}
+
+#endif
+
 result_t interpret(const char *source, const char *file) {
   char *full_path = realpath(file, NULL);
   obj_string_t *full_path_str;
@@ -1703,5 +2647,19 @@ result_t interpret(const char *source, const char *file) {
   push(OBJ_VAL(module));
   call(module->init, 0);
 
-  return run();
+  call_frame_t *frame = &vm.frames[vm.frame_count - 1];
+  if (vm.globals != NULL && frame->globals != NULL)
+    globals_add_all(vm.globals, frame->globals);
+
+  result_t result = run(0);
+  if (vm.heap_snapshot_path != NULL) {
+    // The frame of the script is gone, its globals are only reachable
+    // through the module now
+    push(OBJ_VAL(module));
+    if (!write_heap_snapshot(vm.heap_snapshot_path))
+      fprintf(stderr, "Error: Could not write the heap snapshot to '%s'\n",
+              vm.heap_snapshot_path);
+    pop();
+  }
+  return result;
 }